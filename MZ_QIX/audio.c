@@ -0,0 +1,374 @@
+#include "audio.h"
+#include "mzapo_regs.h"
+#include "mzapo_phys.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NSEC_PER_SEC 1000000000LL
+#define SAMPLE_NS (NSEC_PER_SEC / AUDIO_SAMPLE_RATE)
+#define PWM_PERIOD 4000 ///< In 100 MHz clocks, 25 kHz carrier.
+#define IDLE_DUTY (PWM_PERIOD / 2) ///< Silence, the middle of the range.
+#define RAMP_SAMPLES 256 ///< Samples of a ramp between off and IDLE_DUTY.
+#define MAX_SAMPLES AUDIO_SAMPLE_RATE ///< One second per sound at most.
+#define BLOCK_SIZE 64 ///< Samples mixed at once.
+#define QUEUE_SIZE 16 ///< Has to be a power of two.
+#define VOLUME 8000 ///< Amplitude of one voice, several may be summed.
+
+/// Waveform of a sound effect.
+typedef enum wave_t {
+    WAVE_SQUARE,
+    WAVE_TRIANGLE,
+    WAVE_NOISE
+} wave_t;
+
+/// Precomputed sound.
+typedef struct {
+    int16_t samples[MAX_SAMPLES]; ///< Signed samples.
+    int len; ///< Number of samples.
+} sound_data_t;
+
+/// Sound being played.
+typedef struct {
+    const sound_data_t *sound; ///< Played sound, NULL if the voice is free.
+    int pos; ///< Next sample to be played.
+} voice_t;
+
+static volatile uint8_t *regs = NULL;
+static int regs_fd = -1;
+static sound_data_t sounds[SOUND_COUNT];
+
+static pthread_t mixer;
+static bool mixer_running = false;
+static bool stopping = false; ///< Accessed atomically.
+
+// Single producer, single consumer ring; indices grow forever and are
+// masked on access.
+static uint8_t queue[QUEUE_SIZE];
+static unsigned int queue_head = 0; ///< Next to be read by the mixer.
+static unsigned int queue_tail = 0; ///< Next to be written by audio_play().
+
+/// <------------ Start implementation functions declaration ------------>
+
+/// Renders a tone sweeping between two frequencies with a decaying
+/// envelope and appends it to the given sound.
+/// \param sound Sound to be appended to.
+/// \param wave Waveform of the tone.
+/// \param freq_from Frequency in Hz at the start.
+/// \param freq_to Frequency in Hz at the end.
+/// \param ms Length of the tone in milliseconds.
+static void append_tone(sound_data_t *sound, wave_t wave, int freq_from,
+                        int freq_to, int ms);
+
+/// Precomputes all the sounds.
+static void build_sounds();
+
+/// Writes a register of the audio PWM block.
+/// \param offset Offset of the register.
+/// \param value Value to be written.
+static void write_reg(size_t offset, uint32_t value);
+
+/// Starts voices for all the queued sounds.
+/// \param voices Voices of the mixer.
+static void drain_queue(voice_t *voices);
+
+/// Mixes the playing voices into PWM duty cycles.
+/// \param voices Voices of the mixer.
+/// \param duty Output, BLOCK_SIZE duty cycles.
+/// \return true if any voice was playing, false if the block is silent
+static bool mix_block(voice_t *voices, uint32_t *duty);
+
+/// Writes a duty cycle once its deadline comes.
+/// \param duty Duty cycle to be written.
+/// \param deadline Deadline of the sample, moved on to the next one.
+static void write_sample(uint32_t duty, long long *deadline);
+
+/// Moves the output linearly between two duty cycles, so starting and
+/// stopping the mixer does not click.
+/// \param from Duty cycle at the start.
+/// \param to Duty cycle at the end.
+/// \param deadline Deadline of the first sample, moved on past the ramp.
+static void ramp(uint32_t from, uint32_t to, long long *deadline);
+
+/// Entry point of the mixer thread.
+static void *mixer_main(void *arg);
+
+/// <------------ End implementation functions declaration ------------>
+
+int audio_init(const char *regs_path)
+{
+    build_sounds();
+
+    if (regs_path) {
+        regs_fd = open(regs_path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+        if (regs_fd >= 0 && ftruncate(regs_fd, AUDIOPWM_REG_SIZE) == 0) {
+            void *mem = mmap(NULL, AUDIOPWM_REG_SIZE, PROT_READ | PROT_WRITE,
+                             MAP_SHARED, regs_fd, 0);
+            regs = mem == MAP_FAILED ? NULL : mem;
+        }
+    } else {
+        regs = map_phys_address(AUDIOPWM_REG_BASE_PHYS, AUDIOPWM_REG_SIZE, 0);
+    }
+
+    if (!regs) {
+        if (regs_fd >= 0) {
+            close(regs_fd);
+            regs_fd = -1;
+        }
+        return -1;
+    }
+
+    write_reg(AUDIOPWM_REG_PWMPER_o, PWM_PERIOD);
+    write_reg(AUDIOPWM_REG_PWM_o, 0);
+
+    __atomic_store_n(&stopping, false, __ATOMIC_RELAXED);
+
+    // Late samples are audible, ask for a real-time thread but settle for
+    // a normal one without the privileges.
+    pthread_attr_t attr;
+    struct sched_param param = {
+        .sched_priority = sched_get_priority_min(SCHED_FIFO) + 1
+    };
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+    mixer_running = pthread_create(&mixer, &attr, mixer_main, NULL) == 0
+        || pthread_create(&mixer, NULL, mixer_main, NULL) == 0;
+    pthread_attr_destroy(&attr);
+
+    return 0;
+}
+
+void audio_play(sound_t sound)
+{
+    if (!mixer_running || sound < 0 || sound >= SOUND_COUNT) {
+        return;
+    }
+
+    unsigned int tail = __atomic_load_n(&queue_tail, __ATOMIC_RELAXED);
+    unsigned int head = __atomic_load_n(&queue_head, __ATOMIC_ACQUIRE);
+    if (tail - head == QUEUE_SIZE) {
+        return;
+    }
+
+    queue[tail & (QUEUE_SIZE - 1)] = sound;
+    __atomic_store_n(&queue_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+void audio_cleanup()
+{
+    if (mixer_running) {
+        __atomic_store_n(&stopping, true, __ATOMIC_RELAXED);
+        pthread_join(mixer, NULL);
+        mixer_running = false;
+    }
+
+    if (regs) {
+        write_reg(AUDIOPWM_REG_PWM_o, 0);
+    }
+
+    if (regs_fd >= 0) {
+        munmap((void *)regs, AUDIOPWM_REG_SIZE);
+        close(regs_fd);
+        regs_fd = -1;
+    }
+    regs = NULL;
+}
+
+static void append_tone(sound_data_t *sound, wave_t wave, int freq_from,
+                        int freq_to, int ms)
+{
+    int len = AUDIO_SAMPLE_RATE * ms / 1000;
+    if (len > MAX_SAMPLES - sound->len) {
+        len = MAX_SAMPLES - sound->len;
+    }
+
+    uint32_t phase = 0;
+    uint32_t noise = 0x2545F491;
+    for (int i = 0; i < len; ++i) {
+        int freq = freq_from + (freq_to - freq_from) * i / len;
+        int amplitude = VOLUME * (len - i) / len;
+        int value;
+
+        switch (wave) {
+        case WAVE_SQUARE:
+            value = phase & 0x80000000 ? amplitude : -amplitude;
+            break;
+        case WAVE_TRIANGLE: {
+            // Fold the phase into a ramp going 0 -> 0xffff -> 0.
+            int ramp = (phase >> 15) & 0xffff;
+            ramp = phase & 0x80000000 ? 0xffff - ramp : ramp;
+            value = (ramp - 0x8000) * amplitude / 0x8000;
+            break;
+        }
+        default:
+            noise ^= noise << 13;
+            noise ^= noise >> 17;
+            noise ^= noise << 5;
+            value = (int)(noise % (2 * amplitude + 1)) - amplitude;
+            break;
+        }
+
+        sound->samples[sound->len++] = value;
+        phase += (uint32_t)((4294967296LL * freq) / AUDIO_SAMPLE_RATE);
+    }
+}
+
+static void build_sounds()
+{
+    memset(sounds, 0, sizeof(sounds));
+
+    append_tone(&sounds[SOUND_CAPTURE], WAVE_TRIANGLE, 440, 880, 150);
+
+    append_tone(&sounds[SOUND_HIT], WAVE_NOISE, 0, 0, 60);
+    append_tone(&sounds[SOUND_HIT], WAVE_SQUARE, 220, 110, 200);
+
+    static const int arpeggio[] = {523, 659, 784, 1047};
+    for (int i = 0; i < 4; ++i) {
+        append_tone(&sounds[SOUND_WIN], WAVE_TRIANGLE, arpeggio[i],
+                    arpeggio[i], 150);
+    }
+
+    append_tone(&sounds[SOUND_LOSE], WAVE_SQUARE, 440, 110, 700);
+}
+
+static void write_reg(size_t offset, uint32_t value)
+{
+    *(volatile uint32_t*)(regs + offset) = value;
+}
+
+static void drain_queue(voice_t *voices)
+{
+    unsigned int head = __atomic_load_n(&queue_head, __ATOMIC_RELAXED);
+    unsigned int tail = __atomic_load_n(&queue_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; ++head) {
+        const sound_data_t *sound = &sounds[queue[head & (QUEUE_SIZE - 1)]];
+
+        // Take a free voice, otherwise cut the one closest to its end.
+        int best = 0;
+        for (int i = 0; i < AUDIO_NVOICES; ++i) {
+            if (!voices[i].sound) {
+                best = i;
+                break;
+            }
+            if (voices[i].sound->len - voices[i].pos
+                < voices[best].sound->len - voices[best].pos) {
+                best = i;
+            }
+        }
+        voices[best].sound = sound;
+        voices[best].pos = 0;
+    }
+
+    __atomic_store_n(&queue_head, head, __ATOMIC_RELEASE);
+}
+
+static bool mix_block(voice_t *voices, uint32_t *duty)
+{
+    int32_t mix[BLOCK_SIZE] = {0};
+    bool active = false;
+
+    for (int v = 0; v < AUDIO_NVOICES; ++v) {
+        const sound_data_t *sound = voices[v].sound;
+        if (!sound) {
+            continue;
+        }
+        active = true;
+
+        int n = sound->len - voices[v].pos;
+        n = n < BLOCK_SIZE ? n : BLOCK_SIZE;
+        const int16_t *samples = sound->samples + voices[v].pos;
+        for (int i = 0; i < n; ++i) {
+            mix[i] += samples[i];
+        }
+
+        voices[v].pos += n;
+        if (voices[v].pos >= sound->len) {
+            voices[v].sound = NULL;
+        }
+    }
+
+    for (int i = 0; i < BLOCK_SIZE; ++i) {
+        int32_t s = mix[i] > INT16_MAX ? INT16_MAX
+            : mix[i] < INT16_MIN ? INT16_MIN : mix[i];
+        duty[i] = (uint32_t)(s - INT16_MIN) * PWM_PERIOD >> 16;
+    }
+
+    return active;
+}
+
+static void *mixer_main(void *arg)
+{
+    voice_t voices[AUDIO_NVOICES];
+    uint32_t duty[BLOCK_SIZE];
+    memset(voices, 0, sizeof(voices));
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long deadline = now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+    uint32_t last = IDLE_DUTY;
+
+    ramp(0, IDLE_DUTY, &deadline);
+    while (!__atomic_load_n(&stopping, __ATOMIC_RELAXED)) {
+        drain_queue(voices);
+        bool active = mix_block(voices, duty);
+
+        // Silence stays in the middle of the range, where sounds start and
+        // end, and sleeps through the whole block.
+        int nsamples = active ? BLOCK_SIZE : 1;
+        if (!active) {
+            duty[0] = IDLE_DUTY;
+        }
+
+        for (int i = 0; i < nsamples; ++i) {
+            write_sample(duty[i], &deadline);
+        }
+        last = duty[nsamples - 1];
+        if (!active) {
+            deadline += (BLOCK_SIZE - 1) * SAMPLE_NS;
+        }
+
+        // Preempted for longer than a block, skip the lost samples rather
+        // than playing them all at once.
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long now_ns = now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+        if (now_ns - deadline > BLOCK_SIZE * SAMPLE_NS) {
+            deadline = now_ns;
+        }
+    }
+    ramp(last, 0, &deadline);
+
+    return NULL;
+}
+
+static void write_sample(uint32_t duty, long long *deadline)
+{
+    struct timespec ts = {
+        .tv_sec = *deadline / NSEC_PER_SEC,
+        .tv_nsec = *deadline % NSEC_PER_SEC
+    };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+           == EINTR) {
+    }
+    write_reg(AUDIOPWM_REG_PWM_o, duty);
+    *deadline += SAMPLE_NS;
+}
+
+static void ramp(uint32_t from, uint32_t to, long long *deadline)
+{
+    for (int i = 1; i <= RAMP_SAMPLES; ++i) {
+        write_sample(from + ((int32_t)to - (int32_t)from) * i / RAMP_SAMPLES,
+                     deadline);
+    }
+}
@@ -0,0 +1,46 @@
+/// \file audio.h
+/// Sound effects played through the audio PWM peripheral. Waveforms are
+/// precomputed at start, a real-time mixer thread sums the playing voices
+/// and writes one sample into the PWM duty register per sample period.
+/// Sounds are requested through a lock-free queue, so playing one from the
+/// game loop never blocks.
+
+#ifndef AUDIO_H_INCLUDED
+#define AUDIO_H_INCLUDED
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdbool.h>
+
+#define AUDIO_SAMPLE_RATE 8000 ///< Samples per second.
+#define AUDIO_NVOICES 4 ///< Number of sounds which can play at once.
+#define AUDIO_REGS_ENV "QIX_AUDIO_REGS" ///< Environment variable with a path
+                                        /// of the file used instead of the
+                                        /// register block.
+
+/// Sound effects.
+typedef enum sound_t {
+    SOUND_CAPTURE, ///< Player has captured an area.
+    SOUND_HIT, ///< Player has lost HP.
+    SOUND_WIN, ///< Game is won.
+    SOUND_LOSE, ///< Game is lost.
+    SOUND_COUNT ///< Number of sounds.
+} sound_t;
+
+/// Precomputes the waveforms, maps the audio PWM block and starts the mixer.
+/// \param regs_path Path to a file standing in for the register block,
+/// NULL to map the peripheral. The file is created and sized as needed, so
+/// the mixer can run and be inspected on a machine without the board.
+/// \return 0 on success, -1 if the registers cannot be mapped (sounds are
+/// then silently dropped)
+int audio_init(const char *regs_path);
+
+/// Queues the given sound to be played. Never blocks; if the queue is full
+/// the sound is dropped. Has to be called from one thread only.
+/// \param sound Sound to be played.
+void audio_play(sound_t sound);
+
+/// Stops the mixer, silences the output and unmaps the registers.
+void audio_cleanup();
+
+#endif // AUDIO_H_INCLUDED
@@ -0,0 +1,217 @@
+#include "fb.h"
+
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FB_NEON 1
+#endif
+
+#define FB_LANES 8 ///< Pixels in one NEON register.
+
+/// <------------ Start implementation functions declaration ------------>
+
+/// Fills a run of pixels with one color, four pixels per 64-bit store.
+/// \param dst First pixel.
+/// \param n Number of pixels.
+/// \param color Color of the pixels.
+static void fill_run(rgb565_t *dst, int n, rgb565_t color);
+
+/// <------------ End implementation functions declaration ------------>
+
+#ifdef FB_NEON
+
+void fb_fill(rgb565_t *dst, int stride, int w, int h, rgb565_t color)
+{
+    uint16x8_t v = vdupq_n_u16(color);
+
+    for (int y = 0; y < h; ++y, dst += stride) {
+        int x = 0;
+        for (; x + FB_LANES <= w; x += FB_LANES) {
+            vst1q_u16(dst + x, v);
+        }
+        for (; x < w; ++x) {
+            dst[x] = color;
+        }
+    }
+}
+
+void fb_copy(rgb565_t *dst, int dst_stride, const rgb565_t *src,
+             int src_stride, int w, int h)
+{
+    for (int y = 0; y < h; ++y, dst += dst_stride, src += src_stride) {
+        int x = 0;
+        for (; x + FB_LANES <= w; x += FB_LANES) {
+            vst1q_u16(dst + x, vld1q_u16(src + x));
+        }
+        for (; x < w; ++x) {
+            dst[x] = src[x];
+        }
+    }
+}
+
+int fb_replace(rgb565_t *dst, int stride, int w, int h, rgb565_t old_color,
+               rgb565_t new_color)
+{
+    uint16x8_t old_v = vdupq_n_u16(old_color);
+    uint16x8_t new_v = vdupq_n_u16(new_color);
+    int replaced = 0;
+
+    for (int y = 0; y < h; ++y, dst += stride) {
+        // Matching lanes are all ones, so subtracting them counts them.
+        uint16x8_t count = vdupq_n_u16(0);
+        int x = 0;
+        for (; x + FB_LANES <= w; x += FB_LANES) {
+            uint16x8_t px = vld1q_u16(dst + x);
+            uint16x8_t match = vceqq_u16(px, old_v);
+            vst1q_u16(dst + x, vbslq_u16(match, new_v, px));
+            count = vsubq_u16(count, match);
+        }
+        uint64x2_t sum = vpaddlq_u32(vpaddlq_u16(count));
+        replaced += vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1);
+
+        for (; x < w; ++x) {
+            if (dst[x] == old_color) {
+                dst[x] = new_color;
+                ++replaced;
+            }
+        }
+    }
+
+    return replaced;
+}
+
+bool fb_equal(const rgb565_t *a, int a_stride, const rgb565_t *b,
+              int b_stride, int w, int h)
+{
+    for (int y = 0; y < h; ++y, a += a_stride, b += b_stride) {
+        uint16x8_t diff = vdupq_n_u16(0);
+        int x = 0;
+        for (; x + FB_LANES <= w; x += FB_LANES) {
+            diff = vorrq_u16(diff, veorq_u16(vld1q_u16(a + x),
+                                             vld1q_u16(b + x)));
+        }
+        uint64x2_t diff64 = vreinterpretq_u64_u16(diff);
+        if (vgetq_lane_u64(diff64, 0) | vgetq_lane_u64(diff64, 1)) {
+            return false;
+        }
+
+        for (; x < w; ++x) {
+            if (a[x] != b[x]) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+#else
+
+void fb_fill(rgb565_t *dst, int stride, int w, int h, rgb565_t color)
+{
+    fb_fill_scalar(dst, stride, w, h, color);
+}
+
+void fb_copy(rgb565_t *dst, int dst_stride, const rgb565_t *src,
+             int src_stride, int w, int h)
+{
+    fb_copy_scalar(dst, dst_stride, src, src_stride, w, h);
+}
+
+int fb_replace(rgb565_t *dst, int stride, int w, int h, rgb565_t old_color,
+               rgb565_t new_color)
+{
+    return fb_replace_scalar(dst, stride, w, h, old_color, new_color);
+}
+
+bool fb_equal(const rgb565_t *a, int a_stride, const rgb565_t *b,
+              int b_stride, int w, int h)
+{
+    return fb_equal_scalar(a, a_stride, b, b_stride, w, h);
+}
+
+#endif // FB_NEON
+
+void fb_copy_columns(rgb565_t *dst, int dst_stride, const rgb565_t *src,
+                     int src_stride, int w, int h)
+{
+    // Rows of the destination are written in order, the source is small
+    // enough (a tile) to stay in the cache while it is read across.
+    for (int y = 0; y < h; ++y, dst += dst_stride) {
+        const rgb565_t *column = src + y;
+        for (int x = 0; x < w; ++x, column += src_stride) {
+            dst[x] = *column;
+        }
+    }
+}
+
+void fb_fill_scalar(rgb565_t *dst, int stride, int w, int h,
+                    rgb565_t color)
+{
+    if (w == stride) {
+        fill_run(dst, w * h, color);
+        return;
+    }
+
+    for (int y = 0; y < h; ++y, dst += stride) {
+        fill_run(dst, w, color);
+    }
+}
+
+void fb_copy_scalar(rgb565_t *dst, int dst_stride, const rgb565_t *src,
+                    int src_stride, int w, int h)
+{
+    if (w == dst_stride && w == src_stride) {
+        memcpy(dst, src, (size_t)w * h * sizeof(rgb565_t));
+        return;
+    }
+
+    for (int y = 0; y < h; ++y, dst += dst_stride, src += src_stride) {
+        memcpy(dst, src, w * sizeof(rgb565_t));
+    }
+}
+
+int fb_replace_scalar(rgb565_t *dst, int stride, int w, int h,
+                      rgb565_t old_color, rgb565_t new_color)
+{
+    int replaced = 0;
+
+    for (int y = 0; y < h; ++y, dst += stride) {
+        for (int x = 0; x < w; ++x) {
+            if (dst[x] == old_color) {
+                dst[x] = new_color;
+                ++replaced;
+            }
+        }
+    }
+
+    return replaced;
+}
+
+bool fb_equal_scalar(const rgb565_t *a, int a_stride, const rgb565_t *b,
+                     int b_stride, int w, int h)
+{
+    for (int y = 0; y < h; ++y, a += a_stride, b += b_stride) {
+        if (memcmp(a, b, w * sizeof(rgb565_t))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void fill_run(rgb565_t *dst, int n, rgb565_t color)
+{
+    uint64_t quad = color * 0x0001000100010001ULL;
+
+    for (; n > 0 && (uintptr_t)dst % sizeof(quad); --n) {
+        *dst++ = color;
+    }
+    for (; n >= 4; n -= 4, dst += 4) {
+        memcpy(dst, &quad, sizeof(quad));
+    }
+    for (; n > 0; --n) {
+        *dst++ = color;
+    }
+}
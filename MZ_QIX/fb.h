@@ -0,0 +1,86 @@
+/// \file fb.h
+/// Kernels over rectangles of rgb565 pixels, used by the screen buffer and
+/// the arena. A rectangle is given by its first pixel, the distance between
+/// its rows in pixels (stride), its width and its height; it has to lie
+/// within its buffer, clipping is left to the caller. On ARM with NEON the
+/// kernels process eight pixels per instruction, elsewhere they fall back
+/// to the scalar reference implementations, which are exported so both can
+/// be checked against each other (see qix_bench.c).
+
+#ifndef FB_H_INCLUDED
+#define FB_H_INCLUDED
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "image.h"
+
+#include <stdbool.h>
+
+/// Fills a rectangle with one color.
+/// \param dst First pixel of the rectangle.
+/// \param stride Distance between rows of dst.
+/// \param w Width of the rectangle.
+/// \param h Height of the rectangle.
+/// \param color Color to be filled with.
+void fb_fill(rgb565_t *dst, int stride, int w, int h, rgb565_t color);
+
+/// Copies a rectangle, the source and the destination must not overlap.
+/// \param dst First pixel of the destination.
+/// \param dst_stride Distance between rows of dst.
+/// \param src First pixel of the source.
+/// \param src_stride Distance between rows of src.
+/// \param w Width of the rectangle.
+/// \param h Height of the rectangle.
+void fb_copy(rgb565_t *dst, int dst_stride, const rgb565_t *src,
+             int src_stride, int w, int h);
+
+/// Copies a rectangle of a column-major buffer (columns of src_stride
+/// pixels, like the arena) into a row-major one.
+/// \param dst First pixel of the destination.
+/// \param dst_stride Distance between rows of dst.
+/// \param src First pixel of the source.
+/// \param src_stride Distance between columns of src.
+/// \param w Width of the rectangle.
+/// \param h Height of the rectangle.
+void fb_copy_columns(rgb565_t *dst, int dst_stride, const rgb565_t *src,
+                     int src_stride, int w, int h);
+
+/// Replaces pixels of one color with another in a rectangle.
+/// \param dst First pixel of the rectangle.
+/// \param stride Distance between rows of dst.
+/// \param w Width of the rectangle.
+/// \param h Height of the rectangle.
+/// \param old_color Color to be replaced.
+/// \param new_color Color to replace with.
+/// \return number of replaced pixels
+int fb_replace(rgb565_t *dst, int stride, int w, int h, rgb565_t old_color,
+               rgb565_t new_color);
+
+/// Compares two rectangles.
+/// \param a First pixel of the first rectangle.
+/// \param a_stride Distance between rows of a.
+/// \param b First pixel of the second rectangle.
+/// \param b_stride Distance between rows of b.
+/// \param w Width of the rectangles.
+/// \param h Height of the rectangles.
+/// \return true if the rectangles are the same, false otherwise
+bool fb_equal(const rgb565_t *a, int a_stride, const rgb565_t *b,
+              int b_stride, int w, int h);
+
+/// Scalar reference of fb_fill().
+void fb_fill_scalar(rgb565_t *dst, int stride, int w, int h,
+                    rgb565_t color);
+
+/// Scalar reference of fb_copy().
+void fb_copy_scalar(rgb565_t *dst, int dst_stride, const rgb565_t *src,
+                    int src_stride, int w, int h);
+
+/// Scalar reference of fb_replace().
+int fb_replace_scalar(rgb565_t *dst, int stride, int w, int h,
+                      rgb565_t old_color, rgb565_t new_color);
+
+/// Scalar reference of fb_equal().
+bool fb_equal_scalar(const rgb565_t *a, int a_stride, const rgb565_t *b,
+                     int b_stride, int w, int h);
+
+#endif // FB_H_INCLUDED
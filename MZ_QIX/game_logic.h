@@ -11,9 +11,21 @@
 
 #include <stdbool.h>
 
+#define CAPTURE_BUDGET_ENV "QIX_CAPTURE_US" ///< Environment variable with the
+                                            /// capture budget in microseconds.
+#define CAPTURE_BUDGET_US 1000 ///< Default capture budget of one frame.
+
 /// Initializes game logic. Needs to be called when before new game starts.
 void init_gamelogic();
 
+/// Sets how much time every frame may spend on a capture in progress.
+/// Captures run on the other core and appear at once; only when its thread
+/// cannot be started is the captured area filled progressively over the
+/// following frames, the more budget the faster.
+/// \param budget_us Budget in microseconds, 0 to fill only the minimal part
+/// every step.
+void set_capture_budget(long budget_us);
+
 /// Starts a new game, needs to be initialized first. If not initialized, exits.
 /// Requires initialization of peripherals called by memory_map_boot(),
 /// otherwise behaviour is undefined.
@@ -0,0 +1,303 @@
+#include "highscore.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define RECORD_MAGIC 0x53485851 // "QXHS"
+#define QUEUE_SIZE 64
+#define READ_CHUNK 64
+#define SYNC_DELAY_NS (200 * 1000 * 1000)
+
+/// Record of the journal as stored on the disk.
+typedef struct {
+    uint32_t magic; ///< RECORD_MAGIC.
+    uint32_t score; ///< Final score.
+    int64_t date; ///< When the game has ended (seconds since the epoch).
+    uint32_t play_time_ms; ///< Length of the game in milliseconds.
+    uint16_t fill_permille; ///< Captured part of the arena.
+    uint16_t reserved; ///< Zero.
+    uint32_t reserved2; ///< Zero.
+    uint32_t checksum; ///< CRC-32 of all the previous fields.
+} record_t;
+
+static int fd = -1;
+static off_t journal_size = 0;
+static highscore_t top[HIGHSCORE_TOP_N];
+static int ntop = 0;
+
+static pthread_t writer;
+static bool writer_running = false;
+static bool stopping = false;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static record_t queue[QUEUE_SIZE];
+static int queue_len = 0;
+
+/// <------------ Start implementation functions declaration ------------>
+
+/// Computes CRC-32 of the given data.
+/// \param data Data to be checksummed.
+/// \param len Length of the data in bytes.
+/// \return CRC-32 of the data
+static uint32_t crc32(const void *data, size_t len);
+
+/// Check if the given record is complete and not corrupted.
+/// \param rec Record to be checked.
+/// \return true if the record is valid, false otherwise
+static bool record_valid(const record_t *rec);
+
+/// Inserts the given score into the in-memory table if it is good enough.
+/// Has to be called with lock held (or before the writer is started).
+/// \param entry Score to be inserted.
+static void insert_top(const highscore_t *entry);
+
+/// Reads the whole journal into the in-memory table.
+/// \return number of bytes taken by valid records at the start of the file
+static off_t load_journal();
+
+/// Writes the whole buffer, retrying on short writes.
+/// \param buf Data to be written.
+/// \param len Length of the data in bytes.
+/// \return 0 on success, -1 otherwise
+static int write_all(const void *buf, size_t len);
+
+/// Entry point of the writer thread. Writes queued records in batches and
+/// syncs the journal once per batch.
+static void *writer_main(void *arg);
+
+/// <------------ End implementation functions declaration ------------>
+
+int highscore_open(const char *filepath)
+{
+    ntop = 0;
+    stopping = false;
+
+    fd = open(filepath, O_RDWR | O_CREAT | O_APPEND,
+              S_IRUSR | S_IWUSR | S_IRGRP);
+    if (fd < 0) {
+        return -1;
+    }
+
+    journal_size = load_journal();
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size != journal_size) {
+        // Torn or corrupted tail, appending after it would lose every
+        // following record too.
+        if (ftruncate(fd, journal_size) == 0) {
+            fsync(fd);
+        }
+    }
+
+    writer_running = pthread_create(&writer, NULL, writer_main, NULL) == 0;
+
+    return 0;
+}
+
+void highscore_add(const highscore_t *entry)
+{
+    record_t rec = {
+        .magic = RECORD_MAGIC,
+        .score = entry->score,
+        .date = entry->date,
+        .play_time_ms = entry->play_time_ms,
+        .fill_permille = entry->fill_permille,
+    };
+    rec.checksum = crc32(&rec, offsetof(record_t, checksum));
+
+    pthread_mutex_lock(&lock);
+    insert_top(entry);
+
+    // With the queue full the writer is stuck on the disk; keep the score
+    // in memory at least.
+    if (writer_running && queue_len < QUEUE_SIZE) {
+        queue[queue_len++] = rec;
+        pthread_cond_signal(&cond);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+int highscore_top(highscore_t *entries, int max)
+{
+    pthread_mutex_lock(&lock);
+    int n = ntop < max ? ntop : max;
+    memcpy(entries, top, n * sizeof(highscore_t));
+    pthread_mutex_unlock(&lock);
+
+    return n;
+}
+
+void highscore_close()
+{
+    if (writer_running) {
+        pthread_mutex_lock(&lock);
+        stopping = true;
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&lock);
+
+        pthread_join(writer, NULL);
+        writer_running = false;
+    }
+
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+static uint32_t crc32(const void *data, size_t len)
+{
+    static uint32_t table[256];
+    static bool table_ready = false;
+
+    if (!table_ready) {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        table_ready = true;
+    }
+
+    const uint8_t *bytes = data;
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < len; ++i) {
+        crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc ^ 0xFFFFFFFF;
+}
+
+static bool record_valid(const record_t *rec)
+{
+    return rec->magic == RECORD_MAGIC
+        && rec->checksum == crc32(rec, offsetof(record_t, checksum));
+}
+
+static void insert_top(const highscore_t *entry)
+{
+    int pos = ntop;
+    while (pos > 0 && top[pos - 1].score < entry->score) {
+        --pos;
+    }
+
+    if (pos >= HIGHSCORE_TOP_N) {
+        return;
+    }
+
+    int last = ntop < HIGHSCORE_TOP_N ? ntop : HIGHSCORE_TOP_N - 1;
+    memmove(top + pos + 1, top + pos, (last - pos) * sizeof(highscore_t));
+    top[pos] = *entry;
+    ntop = last + 1;
+}
+
+static off_t load_journal()
+{
+    record_t recs[READ_CHUNK];
+    off_t valid = 0;
+
+    lseek(fd, 0, SEEK_SET);
+    while (true) {
+        ssize_t n = read(fd, recs, sizeof(recs));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+
+        for (size_t i = 0; i < n / sizeof(record_t); ++i) {
+            if (!record_valid(recs + i)) {
+                return valid;
+            }
+
+            highscore_t entry = {
+                .score = recs[i].score,
+                .date = recs[i].date,
+                .play_time_ms = recs[i].play_time_ms,
+                .fill_permille = recs[i].fill_permille,
+            };
+            insert_top(&entry);
+            valid += sizeof(record_t);
+        }
+
+        if (n % sizeof(record_t)) {
+            break;
+        }
+    }
+
+    return valid;
+}
+
+static int write_all(const void *buf, size_t len)
+{
+    const uint8_t *bytes = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, bytes, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bytes += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static void *writer_main(void *arg)
+{
+    record_t batch[QUEUE_SIZE];
+
+    pthread_mutex_lock(&lock);
+    while (true) {
+        while (!queue_len && !stopping) {
+            pthread_cond_wait(&cond, &lock);
+        }
+
+        if (!queue_len && stopping) {
+            break;
+        }
+
+        // Give other records a moment to join this batch, one fsync for all.
+        if (!stopping && queue_len < QUEUE_SIZE) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += SYNC_DELAY_NS;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_nsec -= 1000000000;
+                ++deadline.tv_sec;
+            }
+            pthread_cond_timedwait(&cond, &lock, &deadline);
+        }
+
+        int n = queue_len;
+        memcpy(batch, queue, n * sizeof(record_t));
+        queue_len = 0;
+        pthread_mutex_unlock(&lock);
+
+        if (write_all(batch, n * sizeof(record_t)) == 0) {
+            fsync(fd);
+            journal_size += n * sizeof(record_t);
+        } else if (ftruncate(fd, journal_size) == 0) {
+            // Do not leave a partial record for the next batch to follow.
+            fsync(fd);
+        }
+
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+
+    return NULL;
+}
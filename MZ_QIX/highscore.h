@@ -0,0 +1,47 @@
+/// \file highscore.h
+/// Persistent table of the best scores. Scores are appended as fixed-size,
+/// checksummed records to a journal file by a background thread, so adding
+/// a score never waits for the disk. A torn record left by a power loss is
+/// detected by its checksum and cut off when the journal is opened.
+
+#ifndef HIGHSCORE_H_INCLUDED
+#define HIGHSCORE_H_INCLUDED
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdint.h>
+#include <time.h>
+
+#define HIGHSCORE_TOP_N 10 ///< Number of best scores kept in memory.
+#define HIGHSCORE_FILE "qix_scores.dat" ///< Default journal file.
+
+/// One entry of the table.
+typedef struct {
+    int score; ///< Final score.
+    time_t date; ///< When the game has ended.
+    int play_time_ms; ///< Length of the game in milliseconds.
+    int fill_permille; ///< Captured part of the arena in tenths of percent.
+} highscore_t;
+
+/// Opens the journal, drops a torn record at its end, builds the table of
+/// the best scores and starts the writer thread.
+/// \param filepath Path to the journal, created if it does not exist.
+/// \return 0 on success, -1 if the journal cannot be opened (the table then
+/// works in memory only)
+int highscore_open(const char *filepath);
+
+/// Adds a score into the table and queues it for the writer thread.
+/// Does no I/O.
+/// \param entry Score to be added.
+void highscore_add(const highscore_t *entry);
+
+/// Get the best scores, the best first.
+/// \param entries Output array.
+/// \param max Capacity of the output array.
+/// \return number of entries written into the output array
+int highscore_top(highscore_t *entries, int max);
+
+/// Writes all queued scores, stops the writer thread and closes the journal.
+void highscore_close();
+
+#endif // HIGHSCORE_H_INCLUDED
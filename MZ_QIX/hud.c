@@ -0,0 +1,97 @@
+#include "hud.h"
+
+#include <stdio.h>
+
+static bool visible = false;
+static long long frame_times[HUD_AVG_FRAMES];
+static int nframe_times = 0;
+static int next_frame_time = 0;
+static long long max_frame_ns = 0;
+static long long last_capture_ns = 0;
+static int pushed_frames = 0;
+static long long window_start_ns = 0;
+static text_bitmap_t lines[HUD_LINES];
+
+/// <------------ Start implementation functions declaration ------------>
+
+/// Formats the measurements of the last window into the cached bitmaps and
+/// starts a new window.
+/// \param now_ns Current time of the monotonic clock.
+static void refresh(long long now_ns);
+
+/// <------------ End implementation functions declaration ------------>
+
+void hud_toggle()
+{
+    visible = !visible;
+    window_start_ns = 0;
+}
+
+bool hud_visible()
+{
+    return visible;
+}
+
+void hud_frame(long long now_ns, long long frame_ns, bool pushed)
+{
+    if (!visible) {
+        return;
+    }
+
+    frame_times[next_frame_time] = frame_ns;
+    next_frame_time = (next_frame_time + 1) % HUD_AVG_FRAMES;
+    nframe_times += nframe_times < HUD_AVG_FRAMES;
+    max_frame_ns = frame_ns > max_frame_ns ? frame_ns : max_frame_ns;
+    pushed_frames += pushed;
+
+    if (!window_start_ns) {
+        // Just shown, nothing measured yet.
+        window_start_ns = now_ns;
+        max_frame_ns = 0;
+        pushed_frames = 0;
+        refresh(now_ns);
+    } else if (now_ns - window_start_ns >= HUD_REFRESH_NS) {
+        refresh(now_ns);
+    }
+}
+
+void hud_capture(long long capture_ns)
+{
+    last_capture_ns = capture_ns;
+}
+
+void hud_draw(int x, int y, rgb565_t color)
+{
+    if (!visible) {
+        return;
+    }
+
+    for (int i = 0; i < HUD_LINES; ++i) {
+        draw_text_bitmap(x, y + i * HUD_LINE_HEIGHT, &lines[i], color);
+    }
+}
+
+static void refresh(long long now_ns)
+{
+    long long elapsed = now_ns - window_start_ns;
+    double fps = elapsed > 0 ? pushed_frames * 1e9 / elapsed : 0;
+
+    long long sum = 0;
+    for (int i = 0; i < nframe_times; ++i) {
+        sum += frame_times[i];
+    }
+    double avg_ms = nframe_times ? sum / 1e6 / nframe_times : 0;
+
+    char text[64];
+    snprintf(text, sizeof(text), "FPS %.0f  %.1f/%.1f ms", fps, avg_ms,
+             max_frame_ns / 1e6);
+    render_text_bitmap(&lines[0], text);
+
+    snprintf(text, sizeof(text), "CAP %.1f  LCD %.1f ms",
+             last_capture_ns / 1e6, screen_push_ns() / 1e6);
+    render_text_bitmap(&lines[1], text);
+
+    window_start_ns = now_ns;
+    max_frame_ns = 0;
+    pushed_frames = 0;
+}
@@ -0,0 +1,46 @@
+/// \file hud.h
+/// Performance overlay drawn next to the score: frames per second, average
+/// and worst frame time, cost of the last capture and of the last LCD push.
+/// The text is rendered only a few times per second into cached bitmaps,
+/// drawing it every frame is a plain copy of a few thousand pixels.
+
+#ifndef HUD_H_INCLUDED
+#define HUD_H_INCLUDED
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "mapping.h"
+
+#include <stdbool.h>
+
+#define HUD_REFRESH_NS (250 * 1000 * 1000LL) ///< How often the text changes.
+#define HUD_AVG_FRAMES 32 ///< Frames of the rolling average frame time.
+#define HUD_LINES 2
+#define HUD_LINE_HEIGHT 18
+#define HUD_HEIGHT (HUD_LINES * HUD_LINE_HEIGHT) ///< Height of the overlay.
+
+/// Shows the overlay if it is hidden, hides it otherwise.
+void hud_toggle();
+
+/// Check if the overlay is shown.
+/// \return true if the overlay is shown, false otherwise
+bool hud_visible();
+
+/// Records one iteration of the game loop and refreshes the text when it
+/// is due.
+/// \param now_ns Current time of the monotonic clock.
+/// \param frame_ns Time the iteration has spent working (without sleep).
+/// \param pushed True if the iteration has submitted a frame to the LCD.
+void hud_frame(long long now_ns, long long frame_ns, bool pushed);
+
+/// Records the cost of a capture.
+/// \param capture_ns Length of the step which has done the capture.
+void hud_capture(long long capture_ns);
+
+/// Buffers the overlay into the screen buffer if it is shown.
+/// \param x X-coordinate of the upper left corner of the overlay.
+/// \param y Y-coordinate of the upper left corner of the overlay.
+/// \param color Color of the text.
+void hud_draw(int x, int y, rgb565_t color);
+
+#endif // HUD_H_INCLUDED
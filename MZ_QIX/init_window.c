@@ -1,7 +1,10 @@
 #include "init_window.h"
 #include "mapping.h"
 #include "image.h"
+#include "highscore.h"
+#include "led.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 
@@ -75,17 +78,16 @@ void draw_end_game_screen()
     }
 
     rgb565_t color565 = 0xF2EA;
-    uint32_t color888 = 0xFF0000;
+
+    led_chase(LED_LINE, 0x0f0f0f0f, 100);
+    led_blink(LED_RGB1, 0xFFFFFF, 0xFF0000, 1000);
+    led_blink(LED_RGB2, 0xFFFFFF, 0xFF0000, 1000);
 
     for (int i = 0; i < 10; i++)
     {
         color565 = color565 == 0xF2EA? 0xF75B : 0xF2EA;
-        color888 = color888 == 0xFF0000? 0xFFFFFF : 0xFF0000;
         update_screen();
         print_string_on_screen(100, 130, "YOU LOST!!!", 3, color565);
-        update_led_line(rand());
-        update_led_rgb1(color888);
-        update_led_rgb2(color888);
         clock_nanosleep(CLOCK_MONOTONIC, 0, &loop_delay, NULL);
     }
 }
@@ -101,16 +103,16 @@ void draw_win_game_screen()
     }
 
     rgb565_t color565 = 0x8D8C;
-    uint32_t color888 = 0x00FF00;
+
+    led_chase(LED_LINE, 0x11111111, 60);
+    led_blink(LED_RGB1, 0xFFFFFF, 0x00FF00, 1000);
+    led_blink(LED_RGB2, 0xFFFFFF, 0x00FF00, 1000);
+
     for (int i = 0; i < 10; i++)
     {
         color565 = color565 == 0x8D8C? 0xF75B : 0x8D8C;
-        color888 = color888 == 0x00FF00? 0xFFFFFF : 0x00FF00;
         update_screen();
         print_string_on_screen(100, 130, "YOU WON!!!", 3, color565);
-        update_led_line(rand());
-        update_led_rgb1(color888);
-        update_led_rgb2(color888);
         clock_nanosleep(CLOCK_MONOTONIC, 0, &loop_delay, NULL);
     }
     
@@ -132,9 +134,31 @@ void draw_top_scores_screen()
 {
     struct timespec loop_delay = {.tv_sec = 0, .tv_nsec = 1 * 1000 * 1000};
 
+    highscore_t scores[HIGHSCORE_TOP_N];
+    int nscores = highscore_top(scores, HIGHSCORE_TOP_N);
+
     fill_screen(0);
-    print_string_on_screen(50, 100, "Not yet implemented", 2, 0xffff);
-    print_string_on_screen(50, 150, "Press any key to exit", 2, 0xffff);
+    print_string_on_screen(150, 10, "Top Scores", 2, 0xffff);
+
+    if (nscores == 0) {
+        print_string_on_screen(50, 100, "No games played yet", 2, 0xffff);
+    }
+
+    for (int i = 0; i < nscores; ++i) {
+        char line[64];
+        char date[16];
+        struct tm tm;
+        localtime_r(&scores[i].date, &tm);
+        strftime(date, sizeof(date), "%Y-%m-%d", &tm);
+
+        snprintf(line, sizeof(line), "%2d. %6d  %3d.%d%%  %4d s  %s", i + 1,
+                 scores[i].score, scores[i].fill_permille / 10,
+                 scores[i].fill_permille % 10,
+                 scores[i].play_time_ms / 1000, date);
+        print_string_on_screen(20, 50 + i * 22, line, 1, 0xffff);
+    }
+
+    print_string_on_screen(20, 290, "Press any key to exit", 1, 0xffff);
     update_screen();
 
     while (true) {
@@ -155,9 +179,11 @@ void draw_credits_screen()
 
     fill_screen(0);
 
-    int r = 0;
     rgb565_t color565 = 0x8D8C;
-    uint32_t color888 = 0x00FF00;
+
+    led_chase(LED_LINE, 0x000f000f, 150);
+    led_fade(LED_RGB1, 0x00FF00, 0xFFFFFF, 1000, true);
+    led_fade(LED_RGB2, 0xFFFFFF, 0x00FF00, 1000, true);
 
     while (true) {
         print_string_on_screen(10, 50, "Students: Vadim Mychko, Trenin Egor", 1, color565);
@@ -165,15 +191,9 @@ void draw_credits_screen()
         print_string_on_screen(10, 110, "             RNDr. Petr Stepan, Ph.D", 1, color565);
         print_string_on_screen(10, 140, "CVUT, Otevrena Informatika, 1. rok, APO35", 1, color565);
 
-        update_led_line(r);
-        update_led_rgb1(color888);
-        update_led_rgb2(color888);
-
         if (anim_counter_copy-- < 0) {
             color565 = color565 == 0x8D8C? 0xF75B : 0x8D8C;
-            color888 = color888 == 0x00FF00? 0xFFFFFF : 0x00FF00;
             anim_counter_copy = menu_anim_counter;
-            r = rand();
         }
 
         draw_rect(205, 250, 100, 70, 0);
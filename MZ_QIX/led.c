@@ -0,0 +1,271 @@
+#include "led.h"
+#include "mapping.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#define NSEC_PER_MSEC 1000000LL
+#define NSEC_PER_SEC 1000000000LL
+
+/// Animation being played on one channel.
+typedef struct {
+    led_anim_t anim; ///< The animation.
+    long long started_ms; ///< When the animation was posted.
+} led_playing_t;
+
+static pthread_t animator;
+static bool animator_running = false;
+static bool stopping = false;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static led_playing_t playing[LED_NCHANNELS];
+
+/// <------------ Start implementation functions declaration ------------>
+
+/// Get the current time of the monotonic clock.
+/// \return time in milliseconds
+static long long monotonic_ms();
+
+/// Interpolates every byte of two values.
+/// \param a Value at t = 0.
+/// \param b Value at t = len.
+/// \param t Position between the values.
+/// \param len Length of the interpolation.
+/// \return interpolated value
+static uint32_t lerp_bytes(uint32_t a, uint32_t b, long long t, long long len);
+
+/// Computes the value of the given animation at the given time.
+/// \param anim Animation to be evaluated.
+/// \param t Time in milliseconds since the animation was posted.
+/// \return value of the channel
+static uint32_t evaluate(const led_anim_t *anim, long long t);
+
+/// Writes the given value onto the given channel.
+/// \param channel Channel to be written.
+/// \param value Value to be written.
+static void write_channel(led_channel_t channel, uint32_t value);
+
+/// Entry point of the animation thread. Evaluates all the channels every
+/// LED_TICK_MS.
+static void *animator_main(void *arg);
+
+/// <------------ End implementation functions declaration ------------>
+
+void led_init()
+{
+    stopping = false;
+    for (int i = 0; i < LED_NCHANNELS; ++i) {
+        led_set(i, 0);
+    }
+
+    animator_running = pthread_create(&animator, NULL, animator_main, NULL)
+        == 0;
+}
+
+void led_cleanup()
+{
+    if (animator_running) {
+        pthread_mutex_lock(&lock);
+        stopping = true;
+        pthread_mutex_unlock(&lock);
+
+        pthread_join(animator, NULL);
+        animator_running = false;
+    }
+
+    for (int i = 0; i < LED_NCHANNELS; ++i) {
+        write_channel(i, 0);
+    }
+}
+
+void led_post(led_channel_t channel, const led_anim_t *anim)
+{
+    led_anim_t copy;
+    memset(&copy, 0, sizeof(copy));
+    copy.kind = anim->kind;
+    copy.fade = anim->fade;
+    copy.loop = anim->loop;
+    copy.nkeyframes = anim->nkeyframes > LED_MAX_KEYFRAMES ? LED_MAX_KEYFRAMES
+        : anim->nkeyframes < 1 ? 1 : anim->nkeyframes;
+    memcpy(copy.keyframes, anim->keyframes,
+           copy.nkeyframes * sizeof(led_keyframe_t));
+
+    pthread_mutex_lock(&lock);
+    // Reposting the same animation must not restart it.
+    if (memcmp(&playing[channel].anim, &copy, sizeof(copy))) {
+        memcpy(&playing[channel].anim, &copy, sizeof(copy));
+        playing[channel].started_ms = monotonic_ms();
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (!animator_running) {
+        write_channel(channel, evaluate(&copy, 0));
+    }
+}
+
+void led_set(led_channel_t channel, uint32_t value)
+{
+    led_anim_t anim = {
+        .kind = LED_ANIM_KEYFRAMES,
+        .nkeyframes = 1,
+        .keyframes = {{value, 0}}
+    };
+    led_post(channel, &anim);
+}
+
+void led_blink(led_channel_t channel, uint32_t a, uint32_t b, int period_ms)
+{
+    led_anim_t anim = {
+        .kind = LED_ANIM_KEYFRAMES,
+        .loop = true,
+        .nkeyframes = 2,
+        .keyframes = {{a, period_ms}, {b, period_ms}}
+    };
+    led_post(channel, &anim);
+}
+
+void led_chase(led_channel_t channel, uint32_t pattern, int step_ms)
+{
+    led_anim_t anim = {
+        .kind = LED_ANIM_CHASE,
+        .loop = true,
+        .nkeyframes = 1,
+        .keyframes = {{pattern, step_ms}}
+    };
+    led_post(channel, &anim);
+}
+
+void led_fade(led_channel_t channel, uint32_t from, uint32_t to,
+              int duration_ms, bool loop)
+{
+    led_anim_t anim = {
+        .kind = LED_ANIM_KEYFRAMES,
+        .fade = true,
+        .loop = loop,
+        .nkeyframes = 2,
+        .keyframes = {{from, duration_ms}, {to, loop ? duration_ms : 0}}
+    };
+    led_post(channel, &anim);
+}
+
+static long long monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000 + ts.tv_nsec / NSEC_PER_MSEC;
+}
+
+static uint32_t lerp_bytes(uint32_t a, uint32_t b, long long t, long long len)
+{
+    uint32_t value = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        long long from = (a >> shift) & 0xff;
+        long long to = (b >> shift) & 0xff;
+        value |= (uint32_t)(from + (to - from) * t / len) << shift;
+    }
+
+    return value;
+}
+
+static uint32_t evaluate(const led_anim_t *anim, long long t)
+{
+    const led_keyframe_t *kf = anim->keyframes;
+    int n = anim->nkeyframes;
+
+    if (n < 1) {
+        return 0;
+    }
+
+    if (anim->kind == LED_ANIM_CHASE) {
+        if (kf[0].duration_ms <= 0) {
+            return kf[0].value;
+        }
+        int step = (t / kf[0].duration_ms) % 32;
+        return step ? kf[0].value << step | kf[0].value >> (32 - step)
+            : kf[0].value;
+    }
+
+    long long total = 0;
+    for (int i = 0; i < n; ++i) {
+        total += kf[i].duration_ms > 0 ? kf[i].duration_ms : 0;
+    }
+
+    if (total == 0) {
+        return kf[n - 1].value;
+    }
+
+    if (anim->loop) {
+        t %= total;
+    } else if (t >= total) {
+        return kf[n - 1].value;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        long long len = kf[i].duration_ms > 0 ? kf[i].duration_ms : 0;
+        if (t < len) {
+            int next = i + 1 < n ? i + 1 : anim->loop ? 0 : i;
+            return anim->fade ? lerp_bytes(kf[i].value, kf[next].value, t, len)
+                : kf[i].value;
+        }
+        t -= len;
+    }
+
+    return kf[n - 1].value;
+}
+
+static void write_channel(led_channel_t channel, uint32_t value)
+{
+    switch (channel) {
+    case LED_LINE:
+        update_led_line(value);
+        break;
+    case LED_RGB1:
+        update_led_rgb1(value);
+        break;
+    case LED_RGB2:
+        update_led_rgb2(value);
+        break;
+    default:
+        break;
+    }
+}
+
+static void *animator_main(void *arg)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+    while (true) {
+        uint32_t values[LED_NCHANNELS];
+
+        pthread_mutex_lock(&lock);
+        if (stopping) {
+            pthread_mutex_unlock(&lock);
+            break;
+        }
+        long long now = monotonic_ms();
+        for (int i = 0; i < LED_NCHANNELS; ++i) {
+            values[i] = evaluate(&playing[i].anim,
+                                 now - playing[i].started_ms);
+        }
+        pthread_mutex_unlock(&lock);
+
+        // Unchanged values cost nothing, mapping keeps shadow copies.
+        for (int i = 0; i < LED_NCHANNELS; ++i) {
+            write_channel(i, values[i]);
+        }
+
+        deadline.tv_nsec += LED_TICK_MS * NSEC_PER_MSEC;
+        if (deadline.tv_nsec >= NSEC_PER_SEC) {
+            deadline.tv_nsec -= NSEC_PER_SEC;
+            ++deadline.tv_sec;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline,
+                               NULL) == EINTR) {
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,87 @@
+/// \file led.h
+/// LED animation engine. Game code posts what the LEDs should show (an
+/// intent: a static value, blink, chase or fade) and a timer thread plays
+/// it. Registers are only written when their value changes.
+
+#ifndef LED_H_INCLUDED
+#define LED_H_INCLUDED
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LED_MAX_KEYFRAMES 8 ///< Maximum number of keyframes of an animation.
+#define LED_TICK_MS 10 ///< Period of the animation thread.
+
+/// LED outputs which can be animated.
+typedef enum led_channel_t {
+    LED_LINE, ///< Row of 32 yellow LEDs.
+    LED_RGB1, ///< Left-most RGB LED (rgb888).
+    LED_RGB2, ///< Right-most RGB LED (rgb888).
+    LED_NCHANNELS ///< Number of channels.
+} led_channel_t;
+
+/// Kind of an animation.
+typedef enum led_anim_kind_t {
+    LED_ANIM_KEYFRAMES, ///< Plays keyframes, optionally fading between them.
+    LED_ANIM_CHASE ///< Rotates the value of the first keyframe left by one
+                   /// bit every duration_ms of the first keyframe.
+} led_anim_kind_t;
+
+/// One keyframe of an animation.
+typedef struct {
+    uint32_t value; ///< Value of the channel.
+    int duration_ms; ///< How long until the next keyframe.
+} led_keyframe_t;
+
+/// Animation of one channel.
+typedef struct {
+    led_anim_kind_t kind; ///< Kind of the animation.
+    bool fade; ///< Interpolate every byte between keyframes.
+    bool loop; ///< Start over after the last keyframe, otherwise the last
+               /// keyframe is held.
+    int nkeyframes; ///< Number of keyframes.
+    led_keyframe_t keyframes[LED_MAX_KEYFRAMES]; ///< The keyframes.
+} led_anim_t;
+
+/// Starts the animation thread. Requires memory_map_boot() to be called.
+void led_init();
+
+/// Stops the animation thread and turns all LEDs off.
+void led_cleanup();
+
+/// Plays the given animation on the given channel. Posting the animation
+/// which is already playing does nothing, so it can be posted every frame.
+/// \param channel Channel to be animated.
+/// \param anim Animation to be played.
+void led_post(led_channel_t channel, const led_anim_t *anim);
+
+/// Shows a static value on the given channel.
+/// \param channel Channel to be set.
+/// \param value Value to be shown.
+void led_set(led_channel_t channel, uint32_t value);
+
+/// Blinks the given channel between two values.
+/// \param channel Channel to be animated.
+/// \param a First value.
+/// \param b Second value.
+/// \param period_ms How long each value is shown.
+void led_blink(led_channel_t channel, uint32_t a, uint32_t b, int period_ms);
+
+/// Rotates the given bit pattern on the given channel.
+/// \param channel Channel to be animated.
+/// \param pattern Bit pattern to be rotated.
+/// \param step_ms How long until the pattern moves by one bit.
+void led_chase(led_channel_t channel, uint32_t pattern, int step_ms);
+
+/// Fades the given channel from one value to another.
+/// \param channel Channel to be animated.
+/// \param from Starting value.
+/// \param to Final value.
+/// \param duration_ms Length of the fade.
+/// \param loop If true, fades back and forth forever.
+void led_fade(led_channel_t channel, uint32_t from, uint32_t to,
+              int duration_ms, bool loop);
+
+#endif // LED_H_INCLUDED
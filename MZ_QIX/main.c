@@ -10,6 +10,12 @@
 #include "mapping.h"
 #include "game_logic.h"
 #include "init_window.h"
+#include "highscore.h"
+#include "led.h"
+#include "audio.h"
+#include "trace.h"
+#include "perfcnt.h"
+#include "stats.h"
 
 /// Structure for representing selected menu.
 typedef enum selection_t {
@@ -19,7 +25,6 @@ typedef enum selection_t {
     CREDITS ///< If "Credits" is selected.
 } selection_t;
 
-static int LED_counter = 3;
 static jmp_buf buf;
 static input_t last_input = NO_INPUT;
 static selection_t cur_menu = 0;
@@ -35,7 +40,16 @@ void show_next_selection();
 /// Main entry point. Shows initial menu.
 int main()
 {
+    trace_open(getenv(TRACE_ENV));
+    perfcnt_init(getenv(PERFCNT_ENV) != NULL);
+    stats_open();
     memory_map_boot();
+    highscore_open(HIGHSCORE_FILE);
+    led_init();
+    audio_init(getenv(AUDIO_REGS_ENV));
+    if (getenv(CAPTURE_BUDGET_ENV)) {
+        set_capture_budget(atol(getenv(CAPTURE_BUDGET_ENV)));
+    }
     init_starting_menu();
 
     setjmp(buf);
@@ -60,6 +74,12 @@ int main()
     }
 
     cleanup_starting_menu();
+    audio_cleanup();
+    led_cleanup();
+    highscore_close();
+    trace_close();
+    stats_close();
+    perfcnt_report();
 
     return 0;
 }
@@ -69,6 +89,10 @@ void show_menu_until_selected()
     cur_menu = 0;
     draw_starting_menu(cur_menu);
 
+    led_chase(LED_LINE, 0x80808080, 120);
+    led_fade(LED_RGB1, 0xFF0000, 0x0000FF, 1500, true);
+    led_fade(LED_RGB2, 0x0000FF, 0xFF0000, 1500, true);
+
     while (true) {
         last_input = input_handler();
         if (last_input == UP || last_input == DOWN) {
@@ -86,13 +110,6 @@ void show_menu_until_selected()
             break;
         }
 
-        if (LED_counter-- < 0){
-            update_led_rgb1(rand());
-            update_led_rgb2(rand());
-            update_led_line(rand());
-            LED_counter = 3;
-        }
-
         clock_nanosleep(CLOCK_MONOTONIC, 0, &loop_delay, NULL);
     }
 }
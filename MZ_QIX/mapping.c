@@ -4,24 +4,278 @@
 #include "mzapo_parlcd.h"
 #include "font_types.h"
 #include "game_logic.h"
+#include "trace.h"
+#include "perfcnt.h"
+#include "fb.h"
 
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <time.h>
 
 #define PX_SEPARATOR 5
 #define PX_BORDER 20
 #define PX_NEWLINE 10
+#define PX_TEXT_BITMAP_SEPARATOR 1
+#define MAX_PARTIAL_TILES (SCREEN_TILES / 2) ///< More changed tiles than
+                                            /// this push the whole frame.
 
 static byte *parlcd_mem_base = NULL;
 static byte *mem_base = NULL;
 static rgb565_t current_screen[SCREEN_SIZE];
+static rgb565_t pushed_screen[SCREEN_SIZE];
+static uint8_t screen_dirty[SCREEN_TILES]; ///< Non-zero for tiles of
+                                           /// current_screen written since
+                                           /// the last submit.
 static font_descriptor_t *fdes = &font_winFreeSystem14x16;
 uint32_t knobs_val = 0;
 uint32_t prev_knobs_val = 0;
 
 static bool booted = false;
+static bool headless = false; ///< Booted without peripherals.
+
+/// Indices into led_shadow.
+enum {
+    LED_SHADOW_LINE,
+    LED_SHADOW_RGB1,
+    LED_SHADOW_RGB2,
+    LED_SHADOW_COUNT
+};
+
+static uint32_t led_shadow[LED_SHADOW_COUNT]; ///< Last values written.
+static bool led_shadow_valid[LED_SHADOW_COUNT]; ///< False until the first
+                                                /// write, registers start
+                                                /// in an unknown state.
+
+static pthread_t pusher;
+static bool pusher_running = false; ///< False if the pusher thread could
+                                    /// not be started, frames are then
+                                    /// pushed by the submitting thread.
+static pthread_mutex_t push_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t push_cond = PTHREAD_COND_INITIALIZER;
+static bool push_pending = false;
+static long long last_push_ns = 0; ///< Accessed atomically.
+static bool lcd_synced = false; ///< True once the LCD holds pushed_screen.
+static bool push_full = true; ///< Push the whole frame, not push_tiles.
+static uint16_t push_tiles[SCREEN_TILES]; ///< Changed tiles, ascending.
+static int npush_tiles = 0; ///< Number of push_tiles.
+
+/// <------------ Start implementation functions declaration ------------>
+
+/// Clips a rectangle to the screen.
+/// \param x X-coordinate of the upper left corner.
+/// \param y Y-coordinate of the upper left corner.
+/// \param w Width of the rectangle.
+/// \param h Height of the rectangle.
+/// \param clipped Output, the visible part [x1, x2) x [y1, y2) as
+/// {x1, y1, x2, y2}.
+/// \return true if any part of the rectangle is visible, false otherwise
+static bool clip_rect(int x, int y, int w, int h, int clipped[4]);
+
+/// Marks the tiles of current_screen overlapping a rectangle as written.
+/// \param x1 First column, clipped.
+/// \param y1 First row, clipped.
+/// \param x2 Column after the last one, clipped.
+/// \param y2 Row after the last one, clipped.
+static void mark_dirty(int x1, int y1, int x2, int y2);
+
+/// Copies a tile of current_screen into pushed_screen.
+/// \param tile Index of the tile.
+/// \return true if the tile has changed, false otherwise
+static bool copy_tile(int tile);
+
+/// Sets the rectangle of the LCD the following pixels are written into and
+/// starts writing.
+/// \param x X-coordinate of the upper left corner.
+/// \param y Y-coordinate of the upper left corner.
+/// \param w Width of the rectangle.
+/// \param h Height of the rectangle.
+static void lcd_window(int x, int y, int w, int h);
+
+/// Pushes the changed tiles of pushed_screen, horizontal runs of them as
+/// one window each.
+static void push_changed_tiles();
+
+/// Pushes pushed_screen onto the LCD, whole or its changed tiles, and
+/// records how long it took.
+static void push_screen();
+
+/// <------------ End implementation functions declaration ------------>
+
+/// Pushes pushed_screen onto the LCD whenever a new frame is submitted.
+static void *screen_pusher(void *arg)
+{
+    trace_thread_name("lcd_push");
+
+    pthread_mutex_lock(&push_lock);
+    while (true) {
+        while (!push_pending) {
+            pthread_cond_wait(&push_cond, &push_lock);
+        }
+        pthread_mutex_unlock(&push_lock);
+
+        push_screen();
+
+        pthread_mutex_lock(&push_lock);
+        push_pending = false;
+        pthread_cond_broadcast(&push_cond);
+    }
+
+    return NULL;
+}
+
+/// Writes the given LED register unless it already holds the value.
+/// Uncached MMIO stores are slow, most frames do not change the LEDs.
+static void write_led(size_t offset, int shadow, uint32_t value)
+{
+    if (!booted || headless) {
+        return;
+    }
+
+    if (led_shadow_valid[shadow] && led_shadow[shadow] == value) {
+        return;
+    }
+
+    *(volatile uint32_t*)(mem_base + offset) = value;
+    led_shadow[shadow] = value;
+    led_shadow_valid[shadow] = true;
+}
+
+/// Hands the screen buffer over to the pusher thread. Only tiles written
+/// since the last submit are compared and copied, the pusher then sends just
+/// the ones which have changed. If the pusher thread is not running, the
+/// frame is pushed before returning. Has to be called with push_lock held
+/// and no push pending.
+static void submit_screen()
+{
+    npush_tiles = 0;
+    for (int tile = 0; tile < SCREEN_TILES; ++tile) {
+        if (screen_dirty[tile]) {
+            screen_dirty[tile] = 0;
+            if (copy_tile(tile)) {
+                push_tiles[npush_tiles++] = tile;
+            }
+        }
+    }
+
+    // Until the first push the content of the LCD is unknown.
+    push_full = !lcd_synced || npush_tiles > MAX_PARTIAL_TILES;
+    lcd_synced = true;
+    if (npush_tiles == 0 && !push_full) {
+        return;
+    }
+
+    // Without the pusher thread the frame is pushed right away.
+    if (!pusher_running) {
+        push_screen();
+        return;
+    }
+
+    push_pending = true;
+    pthread_cond_broadcast(&push_cond);
+}
+
+static void mark_dirty(int x1, int y1, int x2, int y2)
+{
+    for (int ty = y1 / SCREEN_TILE_SIZE; ty * SCREEN_TILE_SIZE < y2; ++ty) {
+        for (int tx = x1 / SCREEN_TILE_SIZE; tx * SCREEN_TILE_SIZE < x2;
+             ++tx) {
+            screen_dirty[ty * SCREEN_TILES_X + tx] = 1;
+        }
+    }
+}
+
+static bool clip_rect(int x, int y, int w, int h, int clipped[4])
+{
+    clipped[0] = x < 0 ? 0 : x;
+    clipped[1] = y < 0 ? 0 : y;
+    clipped[2] = x + w < SCREEN_WIDTH ? x + w : SCREEN_WIDTH;
+    clipped[3] = y + h < SCREEN_HEIGHT ? y + h : SCREEN_HEIGHT;
+
+    return clipped[0] < clipped[2] && clipped[1] < clipped[3];
+}
+
+static bool copy_tile(int tile)
+{
+    int x = tile % SCREEN_TILES_X * SCREEN_TILE_SIZE;
+    int y = tile / SCREEN_TILES_X * SCREEN_TILE_SIZE;
+    rgb565_t *pushed = pushed_screen + y * SCREEN_WIDTH + x;
+    const rgb565_t *current = current_screen + y * SCREEN_WIDTH + x;
+
+    if (fb_equal(pushed, SCREEN_WIDTH, current, SCREEN_WIDTH,
+                 SCREEN_TILE_SIZE, SCREEN_TILE_SIZE)) {
+        return false;
+    }
+
+    fb_copy(pushed, SCREEN_WIDTH, current, SCREEN_WIDTH, SCREEN_TILE_SIZE,
+            SCREEN_TILE_SIZE);
+
+    return true;
+}
+
+static void lcd_window(int x, int y, int w, int h)
+{
+    parlcd_write_cmd(parlcd_mem_base, 0x2b);
+    parlcd_write_data(parlcd_mem_base, y >> 8);
+    parlcd_write_data(parlcd_mem_base, y & 0xff);
+    parlcd_write_data(parlcd_mem_base, (y + h - 1) >> 8);
+    parlcd_write_data(parlcd_mem_base, (y + h - 1) & 0xff);
+
+    parlcd_write_cmd(parlcd_mem_base, 0x2a);
+    parlcd_write_data(parlcd_mem_base, x >> 8);
+    parlcd_write_data(parlcd_mem_base, x & 0xff);
+    parlcd_write_data(parlcd_mem_base, (x + w - 1) >> 8);
+    parlcd_write_data(parlcd_mem_base, (x + w - 1) & 0xff);
+
+    parlcd_write_cmd(parlcd_mem_base, 0x2c);
+}
+
+static void push_changed_tiles()
+{
+    for (int i = 0; i < npush_tiles;) {
+        // Join tiles following each other in one row of tiles.
+        int first = push_tiles[i], last = first;
+        for (++i; i < npush_tiles && push_tiles[i] == last + 1
+             && push_tiles[i] % SCREEN_TILES_X != 0; ++i) {
+            last = push_tiles[i];
+        }
+
+        int x1 = first % SCREEN_TILES_X * SCREEN_TILE_SIZE;
+        int x2 = (last % SCREEN_TILES_X + 1) * SCREEN_TILE_SIZE;
+        int y = first / SCREEN_TILES_X * SCREEN_TILE_SIZE;
+        lcd_window(x1, y, x2 - x1, SCREEN_TILE_SIZE);
+        for (int sy = y; sy < y + SCREEN_TILE_SIZE; ++sy) {
+            const rgb565_t *row = pushed_screen + sy * SCREEN_WIDTH;
+            for (int sx = x1; sx < x2; ++sx) {
+                parlcd_write_data(parlcd_mem_base, row[sx]);
+            }
+        }
+    }
+}
+
+static void push_screen()
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    trace_begin("lcd_push");
+    perfcnt_begin(PERFCNT_LCD_PUSH);
+    if (push_full) {
+        lcd_window(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+        for (int i = 0; i < SCREEN_SIZE; ++i) {
+            parlcd_write_data(parlcd_mem_base, pushed_screen[i]);
+        }
+    } else {
+        push_changed_tiles();
+    }
+    perfcnt_end(PERFCNT_LCD_PUSH);
+    trace_end("lcd_push");
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    __atomic_store_n(&last_push_ns, (end.tv_sec - start.tv_sec)
+                     * 1000000000LL + end.tv_nsec - start.tv_nsec,
+                     __ATOMIC_RELAXED);
+}
 
 void memory_map_boot()
 {
@@ -29,6 +283,14 @@ void memory_map_boot()
     parlcd_hx8357_init(parlcd_mem_base);
     mem_base = map_phys_address(SPILED_REG_BASE_PHYS, SPILED_REG_SIZE, 0);
 
+    pusher_running = pthread_create(&pusher, NULL, screen_pusher, NULL) == 0;
+
+    booted = true;
+}
+
+void memory_map_boot_headless()
+{
+    headless = true;
     booted = true;
 }
 
@@ -39,6 +301,8 @@ void draw_pixel(int x, int y, rgb565_t color)
     }
 
     current_screen[y * SCREEN_WIDTH + x] = color;
+    screen_dirty[y / SCREEN_TILE_SIZE * SCREEN_TILES_X
+                 + x / SCREEN_TILE_SIZE] = 1;
 }
 
 void draw_pixel_big(int x, int y, int scale, rgb565_t color)
@@ -60,11 +324,9 @@ void draw_img(const img_t *img)
         return;
     }
 
-    const rgb565_t *pxs = img->pxs;
-
-    for (int i = 0; i < SCREEN_SIZE; ++i) {
-        current_screen[i] = pxs[i];
-    }
+    fb_copy(current_screen, SCREEN_WIDTH, (const rgb565_t *)img->pxs,
+            SCREEN_WIDTH, SCREEN_WIDTH, SCREEN_HEIGHT);
+    memset(screen_dirty, 1, sizeof(screen_dirty));
 }
 
 void draw_img_on_coord(int coord_x, int coord_y, const img_t *img)
@@ -73,25 +335,87 @@ void draw_img_on_coord(int coord_x, int coord_y, const img_t *img)
         return;
     }
 
-    const rgb565_t *pxs = img->pxs;
+    int r[4];
+    if (!clip_rect(coord_x, coord_y, img->width, img->height, r)) {
+        return;
+    }
 
-    for (int y = 0; y < img->height; ++y) {
-        for (int x = 0; x < img->width; ++x) {
-            draw_pixel(coord_x + x, coord_y + y, pxs[y * img->width + x]);
-        }
+    const rgb565_t *pxs = (const rgb565_t *)img->pxs;
+    fb_copy(current_screen + r[1] * SCREEN_WIDTH + r[0], SCREEN_WIDTH,
+            pxs + (r[1] - coord_y) * img->width + r[0] - coord_x, img->width,
+            r[2] - r[0], r[3] - r[1]);
+    mark_dirty(r[0], r[1], r[2], r[3]);
+}
+
+void draw_columns(int x, int y, int w, int h, const rgb565_t *pxs,
+                  int column_len)
+{
+    int r[4];
+    if (!booted || !clip_rect(x, y, w, h, r)) {
+        return;
     }
+
+    fb_copy_columns(current_screen + r[1] * SCREEN_WIDTH + r[0],
+                    SCREEN_WIDTH, pxs + (r[0] - x) * column_len + r[1] - y,
+                    column_len, r[2] - r[0], r[3] - r[1]);
+    mark_dirty(r[0], r[1], r[2], r[3]);
 }
 
 void update_screen()
 {
-    if (!booted) {
+    if (!booted || headless) {
         return;
     }
 
-    parlcd_write_cmd(parlcd_mem_base, 0x2c);
-    for (int i = 0; i < SCREEN_SIZE; ++i) {
-        parlcd_write_data(parlcd_mem_base, current_screen[i]);
+    pthread_mutex_lock(&push_lock);
+    while (push_pending) {
+        pthread_cond_wait(&push_cond, &push_lock);
+    }
+
+    submit_screen();
+
+    while (push_pending) {
+        pthread_cond_wait(&push_cond, &push_lock);
     }
+    pthread_mutex_unlock(&push_lock);
+}
+
+bool update_screen_async()
+{
+    if (!booted) {
+        return false;
+    }
+
+    if (headless) {
+        return true;
+    }
+
+    pthread_mutex_lock(&push_lock);
+    bool submitted = !push_pending;
+    if (submitted) {
+        submit_screen();
+    }
+    pthread_mutex_unlock(&push_lock);
+
+    return submitted;
+}
+
+long long screen_push_ns()
+{
+    return __atomic_load_n(&last_push_ns, __ATOMIC_RELAXED);
+}
+
+bool screen_push_busy()
+{
+    if (!booted || headless) {
+        return false;
+    }
+
+    pthread_mutex_lock(&push_lock);
+    bool busy = push_pending;
+    pthread_mutex_unlock(&push_lock);
+
+    return busy;
 }
 
 int char_width(char ch)
@@ -142,11 +466,18 @@ void draw_char(int x, int y, char ch, int scale, rgb565_t color)
 
 void draw_rect(int x, int y, int w, int h, rgb565_t color)
 {
-    for (int i = 0; i < w; i++) {
-        for (int j = 0; j < h; j++) {
-            draw_pixel(x+i, y+j, color);
-        } 
+    if (!booted) {
+        return;
+    }
+
+    int r[4];
+    if (!clip_rect(x, y, w, h, r)) {
+        return;
     }
+
+    fb_fill(current_screen + r[1] * SCREEN_WIDTH + r[0], SCREEN_WIDTH,
+            r[2] - r[0], r[3] - r[1], color);
+    mark_dirty(r[0], r[1], r[2], r[3]);
 }
 
 void print_string_on_screen(int x, int y, const char *string_to_print,
@@ -168,15 +499,82 @@ void print_string_on_screen(int x, int y, const char *string_to_print,
     }
 }
 
-void fill_screen(rgb565_t color)
+void render_text_bitmap(text_bitmap_t *bmp, const char *text)
+{
+    memset(bmp, 0, sizeof(text_bitmap_t));
+
+    int height = fdes->height < TEXT_BITMAP_HEIGHT ? fdes->height
+        : TEXT_BITMAP_HEIGHT;
+    int x = 0;
+    for (const char *ch = text; *ch; ++ch) {
+        if (*ch < fdes->firstchar || *ch - fdes->firstchar >= fdes->size) {
+            continue;
+        }
+
+        int w = fdes->width ? fdes->width[*ch - fdes->firstchar]
+            : fdes->maxwidth;
+        if (x + w > TEXT_BITMAP_WIDTH) {
+            break;
+        }
+
+        const font_bits_t *ptr;
+        if (fdes->offset) {
+            ptr = &fdes->bits[fdes->offset[*ch - fdes->firstchar]];
+        } else {
+            int bw = (fdes->maxwidth + 15) / 16;
+            ptr = &fdes->bits[(*ch - fdes->firstchar) * bw * fdes->height];
+        }
+
+        for (int i = 0; i < height; ++i) {
+            font_bits_t val = ptr[i];
+            for (int j = 0; j < w; ++j) {
+                bmp->mask[i][x + j] = (val & 0x8000) != 0;
+                val <<= 1;
+            }
+        }
+
+        x += w + PX_TEXT_BITMAP_SEPARATOR;
+        bmp->width = x;
+    }
+}
+
+void draw_text_bitmap(int x, int y, const text_bitmap_t *bmp, rgb565_t color)
 {
     if (!booted) {
         return;
     }
 
-    for (int i = 0; i < SCREEN_SIZE; ++i) {
-        current_screen[i] = color;
+    // Clip once for the whole bitmap instead of once per pixel.
+    int x1 = x < 0 ? 0 : x;
+    int x2 = x + bmp->width < SCREEN_WIDTH ? x + bmp->width : SCREEN_WIDTH;
+    int y1 = y < 0 ? 0 : y;
+    int y2 = y + TEXT_BITMAP_HEIGHT < SCREEN_HEIGHT ? y + TEXT_BITMAP_HEIGHT
+        : SCREEN_HEIGHT;
+
+    if (x1 >= x2 || y1 >= y2) {
+        return;
+    }
+
+    for (int sy = y1; sy < y2; ++sy) {
+        const uint8_t *mask = bmp->mask[sy - y];
+        rgb565_t *row = current_screen + sy * SCREEN_WIDTH;
+        for (int sx = x1; sx < x2; ++sx) {
+            if (mask[sx - x]) {
+                row[sx] = color;
+            }
+        }
+    }
+    mark_dirty(x1, y1, x2, y2);
+}
+
+void fill_screen(rgb565_t color)
+{
+    if (!booted) {
+        return;
     }
+
+    fb_fill(current_screen, SCREEN_WIDTH, SCREEN_WIDTH, SCREEN_HEIGHT, color);
+    memset(screen_dirty, 1, sizeof(screen_dirty));
 }
 
 bool input_detect()
@@ -190,14 +588,19 @@ bool input_detect()
 
 input_t input_handler()
 {
-    if (!booted) {
+    if (!booted || headless) {
         return NO_INPUT;
     }
 
     prev_knobs_val = knobs_val;
     knobs_val = *(volatile uint32_t*)(mem_base + SPILED_REG_KNOBS_8BIT_o);
 
-    if (!input_detect()) {
+    return input_decode(prev_knobs_val, knobs_val);
+}
+
+input_t input_decode(uint32_t prev_knobs_val, uint32_t knobs_val)
+{
+    if (knobs_val == prev_knobs_val) {
         return NO_INPUT;
     }
 
@@ -251,29 +654,17 @@ input_t input_handler()
     return NO_INPUT;
 }
 
-void update_led_line(uint32_t LED) 
+void update_led_line(uint32_t LED)
 {
-    if (!booted) {
-        return;
-    }
-
-    *(volatile uint32_t*)(mem_base + SPILED_REG_LED_LINE_o) = LED;   
+    write_led(SPILED_REG_LED_LINE_o, LED_SHADOW_LINE, LED);
 }
 
 void update_led_rgb1(uint32_t RGB)
 {
-    if (!booted) {
-        return;
-    }
-
-    *(volatile uint32_t*)(mem_base + SPILED_REG_LED_RGB1_o) = RGB;   
+    write_led(SPILED_REG_LED_RGB1_o, LED_SHADOW_RGB1, RGB);
 }
 
 void update_led_rgb2(uint32_t RGB)
 {
-    if (!booted) {
-        return;
-    }
-
-    *(volatile uint32_t*)(mem_base + SPILED_REG_LED_RGB2_o) = RGB;   
+    write_led(SPILED_REG_LED_RGB2_o, LED_SHADOW_RGB2, RGB);
 }
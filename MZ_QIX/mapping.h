@@ -16,6 +16,13 @@
 #define SCREEN_WIDTH 480 ///< Width of the screen.
 #define SCREEN_HEIGHT 320 ///< Height of the screen.
 #define SCREEN_SIZE 153600 ///< Number of pixels on the screen.
+#define SCREEN_TILE_SIZE 16 ///< Size of the tiles the LCD is updated by.
+#define SCREEN_TILES_X (SCREEN_WIDTH / SCREEN_TILE_SIZE)
+#define SCREEN_TILES_Y (SCREEN_HEIGHT / SCREEN_TILE_SIZE)
+#define SCREEN_TILES (SCREEN_TILES_X * SCREEN_TILES_Y)
+
+#define TEXT_BITMAP_WIDTH 240 ///< Maximum width of a text bitmap.
+#define TEXT_BITMAP_HEIGHT 16 ///< Height of a text bitmap, one line of text.
 
 /// Enum for representing different types of input.
 typedef enum input_t {
@@ -29,10 +36,24 @@ typedef enum input_t {
     EXIT ///< If the red knob is pressed.
 } input_t;
 
+/// Line of text rendered once from the font and then drawn without touching
+/// the font again, for text redrawn every frame.
+typedef struct {
+    int width; ///< Width of the rendered text in pixels.
+    uint8_t mask[TEXT_BITMAP_HEIGHT][TEXT_BITMAP_WIDTH]; ///< Non-zero where
+                                                         /// the text is.
+} text_bitmap_t;
+
 /// Maps physical addresses of knobs, screen, leds needed for working properly.
 /// If is not booted, functions do nothing.
 void memory_map_boot();
 
+/// Marks the module as booted without mapping any peripherals. Drawing goes
+/// into the screen buffer as usual, but the screen is never pushed, LEDs
+/// are not written and there is no input. Used by host tools and
+/// benchmarks.
+void memory_map_boot_headless();
+
 /// Draws pixel into screen buffer.
 /// \param x X-coordinate on the screen
 /// \param y Y-coordinate on the screen.
@@ -57,14 +78,40 @@ void draw_img(const img_t *img);
 /// \param img Image to be buffered into the screen buffer.
 void draw_img_on_coord(int coord_x, int coord_y, const img_t *img);
 
+/// Draws a rectangle of a column-major image (pixel (i, j) of the
+/// rectangle at pxs[i * column_len + j]), e.g. a part of the arena, into
+/// the screen buffer.
+/// \param x X-coordinate of the upper left corner.
+/// \param y Y-coordinate of the upper left corner.
+/// \param w Width of the rectangle.
+/// \param h Height of the rectangle.
+/// \param pxs Upper left pixel of the rectangle in the image.
+/// \param column_len Distance between columns of the image in pixels.
+void draw_columns(int x, int y, int w, int h, const rgb565_t *pxs,
+                  int column_len);
+
 /// Fills screen buffer with the given color.
 /// \param color Color to be filled with.
 void fill_screen(rgb565_t color);
 
-/// Maps screen buffer onto actual LCD display.
+/// Maps screen buffer onto actual LCD display and waits until it is done.
 /// Buffer stays the same.
 void update_screen();
 
+/// Hands a copy of the screen buffer over to the LCD pusher thread and
+/// returns immediately. Buffer stays the same and can be drawn into.
+/// \return true if the frame was submitted, false if the previous frame
+/// is still being pushed (the frame is dropped then)
+bool update_screen_async();
+
+/// Get how long the last push of a frame onto the LCD has taken.
+/// \return time in nanoseconds, 0 if no frame has been pushed yet
+long long screen_push_ns();
+
+/// Check if the LCD pusher thread is still pushing a frame.
+/// \return true if a frame is being pushed, false otherwise
+bool screen_push_busy();
+
 /// Get width of the given character from booted font.
 /// \param ch Character whose width should be gotten.
 /// \return width of the given character from booted font
@@ -86,6 +133,19 @@ void draw_char(int x, int y, char ch, int scale, rgb565_t color);
 void print_string_on_screen(int x, int y, const char *string_to_print,
                             int scale, rgb565_t color);
 
+/// Renders the given text into the given bitmap at scale 1. Characters
+/// which do not fit into TEXT_BITMAP_WIDTH are left out.
+/// \param bmp Bitmap to be rendered into.
+/// \param text Text to be rendered.
+void render_text_bitmap(text_bitmap_t *bmp, const char *text);
+
+/// Draws a text bitmap into the screen buffer.
+/// \param x X-coordinate of the upper left corner of the text.
+/// \param y Y-coordinate of the upper left corner of the text.
+/// \param bmp Bitmap rendered by render_text_bitmap().
+/// \param color Color of the text.
+void draw_text_bitmap(int x, int y, const text_bitmap_t *bmp, rgb565_t color);
+
 /// Check if there is new input from knobs.
 /// \return true if input is detected, false otherwise
 bool input_detect();
@@ -107,15 +167,24 @@ void draw_rect(int x, int y, int w, int h, rgb565_t color);
 /// EXIT if the red knobs is pressed.
 enum input_t input_handler();
 
-/// Directly maps the given integer onto LEDs.
+/// Decodes two consecutive values of the knobs register into an input, as
+/// done by input_handler().
+/// \param prev_knobs_val Previous value of the knobs register.
+/// \param knobs_val Current value of the knobs register.
+/// \return input as described at input_handler()
+input_t input_decode(uint32_t prev_knobs_val, uint32_t knobs_val);
+
+/// Maps the given integer onto LEDs. The register is written only if its
+/// value changes. Called by the LED thread, see led.h for posting
+/// animations from the game.
 /// \param LED New value to be mapped.
 void update_led_line(uint32_t LED);
 
-/// Directly maps the given integer left-most RGB LED.
+/// Maps the given integer onto the left-most RGB LED if it changes.
 /// \param RGB New value (rgb888) to be mapped.
 void update_led_rgb1(uint32_t RGB);
 
-/// Directly maps the given integer right-most RGB LED.
+/// Maps the given integer onto the right-most RGB LED if it changes.
 /// \param RGB New value (rgb888) to be mapped.
 void update_led_rgb2(uint32_t RGB);
 
@@ -0,0 +1,231 @@
+#define _DEFAULT_SOURCE // syscall()
+
+#include "perfcnt.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/// Counters of one group.
+typedef enum counter_t {
+    CNT_CYCLES, ///< CPU cycles, leader of the group.
+    CNT_INSTRUCTIONS, ///< Retired instructions.
+    CNT_L1D_MISSES, ///< L1 data cache read misses.
+    CNT_L2_MISSES, ///< Last level (L2 on the board) cache read misses.
+    CNT_BRANCH_MISSES, ///< Mispredicted branches.
+    NCOUNTERS ///< Number of counters.
+} counter_t;
+
+/// Counters of one thread.
+typedef struct {
+    bool tried; ///< True once the group has been opened (or has failed).
+    int leader; ///< Descriptor of the group leader, -1 if none.
+    int slot[NCOUNTERS]; ///< Position of each counter in a group read,
+                         /// -1 if it could not be opened.
+    int nopen; ///< Number of opened counters.
+    uint64_t start[PERFCNT_NPHASES][NCOUNTERS]; ///< Counts at the start of
+                                                /// every phase.
+} thread_counters_t;
+
+/// Totals of one phase.
+typedef struct {
+    unsigned long calls; ///< Number of measured calls.
+    uint64_t sum[NCOUNTERS]; ///< Summed counts.
+    bool available[NCOUNTERS]; ///< True if the counter was measured.
+} phase_totals_t;
+
+static const char *counter_names[NCOUNTERS] = {
+    "cycles", "instructions", "l1d_misses", "l2_misses", "branch_misses"
+};
+
+static const char *phase_names[PERFCNT_NPHASES] = {
+    "input", "update", "compose", "lcd_push"
+};
+
+static bool enabled = false;
+static int open_errno = 0; ///< Why a group could not be opened, 0 if none.
+static pthread_mutex_t totals_lock = PTHREAD_MUTEX_INITIALIZER;
+static phase_totals_t totals[PERFCNT_NPHASES];
+static __thread thread_counters_t counters;
+
+/// <------------ Start implementation functions declaration ------------>
+
+/// Opens one counter for the calling thread.
+/// \param type perf_event_attr type.
+/// \param config perf_event_attr config.
+/// \param group_fd Leader of the group, -1 to open a leader.
+/// \return file descriptor of the counter, -1 on failure
+static int open_counter(uint32_t type, uint64_t config, int group_fd);
+
+/// Opens the group of counters of the calling thread on first use.
+/// \return counters of the thread
+static thread_counters_t *thread_counters();
+
+/// Reads all the counters of the calling thread.
+/// \param tc Counters of the thread.
+/// \param values Output, NCOUNTERS values.
+/// \return true on success, false otherwise
+static bool read_counters(const thread_counters_t *tc, uint64_t *values);
+
+/// <------------ End implementation functions declaration ------------>
+
+void perfcnt_init(bool enable)
+{
+    enabled = enable;
+    memset(totals, 0, sizeof(totals));
+}
+
+void perfcnt_begin(perfcnt_phase_t phase)
+{
+    if (!enabled) {
+        return;
+    }
+
+    thread_counters_t *tc = thread_counters();
+    if (tc->leader >= 0) {
+        read_counters(tc, tc->start[phase]);
+    }
+}
+
+void perfcnt_end(perfcnt_phase_t phase)
+{
+    if (!enabled) {
+        return;
+    }
+
+    thread_counters_t *tc = thread_counters();
+    uint64_t now[NCOUNTERS];
+    if (tc->leader < 0 || !read_counters(tc, now)) {
+        return;
+    }
+
+    pthread_mutex_lock(&totals_lock);
+    phase_totals_t *t = &totals[phase];
+    ++t->calls;
+    for (int c = 0; c < NCOUNTERS; ++c) {
+        if (tc->slot[c] >= 0) {
+            t->sum[c] += now[c] - tc->start[phase][c];
+            t->available[c] = true;
+        }
+    }
+    pthread_mutex_unlock(&totals_lock);
+}
+
+void perfcnt_report()
+{
+    if (!enabled) {
+        return;
+    }
+
+    pthread_mutex_lock(&totals_lock);
+    printf("# perf counters, averages per call\n");
+    if (open_errno) {
+        printf("# some threads are not measured, perf_event_open: %s "
+               "(see /proc/sys/kernel/perf_event_paranoid)\n",
+               strerror(open_errno));
+    }
+    for (int p = 0; p < PERFCNT_NPHASES; ++p) {
+        const phase_totals_t *t = &totals[p];
+        if (!t->calls) {
+            printf("perfcnt phase=%s calls=0\n", phase_names[p]);
+            continue;
+        }
+
+        printf("perfcnt phase=%s calls=%lu", phase_names[p], t->calls);
+        for (int c = 0; c < NCOUNTERS; ++c) {
+            if (t->available[c]) {
+                printf(" %s=%.0f", counter_names[c],
+                       (double)t->sum[c] / t->calls);
+            } else {
+                printf(" %s=n/a", counter_names[c]);
+            }
+        }
+        if (t->available[CNT_CYCLES] && t->available[CNT_INSTRUCTIONS]
+            && t->sum[CNT_CYCLES]) {
+            printf(" ipc=%.2f", (double)t->sum[CNT_INSTRUCTIONS]
+                   / t->sum[CNT_CYCLES]);
+        }
+        printf("\n");
+    }
+    pthread_mutex_unlock(&totals_lock);
+}
+
+static int open_counter(uint32_t type, uint64_t config, int group_fd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    // Calling thread on any CPU.
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static thread_counters_t *thread_counters()
+{
+    thread_counters_t *tc = &counters;
+    if (tc->tried) {
+        return tc;
+    }
+    tc->tried = true;
+
+    static const struct {
+        uint32_t type;
+        uint64_t config;
+    } events[NCOUNTERS] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+            | PERF_COUNT_HW_CACHE_OP_READ << 8
+            | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL
+            | PERF_COUNT_HW_CACHE_OP_READ << 8
+            | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+
+    tc->leader = open_counter(events[CNT_CYCLES].type,
+                              events[CNT_CYCLES].config, -1);
+    for (int c = 0; c < NCOUNTERS; ++c) {
+        tc->slot[c] = -1;
+    }
+    if (tc->leader < 0) {
+        open_errno = errno;
+        return tc;
+    }
+    tc->slot[CNT_CYCLES] = tc->nopen++;
+
+    // Counters missing on this CPU are reported as n/a.
+    for (int c = CNT_CYCLES + 1; c < NCOUNTERS; ++c) {
+        if (open_counter(events[c].type, events[c].config, tc->leader) >= 0) {
+            tc->slot[c] = tc->nopen++;
+        }
+    }
+
+    return tc;
+}
+
+static bool read_counters(const thread_counters_t *tc, uint64_t *values)
+{
+    uint64_t buf[1 + NCOUNTERS];
+    ssize_t size = (1 + tc->nopen) * sizeof(uint64_t);
+
+    if (read(tc->leader, buf, size) != size) {
+        return false;
+    }
+
+    for (int c = 0; c < NCOUNTERS; ++c) {
+        values[c] = tc->slot[c] >= 0 ? buf[1 + tc->slot[c]] : 0;
+    }
+
+    return true;
+}
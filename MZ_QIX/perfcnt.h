@@ -0,0 +1,44 @@
+/// \file perfcnt.h
+/// Hardware performance counters (cycles, instructions, L1D and L2 misses,
+/// branch misses) read around the phases of the game loop with
+/// perf_event_open(). Counts are summed per phase and printed at exit.
+/// Every thread gets its own group of counters, so a phase is charged only
+/// with the work of the thread running it.
+
+#ifndef PERFCNT_H_INCLUDED
+#define PERFCNT_H_INCLUDED
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdbool.h>
+
+#define PERFCNT_ENV "QIX_PERF" ///< Environment variable turning the counters
+                               /// on when set.
+
+/// Measured phases.
+typedef enum perfcnt_phase_t {
+    PERFCNT_INPUT, ///< Reading the knobs.
+    PERFCNT_UPDATE, ///< Simulation steps of one frame.
+    PERFCNT_COMPOSE, ///< Drawing the frame into the screen buffer.
+    PERFCNT_LCD_PUSH, ///< Pushing the frame onto the LCD (pusher thread).
+    PERFCNT_NPHASES ///< Number of phases.
+} perfcnt_phase_t;
+
+/// Turns the counters on. Has to be called before the measured threads are
+/// started.
+/// \param enable False keeps the counters off and every call a no-op.
+void perfcnt_init(bool enable);
+
+/// Starts measuring a phase on the calling thread.
+/// \param phase Phase to be measured.
+void perfcnt_begin(perfcnt_phase_t phase);
+
+/// Stops measuring the phase on the calling thread and adds the counts to
+/// its totals.
+/// \param phase Phase started by perfcnt_begin().
+void perfcnt_end(perfcnt_phase_t phase);
+
+/// Prints totals and per-call averages of every phase to stdout.
+void perfcnt_report();
+
+#endif // PERFCNT_H_INCLUDED
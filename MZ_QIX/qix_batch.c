@@ -0,0 +1,598 @@
+/// \file qix_batch.c
+/// Headless batch simulator. Runs many games of qix on all cores with
+/// scripted or random input and reports score, game length, capture size
+/// and per-step cost, so the tuning constants can be evaluated on a host.
+///
+/// Usage: qix_batch [-g games] [-j threads] [-s seed] [-m max_steps]
+///                  [-p random|boxes] [-q qix_speeds] [-t triggers]
+///                  [-n qix_counts] [-f fill_threads] [-a commit_lag]
+///                  [-c capture_step] [-r]
+/// where qix_speeds (pixels per step, may be fractional), triggers and
+/// qix_counts are comma separated lists of values; every combination of
+/// them is simulated as one configuration.
+/// fill_threads splits large captures of every game across threads; the
+/// results are the same for any value.
+/// -a runs captures on the worker thread as the game does; the batch waits
+/// for the worker and commits the capture commit_lag steps after it has
+/// started, so the results do not depend on scheduling. With commit_lag 0
+/// they are the same as without -a, larger lags keep the trail held across
+/// steps. -c fills captures capture_step pixels per step instead of at
+/// once. -r keeps the arena run-length encoded too and reads collisions
+/// from there; the results are the same.
+/// Sweeping qix_counts benchmarks how the step cost scales with the number
+/// of enemies.
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "qix_core.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_GAMES 1000
+#define DEFAULT_MAX_STEPS 100000
+#define DEFAULT_SEED 1
+#define MAX_VALUES 16
+#define MAX_THREADS 64
+#define WORKER_STACK_SIZE (64 * 1024 * 1024)
+
+/// Input policy driving the player.
+typedef enum policy_t {
+    POLICY_RANDOM, ///< Random direction every few dozen steps.
+    POLICY_BOXES ///< Cuts boxes off the arena, leaving and rejoining
+                 /// the claimed area.
+} policy_t;
+
+/// Result of one simulated game.
+typedef struct {
+    int score; ///< Final score.
+    long steps; ///< Number of simulated steps.
+    qix_status_t status; ///< Final status.
+    int captures; ///< Number of captures.
+    long long step_ns; ///< Total wall time spent in qix_step().
+    long long max_step_ns; ///< The slowest qix_step() call.
+} game_result_t;
+
+/// Growable array of capture sizes.
+typedef struct {
+    int *data; ///< Capture sizes.
+    size_t len; ///< Number of stored sizes.
+    size_t cap; ///< Capacity of data.
+} int_vec_t;
+
+/// Double ended queue of game indices owned by one worker. The owner pops
+/// from the back, thieves steal from the front.
+typedef struct {
+    pthread_mutex_t lock; ///< Protects head and tail.
+    int head; ///< First job not yet taken.
+    int tail; ///< One past the last job not yet taken.
+} job_deque_t;
+
+/// Private data of one worker thread.
+typedef struct {
+    int id; ///< Index of the worker.
+    qix_state_t *state; ///< Simulation state reused for every game.
+    int_vec_t captures; ///< Sizes of all captures in the games played.
+    long stolen; ///< Number of jobs stolen from other workers.
+} worker_t;
+
+/// Configuration shared by all workers.
+typedef struct {
+    qix_params_t params; ///< Parameters of every game.
+    policy_t policy; ///< Input policy.
+    uint32_t seed; ///< Base seed, game i uses seed + i.
+    long max_steps; ///< Games longer than this are cut off.
+    int games; ///< Number of games.
+    int commit_lag; ///< Steps a capture on the worker thread runs before it
+                    /// is committed.
+    int nworkers; ///< Number of worker threads.
+    job_deque_t deques[MAX_THREADS]; ///< Job queue of every worker.
+    game_result_t *results; ///< Result of every game.
+} batch_t;
+
+static batch_t batch;
+
+/// <------------ Start implementation functions declaration ------------>
+
+/// Parses comma separated list of integers.
+/// \param str String to be parsed.
+/// \param values Output array, at least MAX_VALUES long.
+/// \return number of parsed values
+static int parse_list(const char *str, int *values);
+
+/// Parses comma separated list of speeds in pixels into fixed point.
+/// \param str String to be parsed.
+/// \param values Output array, at least MAX_VALUES long.
+/// \return number of parsed values
+static int parse_speeds(const char *str, int *values);
+
+/// Appends a value into the vector, exits on allocation failure.
+/// \param vec Vector to be appended to.
+/// \param value Value to be appended.
+static void vec_push(int_vec_t *vec, int value);
+
+/// Get the next random number of the policy generator (xorshift32).
+/// \param rng Generator state.
+/// \return next random number
+static uint32_t policy_random(uint32_t *rng);
+
+/// Chooses input for the next step based on the policy.
+/// \param policy Policy to be used.
+/// \param state Current state of the game.
+/// \param rng Generator state of the policy.
+/// \param cooldown Steps left until the next decision.
+/// \param phase Phase of the scripted policy.
+/// \return input for the next step
+static input_t choose_input(policy_t policy, const qix_state_t *state,
+                            uint32_t *rng, int *cooldown, int *phase);
+
+/// Simulates one game.
+/// \param worker Worker simulating the game.
+/// \param game Index of the game.
+static void play_game(worker_t *worker, int game);
+
+/// Takes a job from the worker's own deque or steals one from the others.
+/// \param worker Worker asking for a job.
+/// \return index of the game, -1 when there are no jobs left
+static int take_job(worker_t *worker);
+
+/// Entry point of the worker threads.
+static void *worker_main(void *arg);
+
+/// Runs one configuration and prints its report.
+/// \param nthreads Number of worker threads.
+static void run_batch(int nthreads);
+
+/// Prints report of the finished batch.
+/// \param workers Workers which have run the batch.
+static void print_report(const worker_t *workers);
+
+/// Comparator of integers for qsort().
+static int cmp_int(const void *a, const void *b);
+
+/// Comparator of long integers for qsort().
+static int cmp_long(const void *a, const void *b);
+
+/// Get wall time in nanoseconds.
+static long long now_ns();
+
+/// <------------ End implementation functions declaration ------------>
+
+int main(int argc, char *argv[])
+{
+    int qix_speeds[MAX_VALUES] = {QIX_DEFAULT_SPEED * QIX_FP_ONE};
+    int triggers[MAX_VALUES] = {NEXT_ACTION_TRIGGER};
+    int counts[MAX_VALUES] = {NQIXES};
+    int nspeeds = 1, ntriggers = 1, ncounts = 1;
+    int fill_threads = 1;
+    int capture_step = 0;
+    bool async_capture = false;
+    bool rle_territory = false;
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    batch.games = DEFAULT_GAMES;
+    batch.max_steps = DEFAULT_MAX_STEPS;
+    batch.seed = DEFAULT_SEED;
+    batch.policy = POLICY_RANDOM;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "g:j:s:m:p:q:t:n:f:a:c:r")) != -1) {
+        switch (opt) {
+        case 'g':
+            batch.games = atoi(optarg);
+            break;
+        case 'j':
+            nthreads = atoi(optarg);
+            break;
+        case 's':
+            batch.seed = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            batch.max_steps = atol(optarg);
+            break;
+        case 'p':
+            batch.policy = strcmp(optarg, "boxes") ? POLICY_RANDOM : POLICY_BOXES;
+            break;
+        case 'q':
+            nspeeds = parse_speeds(optarg, qix_speeds);
+            break;
+        case 't':
+            ntriggers = parse_list(optarg, triggers);
+            break;
+        case 'n':
+            ncounts = parse_list(optarg, counts);
+            break;
+        case 'f':
+            fill_threads = atoi(optarg);
+            break;
+        case 'a':
+            async_capture = true;
+            batch.commit_lag = atoi(optarg);
+            break;
+        case 'c':
+            capture_step = atoi(optarg);
+            break;
+        case 'r':
+            rle_territory = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-g games] [-j threads] [-s seed] "
+                    "[-m max_steps] [-p random|boxes] [-q qix_speeds] "
+                    "[-t triggers] [-n qix_counts] [-f fill_threads] "
+                    "[-a commit_lag] [-c capture_step] [-r]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    if (batch.games <= 0 || nspeeds == 0 || ntriggers == 0 || ncounts == 0) {
+        fprintf(stderr, "nothing to simulate\n");
+        return 1;
+    }
+
+    nthreads = nthreads < 1 ? 1 : nthreads > MAX_THREADS ? MAX_THREADS : nthreads;
+
+    batch.results = calloc(batch.games, sizeof(game_result_t));
+    if (!batch.results) {
+        fprintf(stderr, "cannot allocate results\n");
+        return 1;
+    }
+
+    printf("# games=%d threads=%d policy=%s seed=%u max_steps=%ld "
+           "async=%d commit_lag=%d capture_step=%d rle=%d\n",
+           batch.games, nthreads,
+           batch.policy == POLICY_BOXES ? "boxes" : "random",
+           batch.seed, batch.max_steps, async_capture, batch.commit_lag,
+           capture_step, rle_territory);
+
+    for (int i = 0; i < nspeeds; ++i) {
+        for (int j = 0; j < ntriggers; ++j) {
+            for (int k = 0; k < ncounts; ++k) {
+                qix_default_params(&batch.params);
+                batch.params.qix_speed = qix_speeds[i];
+                batch.params.next_action_trigger = triggers[j];
+                batch.params.nqixes = counts[k];
+                batch.params.fill_threads = fill_threads;
+                batch.params.async_capture = async_capture;
+                batch.params.capture_step_px = capture_step;
+                batch.params.rle_territory = rle_territory;
+                run_batch(nthreads);
+            }
+        }
+    }
+
+    free(batch.results);
+
+    return 0;
+}
+
+static int parse_list(const char *str, int *values)
+{
+    int n = 0;
+    char *end;
+
+    while (*str && n < MAX_VALUES) {
+        values[n++] = strtol(str, &end, 0);
+        if (*end != ',') {
+            break;
+        }
+        str = end + 1;
+    }
+
+    return n;
+}
+
+static int parse_speeds(const char *str, int *values)
+{
+    int n = 0;
+    char *end;
+
+    while (*str && n < MAX_VALUES) {
+        values[n++] = strtod(str, &end) * QIX_FP_ONE + 0.5;
+        if (*end != ',') {
+            break;
+        }
+        str = end + 1;
+    }
+
+    return n;
+}
+
+static void vec_push(int_vec_t *vec, int value)
+{
+    if (vec->len == vec->cap) {
+        size_t cap = vec->cap ? vec->cap * 2 : 256;
+        int *data = realloc(vec->data, cap * sizeof(int));
+        if (!data) {
+            fprintf(stderr, "cannot allocate captures\n");
+            exit(1);
+        }
+        vec->data = data;
+        vec->cap = cap;
+    }
+
+    vec->data[vec->len++] = value;
+}
+
+static uint32_t policy_random(uint32_t *rng)
+{
+    uint32_t x = *rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *rng = x;
+
+    return x;
+}
+
+static input_t choose_input(policy_t policy, const qix_state_t *state,
+                            uint32_t *rng, int *cooldown, int *phase)
+{
+    if ((*cooldown)-- > 0) {
+        return NO_INPUT;
+    }
+
+    if (policy == POLICY_RANDOM) {
+        *cooldown = 40 + policy_random(rng) % 120;
+        return (policy_random(rng) % RIGHT) + 1;
+    }
+
+    // Boxes: run along the top border, dive down, go right and come back up.
+    static const input_t script[] = {RIGHT, DOWN, RIGHT, UP};
+    input_t input = script[*phase];
+    switch (input) {
+    case DOWN:
+        *cooldown = 20 + policy_random(rng) % 200;
+        break;
+    case UP:
+        *cooldown = SCREEN_HEIGHT / state->params.player_speed;
+        break;
+    default:
+        *cooldown = 10 + policy_random(rng) % 80;
+        break;
+    }
+
+    if (input == RIGHT && state->player.xx + ENTITY_WIDTH
+            >= SCREEN_WIDTH - BORDER_WIDTH) {
+        input = LEFT;
+    }
+
+    *phase = (*phase + 1) % (int)(sizeof(script) / sizeof(script[0]));
+
+    return input;
+}
+
+static void play_game(worker_t *worker, int game)
+{
+    qix_state_t *state = worker->state;
+    game_result_t *result = batch.results + game;
+    uint32_t seed = batch.seed + game;
+    uint32_t rng = seed * 2654435761u + 1;
+    int cooldown = 0, phase = 0, lag = 0;
+
+    qix_init_with_params(state, seed, &batch.params);
+    memset(result, 0, sizeof(*result));
+
+    qix_status_t status = QIX_RUNNING;
+    while (status == QIX_RUNNING && result->steps < batch.max_steps) {
+        input_t input = choose_input(batch.policy, state, &rng,
+                                     &cooldown, &phase);
+
+        long long start = now_ns();
+        status = qix_step(state, input);
+        // The worker is waited for at a fixed step, not when it is done.
+        if (!state->capture.running) {
+            lag = 0;
+        } else if (lag++ == batch.commit_lag) {
+            qix_capture_advance(state, INT_MAX);
+            status = qix_status(state);
+            lag = 0;
+        }
+        long long elapsed = now_ns() - start;
+
+        result->step_ns += elapsed;
+        if (elapsed > result->max_step_ns) {
+            result->max_step_ns = elapsed;
+        }
+
+        if (state->events & QIX_EVENT_CAPTURE) {
+            ++result->captures;
+            vec_push(&worker->captures, state->last_capture);
+        }
+
+        ++result->steps;
+    }
+
+    result->score = state->score;
+    result->status = status;
+    qix_release(state);
+}
+
+static int take_job(worker_t *worker)
+{
+    job_deque_t *own = batch.deques + worker->id;
+    int job = -1;
+
+    pthread_mutex_lock(&own->lock);
+    if (own->head < own->tail) {
+        job = --own->tail;
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    for (int i = 1; job < 0 && i < batch.nworkers; ++i) {
+        job_deque_t *victim = batch.deques + (worker->id + i) % batch.nworkers;
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->head < victim->tail) {
+            job = victim->head++;
+            ++worker->stolen;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+
+    return job;
+}
+
+static void *worker_main(void *arg)
+{
+    worker_t *worker = arg;
+
+    int job;
+    while ((job = take_job(worker)) >= 0) {
+        play_game(worker, job);
+    }
+
+    return NULL;
+}
+
+static void run_batch(int nthreads)
+{
+    worker_t workers[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, WORKER_STACK_SIZE);
+
+    batch.nworkers = nthreads;
+    for (int i = 0; i < nthreads; ++i) {
+        job_deque_t *deque = batch.deques + i;
+        pthread_mutex_init(&deque->lock, NULL);
+        deque->head = (long long)batch.games * i / nthreads;
+        deque->tail = (long long)batch.games * (i + 1) / nthreads;
+
+        memset(workers + i, 0, sizeof(worker_t));
+        workers[i].id = i;
+        workers[i].state = calloc(1, sizeof(qix_state_t));
+        if (!workers[i].state) {
+            fprintf(stderr, "cannot allocate game state\n");
+            exit(1);
+        }
+    }
+
+    long long start = now_ns();
+    for (int i = 0; i < nthreads; ++i) {
+        if (pthread_create(threads + i, &attr, worker_main, workers + i)) {
+            fprintf(stderr, "cannot create worker thread\n");
+            exit(1);
+        }
+    }
+
+    for (int i = 0; i < nthreads; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    long long wall_ns = now_ns() - start;
+
+    pthread_attr_destroy(&attr);
+
+    print_report(workers);
+    printf("  wall_ms=%.1f games_per_s=%.1f\n", wall_ns / 1e6,
+           batch.games / (wall_ns / 1e9));
+
+    for (int i = 0; i < nthreads; ++i) {
+        pthread_mutex_destroy(&batch.deques[i].lock);
+        free(workers[i].state);
+        free(workers[i].captures.data);
+    }
+}
+
+static void print_report(const worker_t *workers)
+{
+    int n = batch.games;
+    int *scores = malloc(n * sizeof(int));
+    long *steps = malloc(n * sizeof(long));
+    if (!scores || !steps) {
+        fprintf(stderr, "cannot allocate report\n");
+        exit(1);
+    }
+
+    int won = 0, lost = 0;
+    long long step_ns = 0, max_step_ns = 0, total_steps = 0;
+    for (int i = 0; i < n; ++i) {
+        const game_result_t *r = batch.results + i;
+        scores[i] = r->score;
+        steps[i] = r->steps;
+        won += r->status == QIX_WON;
+        lost += r->status == QIX_LOST;
+        step_ns += r->step_ns;
+        total_steps += r->steps;
+        max_step_ns = r->max_step_ns > max_step_ns ? r->max_step_ns : max_step_ns;
+    }
+
+    qsort(scores, n, sizeof(int), cmp_int);
+    qsort(steps, n, sizeof(long), cmp_long);
+
+    int_vec_t captures = {0};
+    long stolen = 0;
+    for (int i = 0; i < batch.nworkers; ++i) {
+        for (size_t j = 0; j < workers[i].captures.len; ++j) {
+            vec_push(&captures, workers[i].captures.data[j]);
+        }
+        stolen += workers[i].stolen;
+    }
+    qsort(captures.data, captures.len, sizeof(int), cmp_int);
+
+    long long score_sum = 0;
+    for (int i = 0; i < n; ++i) {
+        score_sum += scores[i];
+    }
+
+    long long capture_sum = 0;
+    for (size_t i = 0; i < captures.len; ++i) {
+        capture_sum += captures.data[i];
+    }
+
+#define PCT(arr, len, p) ((len) ? (arr)[(size_t)((len) - 1) * (p) / 100] : 0)
+
+    printf("qix_speed=%g next_action_trigger=%d nqixes=%d\n",
+           (double)batch.params.qix_speed / QIX_FP_ONE,
+           batch.params.next_action_trigger,
+           batch.params.nqixes);
+    printf("  games=%d won=%d lost=%d cut_off=%d stolen_jobs=%ld\n",
+           n, won, lost, n - won - lost, stolen);
+    printf("  score: mean=%.0f min=%d p10=%d p50=%d p90=%d max=%d\n",
+           (double)score_sum / n, scores[0], PCT(scores, n, 10),
+           PCT(scores, n, 50), PCT(scores, n, 90), scores[n - 1]);
+    printf("  steps: min=%ld p10=%ld p50=%ld p90=%ld max=%ld\n",
+           steps[0], PCT(steps, n, 10), PCT(steps, n, 50),
+           PCT(steps, n, 90), steps[n - 1]);
+    printf("  captures: count=%zu mean=%.0f p50=%d p90=%d max=%d\n",
+           captures.len,
+           captures.len ? (double)capture_sum / captures.len : 0.0,
+           PCT(captures.data, captures.len, 50),
+           PCT(captures.data, captures.len, 90),
+           PCT(captures.data, captures.len, 100));
+    printf("  step_cost: mean_ns=%.0f max_ns=%lld\n",
+           total_steps ? (double)step_ns / total_steps : 0.0, max_step_ns);
+
+#undef PCT
+
+    free(captures.data);
+    free(scores);
+    free(steps);
+}
+
+static int cmp_int(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
@@ -0,0 +1,1128 @@
+/// \file qix_bench.c
+/// Microbenchmarks of the rendering and game kernels, built natively. Every
+/// benchmark is run until it takes at least min_ms, repeated reps times, and
+/// the median is reported as one line of key=value pairs:
+///
+///     bench=fill_screen ops=4096 ns_op=51234.5 items_s=2.998e+09 unit=px
+///
+/// so results of two commits can be compared with a diff or a script.
+///
+/// Usage: qix_bench [-t min_ms] [-r reps] [-f filter] [-k knobs_trace]
+/// where filter runs only benchmarks whose name contains it and knobs_trace
+/// is a file of recorded knobs register values (one hexadecimal value per
+/// line) decoded by the input_decode benchmark instead of a synthetic one.
+///
+/// Before measuring, the framebuffer kernels of fb.h are checked against
+/// their scalar references on random rectangles, the run-length encoded
+/// arena of rle_arena.h against the flat one, also as the two backends of
+/// territory.h, and the rectangle counts of the quadtree against counting
+/// pixels; a mismatch fails the run. The memory taken by both arenas is
+/// printed too.
+
+#define _POSIX_C_SOURCE 200112L
+#define _XOPEN_SOURCE 600 // mkstemp()
+
+#include "qix_core.h"
+#include "render.h"
+#include "fb.h"
+#include "rle_arena.h"
+#include "territory.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_MIN_MS 100
+#define DEFAULT_REPS 5
+#define MAX_REPS 64
+#define TRACE_LEN 4096
+#define RUNNER_STACK_SIZE (64 * 1024 * 1024)
+#define NSEC_PER_SEC 1000000000LL
+#define FB_CHECK_CASES 4096
+#define FB_CHECK_COLORS 4 ///< Colors of the random screens, few so that
+                          /// replaced and compared pixels often match.
+#define RLE_CHECK_CASES 4096
+#define CELL_QUERIES 4096 ///< Pixels read by one call of the cell benchmarks.
+#define RECT_CHECK_CASES 4096
+#define RECT_QUERIES 64 ///< Rectangles counted by one call of the rect
+                        /// benchmarks.
+#define RECT_MAX_SIZE 128 ///< Largest side of the random rectangles.
+
+/// Data shared by the benchmarks, prepared once.
+typedef struct {
+    qix_state_t *open; ///< Empty arena.
+    qix_state_t *serpentine; ///< Arena split by walls into one long corridor.
+    int open_area; ///< Number of background pixels of the empty arena.
+    int serpentine_area; ///< Number of pixels of the corridor.
+    img_t *img888; ///< Full screen rgb888 image.
+    img_t *img565; ///< Full screen rgb565 image.
+    char ppm_path[64]; ///< Temporary PPM file of img888.
+    text_bitmap_t text; ///< Line of HUD-like text.
+    uint32_t *trace; ///< Values of the knobs register.
+    int trace_len; ///< Number of values in trace.
+    rgb565_t *screens[2]; ///< Two screens for the framebuffer kernels.
+    rle_arena_t *rle_open; ///< Run-length encoded empty arena.
+    rle_arena_t *rle_serpentine; ///< Run-length encoded corridor.
+    rle_arena_t *rle_scratch; ///< Snapshots of the encoded arenas.
+} bench_data_t;
+
+/// One benchmark.
+typedef struct {
+    const char *name; ///< Name printed in the report.
+    void (*run)(void); ///< Performs ops_per_call operations.
+    int ops_per_call; ///< Operations done by one call of run, 0 for trace_len.
+    double items_per_op; ///< Items processed by one operation, 0 if it
+                         /// depends on the data (see items_of()).
+    const char *unit; ///< Unit of the items.
+} bench_t;
+
+static bench_data_t data;
+static volatile unsigned int sink;
+
+/// <------------ Start implementation functions declaration ------------>
+
+/// Get the current time of the monotonic clock.
+/// \return time in nanoseconds
+static long long monotonic_ns();
+
+/// Prepares the arenas, images, PPM file and knobs trace.
+/// \param trace_path Recorded knobs trace, NULL for a synthetic one.
+/// \return 0 on success, -1 otherwise
+static int setup(const char *trace_path);
+
+/// Frees everything allocated by setup().
+static void teardown();
+
+/// Loads the knobs register values from the given file.
+/// \param path Path to the file.
+/// \return 0 on success, -1 otherwise
+static int load_trace(const char *path);
+
+/// Generates knobs register values of knobs being turned and pressed.
+static void synthesize_trace();
+
+/// Checks the framebuffer kernels against their scalar references on random
+/// rectangles of random screens and prints the result.
+/// \return 0 if they all agree, -1 otherwise
+static int check_fb();
+
+/// Checks the run-length encoded arena against the flat one on random spans
+/// and on the fills of the benchmark arenas and prints the result.
+/// \return 0 if they agree, -1 otherwise
+static int check_rle();
+
+/// Check that a column of an encoded arena holds the given pixels and that
+/// its runs are as few as possible.
+/// \param arena Encoded arena.
+/// \param x X-coordinate of the column.
+/// \param pixels Expected pixels of the column.
+/// \return true if the column is right, false otherwise
+static bool rle_column_ok(const rle_arena_t *arena, int x,
+                          const rgb565_t *pixels);
+
+/// Check that two territories hold the same pixels, tile by tile as the
+/// renderer reads them.
+/// \param a First territory.
+/// \param b Second territory.
+/// \return true if all the tiles agree, false otherwise
+static bool blocks_agree(const territory_t *a, const territory_t *b);
+
+/// Reads every tile of a territory like the renderer does.
+/// \param territory Territory to be read.
+/// \return sum of the pixels
+static unsigned int read_blocks(const territory_t *territory);
+
+/// Checks the rectangle counts of the quadtree against counting the pixels
+/// on random rectangles of the benchmark arenas and prints the result.
+/// \return 0 if they agree, -1 otherwise
+static int check_quadtree();
+
+/// Counts the pixels of a color within a rectangle one by one, the
+/// reference of qix_rect_count().
+/// \param state State of the game.
+/// \param x X-coordinate of the rectangle.
+/// \param y Y-coordinate of the rectangle.
+/// \param w Width of the rectangle.
+/// \param h Height of the rectangle.
+/// \param color Color to be counted.
+/// \return number of pixels of the color within the rectangle
+static int scan_rect(const qix_state_t *state, int x, int y, int w, int h,
+                     rgb565_t color);
+
+/// Get a random rectangle of the arena.
+/// \param rng State of the random generator.
+/// \param rect Output, x, y, width and height of the rectangle.
+static void random_rect(uint32_t *rng, int rect[4]);
+
+/// Counts the free pixels of random rectangles of an arena, the kernel of
+/// the rect benchmarks.
+/// \param state State of the game.
+/// \param quadtree True to count them by qix_rect_count(), false pixel by
+/// pixel.
+static void count_rects(const qix_state_t *state, bool quadtree);
+
+/// Splits the arena of the given state into one long corridor.
+/// \param state State to be modified.
+static void build_serpentine(qix_state_t *state);
+
+/// Number of items processed by one operation of the given benchmark.
+/// \param bench Benchmark.
+/// \return number of items
+static double items_of(const bench_t *bench);
+
+/// Measures the given benchmark and prints its line of the report.
+/// \param bench Benchmark to be measured.
+/// \param min_ns Minimal length of one measurement.
+/// \param reps Number of measurements, the median is reported.
+static void measure(const bench_t *bench, long long min_ns, int reps);
+
+/// Entry point of the thread running the benchmarks.
+static void *runner_main(void *arg);
+
+static void bench_floodfill_open();
+static void bench_floodfill_serpentine();
+static void bench_floodfill_open_mt();
+static void bench_floodfill_serpentine_mt();
+static void bench_rle_floodfill_open();
+static void bench_rle_floodfill_serpentine();
+static void bench_pseudo_floodfill_open();
+static void bench_pseudo_floodfill_serpentine();
+static void bench_repaint();
+static void bench_snapshot();
+static void bench_rle_snapshot();
+static void bench_rle_encode();
+static void bench_rle_decode();
+static void bench_cell();
+static void bench_rle_cell();
+static void bench_block();
+static void bench_rle_block();
+static void bench_rect_count_open();
+static void bench_rect_count_serpentine();
+static void bench_rect_scan_open();
+static void bench_rect_scan_serpentine();
+static void bench_draw_background();
+static void bench_draw_frame();
+static void bench_fill_screen();
+static void bench_fb_replace();
+static void bench_fb_replace_scalar();
+static void bench_fb_equal();
+static void bench_fb_equal_scalar();
+static void bench_draw_img();
+static void bench_draw_char_1();
+static void bench_draw_char_2();
+static void bench_draw_char_3();
+static void bench_draw_text_bitmap();
+static void bench_to_rgb565();
+static void bench_load_ppm_image();
+static void bench_input_decode();
+
+/// <------------ End implementation functions declaration ------------>
+
+static const bench_t benches[] = {
+    {"floodfill_open", bench_floodfill_open, 1, 0, "px"},
+    {"floodfill_serpentine", bench_floodfill_serpentine, 1, 0, "px"},
+    {"floodfill_open_mt", bench_floodfill_open_mt, 1, 0, "px"},
+    {"floodfill_serpentine_mt", bench_floodfill_serpentine_mt, 1, 0, "px"},
+    {"rle_floodfill_open", bench_rle_floodfill_open, 1, 0, "px"},
+    {"rle_floodfill_serpentine", bench_rle_floodfill_serpentine, 1, 0, "px"},
+    {"pseudo_floodfill_open", bench_pseudo_floodfill_open, 1, 0, "px"},
+    {"pseudo_floodfill_serpentine", bench_pseudo_floodfill_serpentine, 1, 0,
+     "px"},
+    {"repaint", bench_repaint, 1, SCREEN_SIZE, "px"},
+    {"snapshot", bench_snapshot, 1, SCREEN_SIZE, "px"},
+    {"rle_snapshot", bench_rle_snapshot, 1, SCREEN_SIZE, "px"},
+    {"rle_encode", bench_rle_encode, 1, SCREEN_SIZE, "px"},
+    {"rle_decode", bench_rle_decode, 1, SCREEN_SIZE, "px"},
+    {"cell", bench_cell, CELL_QUERIES, 1, "px"},
+    {"rle_cell", bench_rle_cell, CELL_QUERIES, 1, "px"},
+    {"block", bench_block, 1, SCREEN_SIZE, "px"},
+    {"rle_block", bench_rle_block, 1, SCREEN_SIZE, "px"},
+    {"rect_count_open", bench_rect_count_open, RECT_QUERIES, 1, "rect"},
+    {"rect_count_serpentine", bench_rect_count_serpentine, RECT_QUERIES, 1,
+     "rect"},
+    {"rect_scan_open", bench_rect_scan_open, RECT_QUERIES, 1, "rect"},
+    {"rect_scan_serpentine", bench_rect_scan_serpentine, RECT_QUERIES, 1,
+     "rect"},
+    {"draw_background", bench_draw_background, 1, SCREEN_SIZE, "px"},
+    {"draw_frame", bench_draw_frame, 1, 1, "frame"},
+    {"fill_screen", bench_fill_screen, 1, SCREEN_SIZE, "px"},
+    {"fb_replace", bench_fb_replace, 1, SCREEN_SIZE, "px"},
+    {"fb_replace_scalar", bench_fb_replace_scalar, 1, SCREEN_SIZE, "px"},
+    {"fb_equal", bench_fb_equal, 1, SCREEN_SIZE, "px"},
+    {"fb_equal_scalar", bench_fb_equal_scalar, 1, SCREEN_SIZE, "px"},
+    {"draw_img", bench_draw_img, 1, SCREEN_SIZE, "px"},
+    {"draw_char_1", bench_draw_char_1, 26, 1, "char"},
+    {"draw_char_2", bench_draw_char_2, 26, 1, "char"},
+    {"draw_char_3", bench_draw_char_3, 26, 1, "char"},
+    {"draw_text_bitmap", bench_draw_text_bitmap, 1, 20, "char"},
+    {"to_rgb565", bench_to_rgb565, 1, SCREEN_SIZE, "px"},
+    {"load_ppm_image", bench_load_ppm_image, 1,
+     SCREEN_SIZE * sizeof(rgb888_t), "B"},
+    {"input_decode", bench_input_decode, 0, 1, "sample"},
+};
+
+static const char *filter = NULL;
+static long long min_ns = DEFAULT_MIN_MS * 1000000LL;
+static int reps = DEFAULT_REPS;
+
+int main(int argc, char *argv[])
+{
+    const char *trace_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:r:f:k:")) != -1) {
+        switch (opt) {
+        case 't':
+            min_ns = atol(optarg) * 1000000LL;
+            break;
+        case 'r':
+            reps = atoi(optarg);
+            break;
+        case 'f':
+            filter = optarg;
+            break;
+        case 'k':
+            trace_path = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-t min_ms] [-r reps] [-f filter] "
+                    "[-k knobs_trace]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (min_ns <= 0 || reps < 1 || reps > MAX_REPS) {
+        fprintf(stderr, "min_ms has to be positive and reps in 1..%d\n",
+                MAX_REPS);
+        return 1;
+    }
+
+    memory_map_boot_headless();
+
+    if (setup(trace_path)) {
+        fprintf(stderr, "cannot prepare benchmark data\n");
+        teardown();
+        return 1;
+    }
+
+    printf("# min_ms=%lld reps=%d trace=%s\n", min_ns / 1000000, reps,
+           trace_path ? trace_path : "synthetic");
+
+    if (check_fb() || check_rle() || check_quadtree()) {
+        teardown();
+        return 1;
+    }
+
+    pthread_t runner;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, RUNNER_STACK_SIZE);
+    int ret = pthread_create(&runner, &attr, runner_main, NULL);
+    pthread_attr_destroy(&attr);
+    if (ret) {
+        fprintf(stderr, "cannot create runner thread\n");
+        teardown();
+        return 1;
+    }
+    pthread_join(runner, NULL);
+
+    teardown();
+
+    return 0;
+}
+
+static long long monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static int setup(const char *trace_path)
+{
+    data.open = calloc(1, sizeof(qix_state_t));
+    data.serpentine = calloc(1, sizeof(qix_state_t));
+    if (!data.open || !data.serpentine) {
+        return -1;
+    }
+
+    qix_init(data.open, 1);
+    qix_init(data.serpentine, 1);
+    build_serpentine(data.serpentine);
+
+    data.img888 = calloc(1, sizeof(img_t));
+    if (!data.img888) {
+        return -1;
+    }
+    data.img888->pxs = malloc(SCREEN_SIZE * sizeof(rgb888_t));
+    if (!data.img888->pxs) {
+        return -1;
+    }
+    data.img888->width = SCREEN_WIDTH;
+    data.img888->height = SCREEN_HEIGHT;
+    data.img888->px_size = sizeof(rgb888_t);
+    for (int i = 0; i < SCREEN_SIZE; ++i) {
+        rgb888_t *px = (rgb888_t *)data.img888->pxs + i;
+        px->red = i;
+        px->green = i >> 3;
+        px->blue = i >> 6;
+    }
+
+    render_text_bitmap(&data.text, "FPS 120  3.1/12.4 ms");
+
+    for (int i = 0; i < 2; ++i) {
+        data.screens[i] = calloc(SCREEN_SIZE, sizeof(rgb565_t));
+        if (!data.screens[i]) {
+            return -1;
+        }
+    }
+
+    data.img565 = to_rgb565(data.img888);
+    if (!data.img565) {
+        return -1;
+    }
+
+    rle_arena_t **arenas[] = {
+        &data.rle_open, &data.rle_serpentine, &data.rle_scratch
+    };
+    for (int i = 0; i < 3; ++i) {
+        *arenas[i] = malloc(sizeof(rle_arena_t));
+        if (!*arenas[i] || rle_init(*arenas[i], BACKGROUND_COLOR)) {
+            free(*arenas[i]);
+            *arenas[i] = NULL;
+            return -1;
+        }
+    }
+    if (rle_encode(data.rle_open, data.open->background)
+        || rle_encode(data.rle_serpentine, data.serpentine->background)) {
+        return -1;
+    }
+
+    strcpy(data.ppm_path, "/tmp/qix_bench_XXXXXX");
+    int fd = mkstemp(data.ppm_path);
+    if (fd < 0) {
+        data.ppm_path[0] = '\0';
+        return -1;
+    }
+    close(fd);
+    save_ppm_image(data.img888, data.ppm_path);
+
+    if (trace_path) {
+        return load_trace(trace_path);
+    }
+
+    synthesize_trace();
+
+    return 0;
+}
+
+static void teardown()
+{
+    qix_release(data.open);
+    qix_release(data.serpentine);
+    free(data.open);
+    free(data.serpentine);
+    free_image(data.img888);
+    free_image(data.img565);
+    free(data.trace);
+    free(data.screens[0]);
+    free(data.screens[1]);
+    rle_arena_t *arenas[] = {
+        data.rle_open, data.rle_serpentine, data.rle_scratch
+    };
+    for (int i = 0; i < 3; ++i) {
+        if (arenas[i]) {
+            rle_free(arenas[i]);
+            free(arenas[i]);
+        }
+    }
+    if (data.ppm_path[0]) {
+        unlink(data.ppm_path);
+    }
+}
+
+static int load_trace(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+
+    int cap = TRACE_LEN;
+    data.trace = malloc(cap * sizeof(uint32_t));
+    data.trace_len = 0;
+
+    unsigned int value;
+    while (data.trace && fscanf(f, "%x", &value) == 1) {
+        if (data.trace_len == cap) {
+            cap *= 2;
+            uint32_t *grown = realloc(data.trace, cap * sizeof(uint32_t));
+            if (!grown) {
+                break;
+            }
+            data.trace = grown;
+        }
+        data.trace[data.trace_len++] = value;
+    }
+    fclose(f);
+
+    return data.trace && data.trace_len > 1 ? 0 : -1;
+}
+
+static void synthesize_trace()
+{
+    data.trace = malloc(TRACE_LEN * sizeof(uint32_t));
+    data.trace_len = TRACE_LEN;
+
+    uint32_t rng = 0x9E3779B9;
+    uint8_t blue = 0, green = 0, buttons = 0;
+    for (int i = 0; i < TRACE_LEN; ++i) {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+
+        // Like the game polls them: mostly idle, otherwise a few steps of
+        // one knob (wrapping around) or a press.
+        switch (rng % 8) {
+        case 0:
+            blue += 1 + (rng >> 8) % 4;
+            break;
+        case 1:
+            blue -= 1 + (rng >> 8) % 4;
+            break;
+        case 2:
+            green += 1 + (rng >> 8) % 4;
+            break;
+        case 3:
+            green -= 1 + (rng >> 8) % 4;
+            break;
+        case 4:
+            buttons = buttons ? 0 : 1 << (rng >> 8) % 3;
+            break;
+        default:
+            break;
+        }
+
+        data.trace[i] = (uint32_t)buttons << 24 | (uint32_t)green << 8 | blue;
+    }
+}
+
+static int check_fb()
+{
+    rgb565_t *a = data.screens[0], *b = data.screens[1];
+    const rgb565_t *src = (const rgb565_t *)data.img565->pxs;
+    uint32_t rng = 1;
+    int failed = 0;
+
+    for (int i = 0; i < FB_CHECK_CASES; ++i) {
+        for (int j = 0; j < SCREEN_SIZE; ++j) {
+            rng = rng * 1664525 + 1013904223;
+            a[j] = b[j] = rng >> 16 & (FB_CHECK_COLORS - 1);
+        }
+
+        // Every offset and width modulo the vector length is covered.
+        rng = rng * 1664525 + 1013904223;
+        int x = (rng >> 8) % SCREEN_WIDTH, w = (rng >> 20) % SCREEN_WIDTH;
+        rng = rng * 1664525 + 1013904223;
+        int y = (rng >> 8) % SCREEN_HEIGHT, h = (rng >> 20) % SCREEN_HEIGHT;
+        w = w % (SCREEN_WIDTH - x + 1);
+        h = h % (SCREEN_HEIGHT - y + 1);
+        int offset = y * SCREEN_WIDTH + x;
+        rgb565_t color = rng & (FB_CHECK_COLORS - 1);
+
+        bool ok;
+        switch (i % 4) {
+        case 0:
+            fb_fill(a + offset, SCREEN_WIDTH, w, h, color);
+            fb_fill_scalar(b + offset, SCREEN_WIDTH, w, h, color);
+            ok = !memcmp(a, b, SCREEN_SIZE * sizeof(rgb565_t));
+            break;
+        case 1:
+            fb_copy(a + offset, SCREEN_WIDTH, src + offset, SCREEN_WIDTH, w,
+                    h);
+            fb_copy_scalar(b + offset, SCREEN_WIDTH, src + offset,
+                           SCREEN_WIDTH, w, h);
+            ok = !memcmp(a, b, SCREEN_SIZE * sizeof(rgb565_t));
+            break;
+        case 2:
+            ok = fb_replace(a + offset, SCREEN_WIDTH, w, h, color,
+                            PSEUDO_COLOR)
+                == fb_replace_scalar(b + offset, SCREEN_WIDTH, w, h, color,
+                                     PSEUDO_COLOR)
+                && !memcmp(a, b, SCREEN_SIZE * sizeof(rgb565_t));
+            break;
+        default:
+            // Half of the cases differ in one pixel, maybe inside.
+            if (rng & 1 << 4) {
+                b[(rng >> 5) % SCREEN_SIZE] ^= 1;
+            }
+            ok = fb_equal(a + offset, SCREEN_WIDTH, b + offset, SCREEN_WIDTH,
+                          w, h)
+                == fb_equal_scalar(a + offset, SCREEN_WIDTH, b + offset,
+                                   SCREEN_WIDTH, w, h);
+            break;
+        }
+
+        if (!ok) {
+            fprintf(stderr, "fb check failed: case %d kernel %d rect %d,%d "
+                    "%dx%d\n", i, i % 4, x, y, w, h);
+            ++failed;
+        }
+    }
+
+    printf("# check=fb cases=%d failed=%d\n", FB_CHECK_CASES, failed);
+
+    // The benchmarks compare equal screens.
+    memset(a, 0, SCREEN_SIZE * sizeof(rgb565_t));
+    memset(b, 0, SCREEN_SIZE * sizeof(rgb565_t));
+
+    return failed ? -1 : 0;
+}
+
+static int check_rle()
+{
+    rle_arena_t *arena = data.rle_scratch;
+    rgb565_t (*flat)[SCREEN_HEIGHT] = (rgb565_t (*)[SCREEN_HEIGHT])
+        data.screens[0];
+    uint32_t rng = 1;
+    int failed = 0;
+
+    // Few colors, so that spans often merge with their neighbours.
+    memset(flat, 0, SCREEN_SIZE * sizeof(rgb565_t));
+    rle_free(arena);
+    if (rle_init(arena, 0)) {
+        return -1;
+    }
+    for (int i = 0; i < RLE_CHECK_CASES; ++i) {
+        rng = rng * 1664525 + 1013904223;
+        int x = (rng >> 8) % SCREEN_WIDTH, y = (rng >> 20) % SCREEN_HEIGHT;
+        rng = rng * 1664525 + 1013904223;
+        int n = 1 + (rng >> 8) % (i % 2 ? 8 : SCREEN_HEIGHT - y);
+        n = n > SCREEN_HEIGHT - y ? SCREEN_HEIGHT - y : n;
+        rgb565_t color = rng >> 20 & (FB_CHECK_COLORS - 1);
+
+        for (int j = y; j < y + n; ++j) {
+            flat[x][j] = color;
+        }
+        if (rle_set_cells(arena, x, y, n, color)
+            || !rle_column_ok(arena, x, flat[x])) {
+            fprintf(stderr, "rle check failed: case %d span %d,%d+%d\n", i,
+                    x, y, n);
+            ++failed;
+        }
+    }
+
+    // Fills of both benchmark arenas there and back, by the core and by
+    // both backends of territory.h.
+    qix_state_t *states[] = {data.open, data.serpentine};
+    territory_t rle, scratch;
+    territory_rle(&rle, arena);
+    territory_flat(&scratch, flat);
+    for (int i = 0; i < 2; ++i) {
+        qix_state_t *state = states[i];
+        int x = i ? BORDER_WIDTH + 1 : SCREEN_WIDTH / 2;
+        int y = i ? BORDER_HEIGHT + 1 : SCREEN_HEIGHT / 2;
+        rgb565_t colors[] = {BACKGROUND_COLOR, TRAIL_COLOR, BACKGROUND_COLOR};
+
+        if (rle_encode(arena, state->background)) {
+            return -1;
+        }
+        memcpy(flat, state->background, sizeof(state->background));
+        for (int j = 0; j < 2; ++j) {
+            int area = qix_measure_area(state, x, y, colors[j]);
+            qix_fill_area(state, x, y, colors[j], colors[j + 1]);
+            bool ok = territory_fill_area(&rle, x, y, colors[j],
+                                          colors[j + 1]) == area
+                && territory_fill_area(&scratch, x, y, colors[j],
+                                       colors[j + 1]) == area;
+            for (int c = 0; c < SCREEN_WIDTH && ok; ++c) {
+                ok = rle_column_ok(arena, c, state->background[c]);
+            }
+            ok = ok && blocks_agree(&rle, &state->territory)
+                && blocks_agree(&scratch, &state->territory);
+            if (!ok) {
+                fprintf(stderr, "rle check failed: fill %d of arena %d\n", j,
+                        i);
+                ++failed;
+            }
+        }
+    }
+
+    printf("# check=rle cases=%d failed=%d\n", RLE_CHECK_CASES + 4, failed);
+    printf("# footprint flat=%zu rle_open=%zu rle_serpentine=%zu unit=B\n",
+           sizeof(data.open->background), rle_bytes(data.rle_open),
+           rle_bytes(data.rle_serpentine));
+
+    memset(flat, 0, SCREEN_SIZE * sizeof(rgb565_t));
+
+    return failed ? -1 : 0;
+}
+
+static bool rle_column_ok(const rle_arena_t *arena, int x,
+                          const rgb565_t *pixels)
+{
+    const rle_column_t *column = &arena->columns[x];
+
+    if (column->count < 1 || column->runs[0].y != 0) {
+        return false;
+    }
+    for (int i = 1; i < column->count; ++i) {
+        if (column->runs[i].y <= column->runs[i - 1].y
+            || column->runs[i].color == column->runs[i - 1].color) {
+            return false;
+        }
+    }
+    for (int y = 0; y < SCREEN_HEIGHT; ++y) {
+        if (rle_cell(arena, x, y) != pixels[y]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool blocks_agree(const territory_t *a, const territory_t *b)
+{
+    rgb565_t buffers[2][QIX_TILE_SIZE * QIX_TILE_SIZE];
+
+    for (int tile = 0; tile < QIX_TILES; ++tile) {
+        int x = tile % QIX_TILES_X * QIX_TILE_SIZE;
+        int y = tile / QIX_TILES_X * QIX_TILE_SIZE;
+        int strides[2];
+        const rgb565_t *pa = territory_block(a, x, y, QIX_TILE_SIZE,
+                                             QIX_TILE_SIZE, buffers[0],
+                                             &strides[0]);
+        const rgb565_t *pb = territory_block(b, x, y, QIX_TILE_SIZE,
+                                             QIX_TILE_SIZE, buffers[1],
+                                             &strides[1]);
+        for (int c = 0; c < QIX_TILE_SIZE; ++c) {
+            if (memcmp(&pa[c * strides[0]], &pb[c * strides[1]],
+                       QIX_TILE_SIZE * sizeof(rgb565_t))) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static unsigned int read_blocks(const territory_t *territory)
+{
+    rgb565_t buffer[QIX_TILE_SIZE * QIX_TILE_SIZE];
+    unsigned int acc = 0;
+
+    for (int tile = 0; tile < QIX_TILES; ++tile) {
+        int stride;
+        const rgb565_t *pixels = territory_block(
+            territory, tile % QIX_TILES_X * QIX_TILE_SIZE,
+            tile / QIX_TILES_X * QIX_TILE_SIZE, QIX_TILE_SIZE, QIX_TILE_SIZE,
+            buffer, &stride);
+        for (int c = 0; c < QIX_TILE_SIZE; ++c) {
+            for (int r = 0; r < QIX_TILE_SIZE; ++r) {
+                acc += pixels[c * stride + r];
+            }
+        }
+    }
+
+    return acc;
+}
+
+static int check_quadtree()
+{
+    const qix_state_t *states[] = {data.open, data.serpentine};
+    rgb565_t colors[] = {
+        BACKGROUND_COLOR, FILL_COLOR, BORDER_COLOR, TRAIL_COLOR
+    };
+    uint32_t rng = 1;
+    int failed = 0;
+
+    for (int i = 0; i < RECT_CHECK_CASES; ++i) {
+        const qix_state_t *state = states[i % 2];
+        rgb565_t color = colors[i / 2 % 4];
+        int r[4];
+        random_rect(&rng, r);
+        if (qix_rect_count(state, r[0], r[1], r[2], r[3], color)
+            != scan_rect(state, r[0], r[1], r[2], r[3], color)) {
+            fprintf(stderr, "quadtree check failed: case %d rect %d,%d %dx%d\n",
+                    i, r[0], r[1], r[2], r[3]);
+            ++failed;
+        }
+    }
+
+    printf("# check=quadtree cases=%d failed=%d\n", RECT_CHECK_CASES, failed);
+
+    return failed ? -1 : 0;
+}
+
+static int scan_rect(const qix_state_t *state, int x, int y, int w, int h,
+                     rgb565_t color)
+{
+    int n = 0;
+    for (int px = x; px < x + w; ++px) {
+        for (int py = y; py < y + h; ++py) {
+            n += state->background[px][py] == color;
+        }
+    }
+
+    return n;
+}
+
+static void random_rect(uint32_t *rng, int rect[4])
+{
+    *rng = *rng * 1664525 + 1013904223;
+    rect[2] = 1 + (*rng >> 8) % RECT_MAX_SIZE;
+    rect[3] = 1 + (*rng >> 20) % RECT_MAX_SIZE;
+    *rng = *rng * 1664525 + 1013904223;
+    rect[0] = (*rng >> 8) % (SCREEN_WIDTH - rect[2] + 1);
+    rect[1] = (*rng >> 20) % (SCREEN_HEIGHT - rect[3] + 1);
+}
+
+static void count_rects(const qix_state_t *state, bool quadtree)
+{
+    uint32_t rng = sink | 1;
+    unsigned int acc = 0;
+    for (int i = 0; i < RECT_QUERIES; ++i) {
+        int r[4];
+        random_rect(&rng, r);
+        acc += quadtree
+            ? qix_rect_count(state, r[0], r[1], r[2], r[3], BACKGROUND_COLOR)
+            : scan_rect(state, r[0], r[1], r[2], r[3], BACKGROUND_COLOR);
+    }
+    sink += acc;
+}
+
+static void build_serpentine(qix_state_t *state)
+{
+    // Vertical walls 2 px wide every 8 px, with a gap alternating between
+    // the top and the bottom.
+    int k = 0;
+    for (int x = BORDER_WIDTH + 6; x < SCREEN_WIDTH - BORDER_WIDTH - 2;
+         x += 8, ++k) {
+        int gap_top = k % 2 ? BORDER_HEIGHT : SCREEN_HEIGHT - BORDER_HEIGHT - 8;
+        for (int y = BORDER_HEIGHT; y < SCREEN_HEIGHT - BORDER_HEIGHT; ++y) {
+            if (y >= gap_top && y < gap_top + 8) {
+                continue;
+            }
+            state->background[x][y] = FILL_COLOR;
+            state->background[x + 1][y] = FILL_COLOR;
+        }
+    }
+    qix_refresh_tiles(state);
+}
+
+static double items_of(const bench_t *bench)
+{
+    if (bench->items_per_op > 0) {
+        return bench->items_per_op;
+    }
+
+    // Captures: the fill benchmarks fill the area and then restore it.
+    bool serpentine = strstr(bench->name, "serpentine") != NULL;
+    bool pseudo = strstr(bench->name, "pseudo") != NULL;
+    int area = serpentine ? data.serpentine_area : data.open_area;
+
+    return pseudo ? area : 2.0 * area;
+}
+
+static void measure(const bench_t *bench, long long min_ns, int reps)
+{
+    int ops_per_call = bench->ops_per_call ? bench->ops_per_call
+        : data.trace_len - 1;
+
+    // Find the number of calls taking at least min_ns.
+    long calls = 1;
+    while (true) {
+        long long start = monotonic_ns();
+        for (long i = 0; i < calls; ++i) {
+            bench->run();
+        }
+        if (monotonic_ns() - start >= min_ns || calls >= (1L << 30)) {
+            break;
+        }
+        calls *= 2;
+    }
+
+    double ns_op[MAX_REPS];
+    for (int r = 0; r < reps; ++r) {
+        long long start = monotonic_ns();
+        for (long i = 0; i < calls; ++i) {
+            bench->run();
+        }
+        ns_op[r] = (double)(monotonic_ns() - start) / (calls * ops_per_call);
+    }
+
+    // Insertion sort, reps is tiny.
+    for (int i = 1; i < reps; ++i) {
+        double v = ns_op[i];
+        int j = i;
+        while (j > 0 && ns_op[j - 1] > v) {
+            ns_op[j] = ns_op[j - 1];
+            --j;
+        }
+        ns_op[j] = v;
+    }
+    double median = ns_op[reps / 2];
+
+    printf("bench=%s ops=%ld ns_op=%.1f items_s=%.4g unit=%s\n", bench->name,
+           calls * ops_per_call, median, items_of(bench) * 1e9 / median,
+           bench->unit);
+    fflush(stdout);
+}
+
+static void *runner_main(void *arg)
+{
+    data.open_area = qix_measure_area(data.open, SCREEN_WIDTH / 2,
+                                      SCREEN_HEIGHT / 2, BACKGROUND_COLOR);
+    data.serpentine_area = qix_measure_area(data.serpentine,
+                                            BORDER_WIDTH + 1,
+                                            BORDER_HEIGHT + 1,
+                                            BACKGROUND_COLOR);
+
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); ++i) {
+        if (filter && !strstr(benches[i].name, filter)) {
+            continue;
+        }
+        measure(benches + i, min_ns, reps);
+    }
+
+    return NULL;
+}
+
+static void bench_floodfill_open()
+{
+    int x = SCREEN_WIDTH / 2, y = SCREEN_HEIGHT / 2;
+    qix_fill_area(data.open, x, y, BACKGROUND_COLOR, FILL_COLOR);
+    qix_fill_area(data.open, x, y, FILL_COLOR, BACKGROUND_COLOR);
+}
+
+static void bench_floodfill_serpentine()
+{
+    int x = BORDER_WIDTH + 1, y = BORDER_HEIGHT + 1;
+    qix_fill_area(data.serpentine, x, y, BACKGROUND_COLOR, TRAIL_COLOR);
+    qix_fill_area(data.serpentine, x, y, TRAIL_COLOR, BACKGROUND_COLOR);
+}
+
+static void bench_floodfill_open_mt()
+{
+    data.open->params.fill_threads = QIX_MAX_FILL_THREADS;
+    bench_floodfill_open();
+    data.open->params.fill_threads = 1;
+}
+
+static void bench_floodfill_serpentine_mt()
+{
+    data.serpentine->params.fill_threads = QIX_MAX_FILL_THREADS;
+    bench_floodfill_serpentine();
+    data.serpentine->params.fill_threads = 1;
+}
+
+static void bench_rle_floodfill_open()
+{
+    int x = SCREEN_WIDTH / 2, y = SCREEN_HEIGHT / 2;
+    rle_fill_area(data.rle_open, x, y, BACKGROUND_COLOR, FILL_COLOR);
+    rle_fill_area(data.rle_open, x, y, FILL_COLOR, BACKGROUND_COLOR);
+}
+
+static void bench_rle_floodfill_serpentine()
+{
+    int x = BORDER_WIDTH + 1, y = BORDER_HEIGHT + 1;
+    rle_fill_area(data.rle_serpentine, x, y, BACKGROUND_COLOR, TRAIL_COLOR);
+    rle_fill_area(data.rle_serpentine, x, y, TRAIL_COLOR, BACKGROUND_COLOR);
+}
+
+static void bench_pseudo_floodfill_open()
+{
+    sink += qix_measure_area(data.open, SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2,
+                             BACKGROUND_COLOR);
+}
+
+static void bench_pseudo_floodfill_serpentine()
+{
+    sink += qix_measure_area(data.serpentine, BORDER_WIDTH + 1,
+                             BORDER_HEIGHT + 1, BACKGROUND_COLOR);
+}
+
+static void bench_repaint()
+{
+    // Nothing matches, so the arena stays the same and every tile which is
+    // not uniform is scanned.
+    qix_repaint(data.open, PSEUDO_COLOR, FILL_COLOR);
+}
+
+static void bench_snapshot()
+{
+    memcpy(data.screens[0], data.serpentine->background,
+           sizeof(data.serpentine->background));
+}
+
+static void bench_rle_snapshot()
+{
+    rle_copy(data.rle_scratch, data.rle_serpentine);
+}
+
+static void bench_rle_encode()
+{
+    rle_encode(data.rle_scratch, data.serpentine->background);
+}
+
+static void bench_rle_decode()
+{
+    rle_decode(data.rle_serpentine,
+               (rgb565_t (*)[SCREEN_HEIGHT])data.screens[0]);
+}
+
+static void bench_cell()
+{
+    uint32_t rng = sink | 1;
+    unsigned int acc = 0;
+    for (int i = 0; i < CELL_QUERIES; ++i) {
+        rng = rng * 1664525 + 1013904223;
+        acc += data.serpentine->background[(rng >> 8) % SCREEN_WIDTH]
+            [(rng >> 20) % SCREEN_HEIGHT];
+    }
+    sink += acc;
+}
+
+static void bench_rle_cell()
+{
+    uint32_t rng = sink | 1;
+    unsigned int acc = 0;
+    for (int i = 0; i < CELL_QUERIES; ++i) {
+        rng = rng * 1664525 + 1013904223;
+        acc += rle_cell(data.rle_serpentine, (rng >> 8) % SCREEN_WIDTH,
+                        (rng >> 20) % SCREEN_HEIGHT);
+    }
+    sink += acc;
+}
+
+static void bench_block()
+{
+    sink += read_blocks(&data.serpentine->territory);
+}
+
+static void bench_rle_block()
+{
+    territory_t territory;
+    territory_rle(&territory, data.rle_serpentine);
+    sink += read_blocks(&territory);
+}
+
+static void bench_rect_count_open()
+{
+    count_rects(data.open, true);
+}
+
+static void bench_rect_count_serpentine()
+{
+    count_rects(data.serpentine, true);
+}
+
+static void bench_rect_scan_open()
+{
+    count_rects(data.open, false);
+}
+
+static void bench_rect_scan_serpentine()
+{
+    count_rects(data.serpentine, false);
+}
+
+static void bench_draw_background()
+{
+    draw_background(data.open);
+}
+
+static void bench_draw_frame()
+{
+    // The arena does not change, only the tiles under the entities are
+    // redrawn, as in most frames of a game.
+    draw_frame(data.serpentine);
+}
+
+static void bench_fill_screen()
+{
+    fill_screen(sink & 0xffff);
+}
+
+static void bench_fb_replace()
+{
+    // Nothing matches, the whole screen is scanned and stays the same.
+    sink += fb_replace(data.screens[0], SCREEN_WIDTH, SCREEN_WIDTH,
+                       SCREEN_HEIGHT, PSEUDO_COLOR, FILL_COLOR);
+}
+
+static void bench_fb_replace_scalar()
+{
+    sink += fb_replace_scalar(data.screens[0], SCREEN_WIDTH, SCREEN_WIDTH,
+                              SCREEN_HEIGHT, PSEUDO_COLOR, FILL_COLOR);
+}
+
+static void bench_fb_equal()
+{
+    sink += fb_equal(data.screens[0], SCREEN_WIDTH, data.screens[1],
+                     SCREEN_WIDTH, SCREEN_WIDTH, SCREEN_HEIGHT);
+}
+
+static void bench_fb_equal_scalar()
+{
+    sink += fb_equal_scalar(data.screens[0], SCREEN_WIDTH, data.screens[1],
+                            SCREEN_WIDTH, SCREEN_WIDTH, SCREEN_HEIGHT);
+}
+
+static void bench_draw_img()
+{
+    draw_img(data.img565);
+}
+
+static void bench_draw_char_1()
+{
+    for (char ch = 'A'; ch <= 'Z'; ++ch) {
+        draw_char(100, 100, ch, 1, 0xffff);
+    }
+}
+
+static void bench_draw_char_2()
+{
+    for (char ch = 'A'; ch <= 'Z'; ++ch) {
+        draw_char(100, 100, ch, 2, 0xffff);
+    }
+}
+
+static void bench_draw_char_3()
+{
+    for (char ch = 'A'; ch <= 'Z'; ++ch) {
+        draw_char(100, 100, ch, 3, 0xffff);
+    }
+}
+
+static void bench_draw_text_bitmap()
+{
+    draw_text_bitmap(100, 100, &data.text, 0xffff);
+}
+
+static void bench_to_rgb565()
+{
+    img_t *img = to_rgb565(data.img888);
+    sink += img->pxs[0];
+    free_image(img);
+}
+
+static void bench_load_ppm_image()
+{
+    img_t *img = load_ppm_image(data.ppm_path);
+    sink += img ? img->pxs[0] : 0;
+    free_image(img);
+}
+
+static void bench_input_decode()
+{
+    unsigned int acc = 0;
+    for (int i = 1; i < data.trace_len; ++i) {
+        acc += input_decode(data.trace[i - 1], data.trace[i]);
+    }
+    sink += acc;
+}
@@ -0,0 +1,3765 @@
+#include "qix_core.h"
+#include "fb.h"
+#include "span.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PLAYER_HIT_ANIM_PERIOD 6
+#define PLAYER_HIT_ANIM_LENGTH 60
+#define QIX_HIT_ANIM_LENGTH 10
+#define MARK_FILLED 3 ///< Mark of filled pixels, sides are marked 1 and 2.
+#define MEASURE_CHUNK_PX 256 ///< Pixels one side is searched by in a turn.
+#define OUTLINE_SLACK_PX 100 ///< Pixels the areas told from the outline may
+                             /// differ by and still be measured, several
+                             /// times the error of the estimate.
+#define FILL_PROBE 0x80000000u ///< Flags an entry of a parallel fill as a
+                              /// span of pixels to be claimed.
+
+static const rgb565_t qix_color[] = {RED, GREEN, BLUE};
+
+typedef struct fill_thread_t fill_thread_t;
+
+/// Span fill shared by the threads of a parallel fill. The columns are dealt
+/// out to the threads in stripes of a tile. Only the owner of a column marks
+/// and fills its pixels, so they need no atomic access and the filled area
+/// is the same as with one thread. Spans reaching a column of another thread
+/// are handed over to it to be claimed. The stacks and the counters of
+/// threads are guarded by the lock of the helper pool.
+typedef struct {
+    qix_state_t *state; ///< State of the game.
+    qix_fill_pool_t *pool; ///< Helper threads and their lock.
+    fill_thread_t *threads; ///< Threads of the fill, the caller first.
+    rgb565_t color; ///< Color of the area.
+    rgb565_t new_color; ///< Color the area gets.
+    uint8_t match; ///< Mark pixels of the area have.
+    uint8_t set; ///< Mark claimed pixels get.
+    int nthreads; ///< Number of threads owning columns.
+    int count[QIX_MAX_FILL_THREADS]; ///< Entries on the stacks.
+    int budget; ///< Pixels left to be filled, accessed atomically.
+    int busy; ///< Threads processing an entry.
+    int waiting; ///< Threads waiting for entries.
+} fill_job_t;
+
+/// One thread of a parallel fill with the changes it has made to the
+/// summaries of the arena, merged once the threads have finished.
+struct fill_thread_t {
+    fill_job_t *job; ///< Shared fill.
+    unsigned int stacks; ///< Bit mask of the stacks the thread serves, more
+                         /// than its own if another thread has not started.
+    int done; ///< Pixels filled.
+    int claimed; ///< Pixels claimed.
+    int tiles[QIX_TILES]; ///< Pixels filled in every tile.
+    bool columns[SCREEN_WIDTH]; ///< True if the column has been written.
+    uint8_t flags[QIX_GRID_SIZE]; ///< Grid flags set.
+};
+
+/// <------------ Start implementation functions declaration ------------>
+
+/// Get the next pseudo-random number of the given state (xorshift32).
+/// \param state State whose generator should be advanced.
+/// \return next pseudo-random number
+static uint32_t next_random(qix_state_t *state);
+
+/// Get a random direction (UP, DOWN, LEFT or RIGHT).
+/// \param state State whose generator should be used.
+/// \return random direction
+static int random_direction(qix_state_t *state);
+
+/// Get the color of the background at the given coordinates, read through
+/// the territory of the state. The flat backend is read without the call.
+/// \param state State of the game.
+/// \param x X-coordinate of the pixel.
+/// \param y Y-coordinate of the pixel.
+/// \return color of the pixel, BORDER_COLOR if outside of the arena
+static rgb565_t cell(const qix_state_t *state, int x, int y);
+
+/// Initializes player settings.
+/// \param state State whose parameters should be used.
+/// \param player Player to be initialized.
+static void init_player(const qix_state_t *state, entity_t *player);
+
+/// Initializes the given qix settings.
+/// \param state State whose qix should be initialized.
+/// \param i Index of the qix in the pool.
+static void init_qix(qix_state_t *state, int i);
+
+/// Writes the given color into the background and updates the flags of the
+/// spatial hash.
+/// \param state State of the game.
+/// \param x X-coordinate of the pixel.
+/// \param y Y-coordinate of the pixel.
+/// \param color New color of the pixel.
+static void set_cell(qix_state_t *state, int x, int y, rgb565_t color);
+
+/// Writes the given color into a run of pixels of one column and updates
+/// the flags of the spatial hash.
+/// \param state State of the game.
+/// \param x X-coordinate of the column.
+/// \param y Y-coordinate of the first pixel.
+/// \param n Number of pixels.
+/// \param old_color Color all the pixels have.
+/// \param color New color of the pixels.
+static void set_cells(qix_state_t *state, int x, int y, int n,
+                      rgb565_t old_color, rgb565_t color);
+
+/// Writes a run of one column of the background into the territory too,
+/// when it is kept apart. If the territory runs out of memory, it is
+/// dropped and set over the background again.
+/// \param state State of the game.
+/// \param x X-coordinate of the column.
+/// \param y Y-coordinate of the first pixel.
+/// \param n Number of pixels.
+/// \param color New color of the pixels.
+static void mirror_cells(qix_state_t *state, int x, int y, int n,
+                         rgb565_t color);
+
+/// Writes a whole column of the background into the territory, when it is
+/// kept apart, run by run.
+/// \param state State of the game.
+/// \param x X-coordinate of the column.
+static void mirror_column(qix_state_t *state, int x);
+
+/// Get the counts of the tile summary kept for the given color.
+/// \param tiles Tile summary.
+/// \param color Color of pixels.
+/// \return counts of every tile, NULL if the color is not counted
+static uint16_t *tile_counts(qix_tiles_t *tiles, rgb565_t color);
+
+/// Moves pixels of a tile from one color to another in the tile summary
+/// and marks the tile dirty.
+/// \param state State of the game.
+/// \param tile Index of the tile.
+/// \param old_color Old color of the pixels.
+/// \param color New color of the pixels.
+/// \param n Number of pixels.
+static void count_tile(qix_state_t *state, int tile, rgb565_t old_color,
+                       rgb565_t color, int n);
+
+/// Get the counts of the quadtree kept for the given color.
+/// \param tree Quadtree over the tiles.
+/// \param color Color of pixels.
+/// \return counts of every node, NULL if the color is not counted
+static int32_t *quad_counts(qix_quadtree_t *tree, rgb565_t color);
+
+/// Adds pixels of a tile to the nodes of the quadtree above it.
+/// \param counts Counts of the quadtree of one color.
+/// \param tile Index of the tile.
+/// \param n Number of pixels, negative to take them away.
+static void count_quad(int32_t *counts, int tile, int n);
+
+/// Get the index of a node of the quadtree.
+/// \param level Level of the node, from 1 up to QIX_QUAD_LEVELS.
+/// \param nx Column of the node within its level.
+/// \param ny Row of the node within its level.
+/// \return index into the counts of qix_quadtree_t
+static int quad_node(int level, int nx, int ny);
+
+/// Get the part of the arena covered by a node of the quadtree.
+/// \param level Level of the node, 0 for a tile.
+/// \param nx Column of the node within its level.
+/// \param ny Row of the node within its level.
+/// \return rectangle of the node clipped to the arena, empty if the node
+/// lies past it
+static qix_rect_t quad_rect(int level, int nx, int ny);
+
+/// Get the number of pixels of a color within a node of the quadtree.
+/// \param state State of the game.
+/// \param color Color counted by the tile summary.
+/// \param level Level of the node, 0 for a tile.
+/// \param nx Column of the node within its level.
+/// \param ny Row of the node within its level.
+/// \return number of pixels
+static int quad_count(const qix_state_t *state, rgb565_t color, int level,
+                      int nx, int ny);
+
+/// Counts the pixels of a color within the part of a rectangle covered by
+/// a node of the quadtree, descending only into nodes of several colors.
+/// \param state State of the game.
+/// \param rect Rectangle within the arena.
+/// \param color Color counted by the tile summary.
+/// \param level Level of the node, 0 for a tile.
+/// \param nx Column of the node within its level.
+/// \param ny Row of the node within its level.
+/// \return number of pixels
+static int count_rect(const qix_state_t *state, qix_rect_t rect,
+                      rgb565_t color, int level, int nx, int ny);
+
+/// Get the index of the spatial hash cell containing the given pixel.
+/// \param x X-coordinate of the pixel.
+/// \param y Y-coordinate of the pixel.
+/// \return index of the cell, coordinates outside of the arena are clamped
+static int grid_index(int x, int y);
+
+/// Get the spatial hash flags of all cells touched by a rectangle.
+/// \param state State of the game.
+/// \param rect Non-empty rectangle of pixels within the screen.
+/// \return qix_grid_flag_t flags of the touched cells
+static unsigned int grid_flags(const qix_state_t *state, qix_rect_t rect);
+
+/// Buckets all the qixes into the spatial hash by their positions.
+/// \param state State of the game.
+static void build_qix_grid(qix_state_t *state);
+
+/// Takes one HP from the player and makes him invincible for a while.
+/// \param state State of the game.
+static void hit_player(qix_state_t *state);
+
+/// Advances the blinking animation of the invincible player.
+/// \param state State of the game.
+static void update_player_hit_anim(qix_state_t *state);
+
+/// Adds quarter of trail under the player based on its direction.
+/// \param state State of the game.
+static void add_whole_trail_to_background(qix_state_t *state);
+
+/// Adds trail under the player.
+/// \param state State of the game.
+static void add_trail_to_background(qix_state_t *state);
+
+/// Paints the background pixels of a rectangle as trail and records the
+/// rectangle in the trail index if any pixel has changed.
+/// \param state State of the game.
+/// \param x1 First column.
+/// \param y1 First row.
+/// \param x2 Column after the last one.
+/// \param y2 Row after the last one.
+/// \return true if the rectangle has been painted or held, false if it had
+/// no background pixel
+static bool paint_trail(qix_state_t *state, int x1, int y1, int x2, int y2);
+
+/// Adds the center of the player to the path of the trail, starting a new
+/// path if the player has just left the captured area.
+/// \param state State of the game.
+static void record_trail(qix_state_t *state);
+
+/// Adds a rectangle to the trail index, extending the last segment if the
+/// rectangle continues it.
+/// \param index Trail index.
+/// \param rect Rectangle painted as trail.
+static void index_trail(qix_trail_index_t *index, qix_rect_t rect);
+
+/// Starts a capture of the least possible area around the current position
+/// of the player based on its direction.
+/// \param state State of the game.
+static void floodfill_least_area(qix_state_t *state);
+
+/// Check if the given pixel is on the screen.
+/// \param x X-coordinate of the pixel.
+/// \param y Y-coordinate of the pixel.
+/// \return true if the pixel is on the screen, false otherwise
+static bool in_bounds(int x, int y);
+
+/// Get a place in the storage shared by the queues of a capture.
+/// \param cap Capture.
+/// \param q Queue, 0 or 1.
+/// \param i Index in the queue.
+/// \return place of the span
+static uint32_t *queue_slot(qix_capture_t *cap, int q, int i);
+
+/// Queues the longest span of a column through a pixel for a capture
+/// search, if the pixel has the given color and mark. Notes whether the
+/// span touches a qix, and whether the pixel belongs to another search.
+/// \param state State of the game.
+/// \param q Queue, 0 or 1.
+/// \param x X-coordinate of the pixel.
+/// \param y Y-coordinate of the pixel.
+/// \param color Color of the searched area.
+/// \param match Mark the pixel has to have.
+/// \param set Mark the queued pixels get.
+/// \return y-coordinate of the last pixel of the span, y if nothing was
+/// queued
+static int enqueue(qix_state_t *state, int q, int x, int y,
+                   rgb565_t color, uint8_t match, uint8_t set);
+
+/// Processes queued spans of a capture search breadth-first, queueing the
+/// spans touching them in the neighbouring columns.
+/// \param state State of the game.
+/// \param q Queue, 0 or 1.
+/// \param budget Maximal number of pixels to be processed.
+/// \param color Color of the searched area.
+/// \param match Mark pixels of the area have.
+/// \param set Mark queued pixels get.
+/// \param new_color Color processed pixels get, color to keep them.
+/// \return number of processed pixels, whole spans are processed so it may
+/// exceed the budget
+static int search(qix_state_t *state, int q, int budget, rgb565_t color,
+                  uint8_t match, uint8_t set, rgb565_t new_color);
+
+/// Fills queued spans of the first queue like search(), split across the
+/// fill threads of the parameters if the fill is large enough.
+/// \param state State of the game.
+/// \param budget Maximal number of pixels to be processed.
+/// \param area Number of pixels expected to be filled.
+/// \param color Color of the area.
+/// \param match Mark pixels of the area have.
+/// \param new_color Color the area gets.
+/// \return number of processed pixels
+static int fill(qix_state_t *state, int budget, int area, rgb565_t color,
+                uint8_t match, rgb565_t new_color);
+
+/// Fills queued spans of the first queue on several threads. Spans left
+/// when the budget runs out are queued back.
+/// \param state State of the game.
+/// \param budget Maximal number of pixels to be processed.
+/// \param color Color of the area.
+/// \param match Mark pixels of the area have.
+/// \param new_color Color the area gets.
+/// \return number of processed pixels
+static int parallel_fill(qix_state_t *state, int budget, rgb565_t color,
+                         uint8_t match, rgb565_t new_color);
+
+/// Get the thread owning a column in a parallel fill.
+/// \param job Shared fill.
+/// \param x X-coordinate of the column.
+/// \return index of the thread and of its stack
+static int fill_owner(const fill_job_t *job, int x);
+
+/// Starts the helper threads of parallel fills that are not running yet.
+/// \param state State of the game.
+/// \param wanted Number of helpers wanted.
+/// \return number of helpers that will join the next fill, at most wanted
+static int start_fill_helpers(qix_state_t *state, int wanted);
+
+/// Stops the helper threads of parallel fills.
+/// \param state State of the game.
+static void stop_fill_helpers(qix_state_t *state);
+
+/// Entry point of a helper thread of parallel fills. Joins every fill
+/// started until it is stopped.
+/// \param arg State of the game.
+/// \return NULL
+static void *fill_helper_main(void *arg);
+
+/// Takes part in a parallel fill until no entry is left for the thread or
+/// the budget has run out.
+/// \param thread Thread of the fill.
+static void run_fill_thread(fill_thread_t *thread);
+
+/// Fills one span and claims the spans touching it in the neighbouring
+/// columns, or hands them over to the owners of the columns.
+/// \param thread Thread of the fill.
+/// \param id Owner of the column of the span.
+/// \param span Span to be filled.
+static void fill_span(fill_thread_t *thread, int id, uint32_t span);
+
+/// Claims the longest span of a column through a pixel for a parallel fill,
+/// if the pixel has the color and the mark of the area, and pushes it to
+/// the stack of the owner of the column.
+/// \param thread Thread of the fill.
+/// \param id Owner of the column.
+/// \param x X-coordinate of the pixel.
+/// \param y Y-coordinate of the pixel.
+/// \return y-coordinate of the last pixel of the span, y if nothing was
+/// claimed
+static int claim_span(fill_thread_t *thread, int id, int x, int y);
+
+/// Pushes an entry to a stack of a parallel fill.
+/// \param job Shared fill.
+/// \param id Index of the stack.
+/// \param entry Span to be filled, or to be claimed if FILL_PROBE is set.
+static void push_entry(fill_job_t *job, int id, uint32_t entry);
+
+/// Takes the newest entry of a stack served by a thread. A taken entry
+/// counts as busy until the next call. While the stacks are empty but other
+/// threads are busy and may push more, the thread sleeps.
+/// \param thread Thread of the fill.
+/// \param busy True if the thread has processed an entry taken before.
+/// \param id Output, index of the stack.
+/// \param entry Output, the taken entry.
+/// \return true if an entry has been taken, false if the thread is done
+static bool take_entry(fill_thread_t *thread, bool busy, int *id,
+                       uint32_t *entry);
+
+/// Starts searching both sides of the trail.
+/// \param state State of the game.
+static void measure_sides(qix_state_t *state);
+
+/// Searches the side of the trail chosen by side_to_measure() for one turn
+/// and chooses the side to be filled once the searches have seen enough.
+/// \param state State of the game.
+/// \param budget Maximal number of pixels to be processed.
+/// \return number of processed pixels
+static int measure(qix_state_t *state, int budget);
+
+/// Starts measuring the area around the trail as a whole, once the
+/// searches of both sides have met.
+/// \param state State of the game.
+static void measure_whole(qix_state_t *state);
+
+/// Picks the side whose search goes on, the one which may turn out to be
+/// free of qixes, otherwise the one searched less so far.
+/// \param cap Capture.
+/// \return side to be searched, 0 or 1
+static int side_to_measure(const qix_capture_t *cap);
+
+/// Chooses the side to be filled and starts filling it, once the searches
+/// have seen enough.
+/// \param state State of the game.
+/// \return true if a side has been chosen, false if the searches have to
+/// go on
+static bool choose_side(qix_state_t *state);
+
+/// Applies the capture rule: the side without a qix, the smaller one if
+/// both or neither have one.
+/// \param qix0 True if the first side has a qix.
+/// \param qix1 True if the second side has a qix.
+/// \param area0 Area of the first side.
+/// \param area1 Area of the second side.
+/// \return side to be filled, 0 or 1
+static int capture_rule(bool qix0, bool qix1, long area0, long area1);
+
+/// Notes the positions of the qixes for the capture starting.
+/// \param state State of the game.
+static void snapshot_qixes(qix_state_t *state);
+
+/// Starts filling the chosen side.
+/// \param state State of the game.
+static void fill_side(qix_state_t *state);
+
+/// Chooses the side to be filled from the region map and starts filling
+/// it.
+/// \param state State of the game.
+/// \return true on success, false if the regions are not known and the
+/// sides have to be searched
+static bool choose_by_regions(qix_state_t *state);
+
+/// Chooses the side to be filled from the shoelace areas of the polygons
+/// the path of the trail cuts the outline of the free area into, and
+/// starts filling it.
+/// \param state State of the game.
+/// \return true on success, false if the path does not describe the trail,
+/// the sides are too close to be told apart this way or a qix is too close
+/// to the path to be placed
+static bool choose_by_outline(qix_state_t *state);
+
+/// Check if a pixel is free or trail, the pixels within the outline.
+/// \param state State of the game.
+/// \param x X-coordinate of the pixel.
+/// \param y Y-coordinate of the pixel.
+/// \return true if the pixel is background or trail, false otherwise
+static bool in_outline(const qix_state_t *state, int x, int y);
+
+/// Traces the outline of the free and trail pixels connected to a pixel,
+/// keeping them on the right, into the outline of the capture.
+/// \param state State of the game.
+/// \param x X-coordinate of a pixel within the outline.
+/// \param y Y-coordinate of the pixel.
+/// \return true on success, false if there are more corners than fit
+static bool trace_outline(qix_state_t *state, int x, int y);
+
+/// Builds the polygon right of the path of the trail: the path, then the
+/// outline from the point nearest to its end forward to the point nearest
+/// to its start.
+/// \param cap Capture with its path and outline.
+/// \param end_edge Output, edge of the outline the end is closed to.
+/// \param corners_out Output, corners of the outline in the polygon.
+/// \param reach Output, length the trail reaches past both ends of the
+/// path to the outline.
+/// \return true on success, false if an end of the path is not next to
+/// the outline
+static bool build_side(qix_capture_t *cap, int *end_edge, int *corners_out,
+                       int *reach);
+
+/// Get how far a point lies beyond the end of a run, on its line.
+/// \param x1 X-coordinate of the start of the run.
+/// \param y1 Y-coordinate of the start of the run.
+/// \param x2 X-coordinate of the end of the run.
+/// \param y2 Y-coordinate of the end of the run.
+/// \param x X-coordinate of the point.
+/// \param y Y-coordinate of the point.
+/// \return distance in the direction of the run, negative behind its end,
+/// INT_MIN if the point is off the line of the run
+static int beyond_run(int x1, int y1, int x2, int y2, int x, int y);
+
+/// Get the sides of the trail a qix lies in, by the polygons.
+/// \param cap Capture with the polygons built.
+/// \param i Index of the qix in the snapshot of the capture.
+/// \param end Edge of the outline the end of the path is closed to.
+/// \param corners Corners of the outline in the polygon right of the path.
+/// \return 1 if the qix lies right of the path, 2 if left, 3 if on both
+/// sides, 0 if on neither and -1 if it is too close to the trail to tell
+static int place_qix(const qix_capture_t *cap, int i, int end, int corners);
+
+/// Get the point of the outline nearest to a point.
+/// \param cap Capture with its outline.
+/// \param x X-coordinate of the point.
+/// \param y Y-coordinate of the point.
+/// \param nx Output, x-coordinate of the nearest point.
+/// \param ny Output, y-coordinate of the nearest point.
+/// \param offset Output, distance of the nearest point from the first
+/// corner of its edge.
+/// \return index of the edge of the nearest point, -1 if it is farther
+/// than ENTITY_WIDTH
+static int nearest_on_outline(const qix_capture_t *cap, int x, int y,
+                              int *nx, int *ny, int *offset);
+
+/// Check if the path keeps clear of itself and, away from its ends, of the
+/// outline, so the polygons have no pinched pockets the estimate would
+/// miss.
+/// \param cap Capture with its path and outline.
+/// \return true if the path is clear, false otherwise
+static bool path_clear(const qix_capture_t *cap);
+
+/// Get the squared distance of the bounding boxes of two segments.
+/// \param a Corners of the first segment, x1, y1, x2, y2.
+/// \param b Corners of the second segment.
+/// \return squared distance, 0 if the boxes touch
+static int segment_gap(const int a[4], const int b[4]);
+
+/// Get twice the signed area of a polygon by the shoelace formula.
+/// \param x X-coordinates of the corners.
+/// \param y Y-coordinates of the corners.
+/// \param n Number of corners.
+/// \return twice the area, positive if the polygon is clockwise on the
+/// screen
+static long shoelace(const int16_t *x, const int16_t *y, int n);
+
+/// Check if a point lies within a polygon.
+/// \param x X-coordinates of the corners.
+/// \param y Y-coordinates of the corners.
+/// \param n Number of corners.
+/// \param px Twice the x-coordinate of the point, odd.
+/// \param py Twice the y-coordinate of the point, odd.
+/// \return true if the point lies within the polygon, false otherwise
+static bool point_in_polygon(const int16_t *x, const int16_t *y, int n,
+                             int px, int py);
+
+/// Notes that a column of the background has been written.
+/// \param state State of the game.
+/// \param x X-coordinate of the column.
+static void touch_column(qix_state_t *state, int x);
+
+/// Rescans the written columns into the region map and relabels the
+/// regions if needed.
+/// \param state State of the game.
+/// \return true if the regions are known, false otherwise
+static bool refresh_regions(qix_state_t *state);
+
+/// Collects the free spans of a column into the region map.
+/// \param state State of the game.
+/// \param x X-coordinate of the column.
+static void scan_column(qix_state_t *state, int x);
+
+/// Finds the root span of the region of a span, halving the path.
+/// \param regions Region map.
+/// \param span Index of the span.
+/// \return index of the root span
+static int find_region(qix_regions_t *regions, int span);
+
+/// Joins the regions of two spans, the lower index becomes the root.
+/// \param regions Region map.
+/// \param a Index of a span.
+/// \param b Index of the other span.
+static void join_regions(qix_regions_t *regions, int a, int b);
+
+/// Finds the root span of the region containing a pixel.
+/// \param regions Region map, up to date.
+/// \param x X-coordinate of the pixel.
+/// \param y Y-coordinate of the pixel.
+/// \return index of the root span, -1 if the pixel is not free
+static int region_at(qix_regions_t *regions, int x, int y);
+
+/// Credits the captured area and ends the capture.
+/// \param state State of the game.
+static void finish_capture(qix_state_t *state);
+
+/// Hands the capture whose seeds have been set over to the worker thread,
+/// starting the thread if it is not running yet.
+/// \param state State of the game.
+/// \return true on success, false if the thread could not be started
+static bool start_worker(qix_state_t *state);
+
+/// Waits until the worker thread has finished the capture handed over.
+/// \param state State of the game.
+static void wait_worker(qix_state_t *state);
+
+/// Stops the worker thread of captures.
+/// \param state State of the game.
+static void stop_worker(qix_state_t *state);
+
+/// Entry point of the worker thread. Runs every capture handed over until
+/// it is stopped.
+/// \param arg The qix_state_t of the game.
+/// \return NULL
+static void *capture_worker_main(void *arg);
+
+/// Runs a capture whose seeds have been set on the worker thread, leaving
+/// the chosen area marked and queued.
+/// \param state State of the game.
+static void run_capture(qix_state_t *state);
+
+/// Waits for the worker thread and paints the area it has queued. The
+/// trail is repainted by qix_capture_advance() afterwards.
+/// \param state State of the game.
+static void commit_capture(qix_state_t *state);
+
+/// Fills the free nodes of the quadtree lying wholly in the area marked by
+/// the capture, each at once.
+/// \param state State of the game.
+/// \param box Bounding box of the area.
+/// \param level Level of the node, 0 for a tile.
+/// \param nx Column of the node within its level.
+/// \param ny Row of the node within its level.
+static void fill_free_nodes(qix_state_t *state, qix_rect_t box, int level,
+                            int nx, int ny);
+
+/// Check if every pixel of a rectangle is marked as filled by the capture.
+/// \param cap Capture.
+/// \param rect Rectangle within the arena.
+/// \return true if every pixel is marked, false otherwise
+static bool rect_marked(const qix_capture_t *cap, qix_rect_t rect);
+
+/// Fills a free node of the quadtree and moves the counts of the node, of
+/// the nodes and tiles below it and of the nodes above it from background
+/// to fill, without going pixel by pixel.
+/// \param state State of the game.
+/// \param level Level of the node, 0 for a tile.
+/// \param nx Column of the node within its level.
+/// \param ny Row of the node within its level.
+static void fill_node(qix_state_t *state, int level, int nx, int ny);
+
+/// Paints the trail held while the capture ran on the worker thread.
+/// \param state State of the game.
+static void paint_held_trail(qix_state_t *state);
+
+/// Check if the trail under the player would be laid onto the background.
+/// \param state State of the game.
+/// \return true if any pixel under the trail is background, false otherwise
+static bool trail_on_background(const qix_state_t *state);
+
+/// Moves the given coordinates by speed in the given direction, keeps them
+/// on the screen.
+/// \param xx X-coordinate of the upper left corner of the entity.
+/// \param yy Y-coordinate of the upper left corner of the entity.
+/// \param direction Direction of the move.
+/// \param speed Speed in pixels of the move.
+static void update_no_check(int *xx, int *yy, int direction, int speed);
+
+/// Computes where a qix gets by one step of its speed in its direction,
+/// kept on the screen like update_no_check().
+/// \param qixes Pool of qixes.
+/// \param i Index of the qix in the pool.
+/// \param fx Output, fixed-point x-coordinate after the step.
+/// \param fy Output, fixed-point y-coordinate after the step.
+static void qix_next(const qix_pool_t *qixes, int i, int *fx, int *fy);
+
+/// Get the rectangle swept by the body of an entity during a step.
+/// \param x X-coordinate of the upper left corner before the step.
+/// \param y Y-coordinate of the upper left corner before the step.
+/// \param fx Fixed-point x-coordinate after the step.
+/// \param fy Fixed-point y-coordinate after the step.
+/// \return bounding box of the body before and after the step, clipped to
+/// the screen
+static qix_rect_t sweep_rect(int x, int y, int fx, int fy);
+
+/// Check if an entity runs head-on into pixels of the given color anywhere
+/// along a step, the swept variant of entity_speed_stop_if_hit_color().
+/// \param state State of the game.
+/// \param x X-coordinate of the upper left corner before the step.
+/// \param y Y-coordinate of the upper left corner before the step.
+/// \param fx Fixed-point x-coordinate after the step.
+/// \param fy Fixed-point y-coordinate after the step.
+/// \param direction Direction of the step.
+/// \param color Color counted by the tile summary.
+/// \return true if the paths of both front corners cross the given color,
+/// false otherwise
+static bool sweep_stop_if_hit_color(const qix_state_t *state, int x, int y,
+                                    int fx, int fy, int direction,
+                                    rgb565_t color);
+
+/// Check if a rectangle contains trail. Only the trail segments overlapping
+/// it are scanned.
+/// \param state State of the game.
+/// \param rect Rectangle of pixels.
+/// \return true if any pixel of the rectangle is trail, false otherwise
+static bool trail_in_rect(const qix_state_t *state, qix_rect_t rect);
+
+/// Check if a rectangle contains trail held while the capture runs on the
+/// worker thread. Held trail is still background in the arena.
+/// \param state State of the game.
+/// \param rect Rectangle of pixels.
+/// \return true if any pixel of the rectangle is held trail, false
+/// otherwise
+static bool held_trail_in_rect(const qix_state_t *state, qix_rect_t rect);
+
+/// Updates the given qix by its speed and direction. Checks if qix
+/// should go in the opposite direction.
+/// \param state State of the game.
+/// \param i Index of the qix in the pool.
+static void check_and_update(qix_state_t *state, int i);
+
+/// Updates all the qixes.
+/// \param state State of the game.
+static void update_qixes(qix_state_t *state);
+
+/// Updates player.
+/// \param state State of the game.
+static void update_player(qix_state_t *state);
+
+/// Remembers the color the player is moving from.
+/// \param state State of the game.
+static void update_prev_color(qix_state_t *state);
+
+/// Check if an entity runs head-on into pixels of the given color.
+/// \param state State of the game.
+/// \param x X-coordinate of the upper left corner of the entity.
+/// \param y Y-coordinate of the upper left corner of the entity.
+/// \param direction Direction of the entity.
+/// \param color Color to be checked.
+/// \return true if both front corners of the entity are of the given color,
+/// false otherwise
+static bool entity_speed_stop_if_hit_color(const qix_state_t *state,
+                                           int x, int y, int direction,
+                                           rgb565_t color);
+
+/// Check if the player runs head-on into its own trail, held trail included.
+/// The trail of a capture in progress is captured already.
+/// \param state State of the game.
+/// \return true if both front corners of the player are trail, false
+/// otherwise
+static bool player_hits_trail(const qix_state_t *state);
+
+/// Changes pixels of the given color in the given rectangle with the other
+/// color in the background buffer.
+/// \param state State of the game.
+/// \param rect Rectangle to be repainted.
+/// \param old_color Old color to be repainted.
+/// \param new_color New color to be repainted with.
+static void repaint_rect(qix_state_t *state, qix_rect_t rect,
+                         rgb565_t old_color, rgb565_t new_color);
+
+/// Clears the trail flags of the spatial hash once the trail is gone.
+/// \param state State of the game.
+static void clear_trail_flags(qix_state_t *state);
+
+/// Changes all pixels of the given color with the other color in the
+/// background buffer.
+/// \param state State of the game.
+/// \param old_color Old color to be repainted.
+/// \param new_color New color to be repainted with.
+static void repaint(qix_state_t *state, rgb565_t old_color, rgb565_t new_color);
+
+/// Get the kind of the pixels of a rectangle from the quadtree: from its
+/// tiles if it lies within two by two of them, like the body of an entity,
+/// otherwise from the smallest node containing it.
+/// \param state State of the game.
+/// \param rect Rectangle within the arena.
+/// \return kind of the pixels, QIX_TILE_MIXED also if the tree cannot tell
+static qix_tile_kind_t rect_kind(const qix_state_t *state, qix_rect_t rect);
+
+/// Get the rectangle covered by the body of an entity.
+/// \param x X-coordinate of the upper left corner of the entity.
+/// \param y Y-coordinate of the upper left corner of the entity.
+/// \return rectangle of the body
+static qix_rect_t body_rect(int x, int y);
+
+/// Check if an entity is inside the given color.
+/// \param state State of the game.
+/// \param x X-coordinate of the upper left corner of the entity.
+/// \param y Y-coordinate of the upper left corner of the entity.
+/// \param color Color to be checked.
+/// \return true if the entity is inside the given color, false otherwise
+static bool collision_full_body(const qix_state_t *state, int x, int y,
+                                rgb565_t color);
+
+/// Check if an entity has touched any pixel of the given color.
+/// \param state State of the game.
+/// \param x X-coordinate of the upper left corner of the entity.
+/// \param y Y-coordinate of the upper left corner of the entity.
+/// \param color Color of the pixel.
+/// \return true if the entity has touched any pixel of the given color,
+/// false otherwise
+static bool collision_with_color(const qix_state_t *state, int x, int y,
+                                 rgb565_t color);
+
+/// Check if an entity is inside screen (excluding borders).
+/// \param state State of the game.
+/// \param x X-coordinate of the upper left corner of the entity.
+/// \param y Y-coordinate of the upper left corner of the entity.
+/// \param speed Speed of the entity.
+/// \return true if the entity is inside screen (excluding borders),
+/// false otherwise
+static bool inside_screen(const qix_state_t *state, int x, int y, int speed);
+
+/// Check if the the given player touched the given qix.
+/// \param player Player to be checked if touched the given qix.
+/// \param qixes Pool of qixes.
+/// \param i Index of the qix to be checked for collisions with the player.
+/// \return true if the the given player touched the given qix, false otherwise
+static bool collission_check_single(const entity_t *player,
+                                    const qix_pool_t *qixes, int i);
+
+/// Check if the the player touched any of the qixes. Only qixes bucketed
+/// in the spatial hash cells around the player are checked.
+/// \param state State of the game.
+/// \return true if the the player touched any of the qixes, false otherwise
+static bool collission_check(const qix_state_t *state);
+
+/// Get the opposing direction.
+/// \param input Direction for which should the opposing direction returned.
+/// \return the opposing direction on success, NO_INPUT if the given parameter
+/// is not a direction
+static input_t opposing_direction(enum input_t input);
+
+/// <------------ End implementation functions declaration ------------>
+
+void qix_init(qix_state_t *state, uint32_t seed)
+{
+    qix_init_with_params(state, seed, NULL);
+}
+
+void qix_default_params(qix_params_t *params)
+{
+    params->qix_speed = QIX_DEFAULT_SPEED * QIX_FP_ONE;
+    params->player_speed = PLAYER_DEFAULT_SPEED;
+    params->player_hp = PLAYER_DEFAULT_HP;
+    params->next_action_trigger = NEXT_ACTION_TRIGGER;
+    params->nqixes = NQIXES;
+    params->capture_step_px = 0;
+    params->fill_threads = 1;
+    params->async_capture = false;
+    params->rle_territory = false;
+}
+
+void qix_init_with_params(qix_state_t *state, uint32_t seed,
+                          const qix_params_t *params)
+{
+    // The threads of the game before would block on its conditions forever.
+    qix_release(state);
+
+    if (params) {
+        state->params = *params;
+    } else {
+        qix_default_params(&state->params);
+    }
+
+    if (state->params.nqixes < 0) {
+        state->params.nqixes = 0;
+    } else if (state->params.nqixes > QIX_MAX_QIXES) {
+        state->params.nqixes = QIX_MAX_QIXES;
+    }
+
+    if (state->params.fill_threads < 1) {
+        state->params.fill_threads = 1;
+    } else if (state->params.fill_threads > QIX_MAX_FILL_THREADS) {
+        state->params.fill_threads = QIX_MAX_FILL_THREADS;
+    }
+
+    state->rng = seed ? seed : 1;
+
+    init_player(state, &state->player);
+    state->qixes.count = state->params.nqixes;
+    for (int i = 0; i < state->qixes.count; ++i) {
+        init_qix(state, i);
+    }
+
+    memset(state->grid.flags, 0, sizeof(state->grid.flags));
+    build_qix_grid(state);
+
+    for (int y = 0; y < SCREEN_HEIGHT; ++y) {
+        for (int x = 0; x < SCREEN_WIDTH; ++x) {
+            if (x >= BORDER_WIDTH && x < SCREEN_WIDTH - BORDER_WIDTH
+                && y >= BORDER_HEIGHT && y < SCREEN_HEIGHT - BORDER_HEIGHT) {
+                state->background[x][y] = BACKGROUND_COLOR;
+            } else {
+                state->background[x][y] = BORDER_COLOR;
+            }
+        }
+    }
+    territory_flat(&state->territory, state->background);
+    if (state->params.rle_territory) {
+        // Without the memory for the copy the game reads the background.
+        if (rle_init(&state->rle, BORDER_COLOR) == 0
+            && rle_encode(&state->rle, state->background) == 0) {
+            territory_rle(&state->territory, &state->rle);
+        } else {
+            rle_free(&state->rle);
+        }
+    }
+
+    state->score = 0;
+    state->prev_color = BORDER_COLOR;
+    state->events = QIX_EVENT_NONE;
+    state->last_capture = 0;
+    state->steps = 0;
+    state->capture.phase = QIX_CAPTURE_IDLE;
+    state->capture.running = false;
+    state->capture.held.count = 0;
+
+    state->trail_segments.count = 0;
+    state->trail_path.count = 0;
+    state->trail_path.broken = false;
+
+    for (int x = 0; x < SCREEN_WIDTH; ++x) {
+        touch_column(state, x);
+    }
+    qix_refresh_tiles(state);
+}
+
+qix_status_t qix_step(qix_state_t *state, input_t input)
+{
+    switch (input) {
+    case UP:
+    case DOWN:
+    case LEFT:
+    case RIGHT:
+        state->player.direction = input;
+        break;
+    default:
+        break;
+    }
+
+    state->events = QIX_EVENT_NONE;
+    state->last_capture = 0;
+
+    // A capture on the worker thread is committed by qix_capture_commit().
+    if (qix_capture_pending(state) && !state->capture.running
+        && state->params.capture_step_px > 0) {
+        qix_capture_advance(state, state->params.capture_step_px);
+    }
+
+    update_qixes(state);
+    build_qix_grid(state);
+    update_player(state);
+    update_player_hit_anim(state);
+
+    ++state->steps;
+
+    return qix_status(state);
+}
+
+qix_status_t qix_status(const qix_state_t *state)
+{
+    if (state->player.HP <= 0) {
+        return QIX_LOST;
+    }
+
+    if (state->score >= SCREEN_SIZE * 0.8) {
+        return QIX_WON;
+    }
+
+    return QIX_RUNNING;
+}
+
+bool qix_capture_pending(const qix_state_t *state)
+{
+    return state->capture.running
+        || state->capture.phase != QIX_CAPTURE_IDLE;
+}
+
+bool qix_capture_advance(qix_state_t *state, int budget)
+{
+    qix_capture_t *cap = &state->capture;
+    bool committed = cap->running;
+    if (committed) {
+        // The area appears at once, the trail is repainted right after it.
+        commit_capture(state);
+        budget = INT_MAX;
+    } else if (cap->phase == QIX_CAPTURE_IDLE) {
+        return false;
+    }
+
+    // Every pass either spends budget or moves on to the next stage.
+    while (budget > 0 && cap->phase != QIX_CAPTURE_IDLE) {
+        switch (cap->phase) {
+        case QIX_CAPTURE_MEASURE:
+            budget -= measure(state, budget);
+            break;
+        case QIX_CAPTURE_FILL:
+            budget -= fill(state, budget, cap->area[cap->chosen],
+                           BACKGROUND_COLOR, cap->fill_mark, FILL_COLOR);
+            if (cap->queues[0].head == cap->queues[0].tail) {
+                if (cap->estimated) {
+                    cap->area[cap->chosen] = cap->queues[0].pixels;
+                }
+                if (cap->repaint_trail) {
+                    cap->phase = QIX_CAPTURE_REPAINT;
+                    cap->repaint_segment = 0;
+                } else {
+                    finish_capture(state);
+                }
+            }
+            break;
+        case QIX_CAPTURE_REPAINT:
+            for (; cap->repaint_segment < state->trail_segments.count
+                 && budget > 0; ++cap->repaint_segment) {
+                qix_rect_t rect =
+                    state->trail_segments.segments[cap->repaint_segment];
+                repaint_rect(state, rect, TRAIL_COLOR, FILL_COLOR);
+                budget -= (rect.x2 - rect.x1) * (rect.y2 - rect.y1);
+            }
+            if (cap->repaint_segment == state->trail_segments.count) {
+                state->trail_segments.count = 0;
+                clear_trail_flags(state);
+                finish_capture(state);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Only now, or the trail laid meanwhile would be repainted as well.
+    if (committed) {
+        paint_held_trail(state);
+    }
+
+    return cap->phase == QIX_CAPTURE_IDLE;
+}
+
+bool qix_capture_commit(qix_state_t *state)
+{
+    qix_capture_t *cap = &state->capture;
+    if (!cap->running
+        || !__atomic_load_n(&cap->worker.done, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    return qix_capture_advance(state, INT_MAX);
+}
+
+void qix_release(qix_state_t *state)
+{
+    qix_capture_t *cap = &state->capture;
+    if (cap->running) {
+        wait_worker(state);
+        cap->running = false;
+        cap->phase = QIX_CAPTURE_IDLE;
+        cap->held.count = 0;
+    }
+    stop_worker(state);
+    stop_fill_helpers(state);
+
+    if (state->territory.arena == &state->rle) {
+        rle_free(&state->rle);
+        territory_flat(&state->territory, state->background);
+    }
+}
+
+int qix_region_area(qix_state_t *state, int x, int y)
+{
+    // The region map belongs to the worker while it runs.
+    if (state->capture.running || !refresh_regions(state)) {
+        return -1;
+    }
+
+    int r = region_at(&state->regions, x, y);
+
+    return r < 0 ? 0 : state->regions.area[r];
+}
+
+int qix_measure_area(qix_state_t *state, int x, int y, rgb565_t color)
+{
+    qix_capture_t *cap = &state->capture;
+
+    memset(cap->mark, 0, sizeof(cap->mark));
+    memset(&cap->queues[0], 0, sizeof(cap->queues[0]));
+    cap->nqixes = 0;
+    enqueue(state, 0, x, y, color, 0, 1);
+    search(state, 0, INT_MAX, color, 0, 1, color);
+
+    return cap->queues[0].pixels;
+}
+
+void qix_fill_area(qix_state_t *state, int x, int y, rgb565_t old_color,
+                   rgb565_t new_color)
+{
+    qix_capture_t *cap = &state->capture;
+
+    memset(cap->mark, 0, sizeof(cap->mark));
+    memset(&cap->queues[0], 0, sizeof(cap->queues[0]));
+    cap->nqixes = 0;
+    enqueue(state, 0, x, y, old_color, 0, MARK_FILLED);
+    fill(state, INT_MAX, INT_MAX, old_color, 0, new_color);
+}
+
+void qix_repaint(qix_state_t *state, rgb565_t old_color, rgb565_t new_color)
+{
+    repaint(state, old_color, new_color);
+}
+
+qix_tile_kind_t qix_tile_kind(const qix_state_t *state, int tile)
+{
+    const qix_tiles_t *tiles = &state->tiles;
+    int size = QIX_TILE_SIZE * QIX_TILE_SIZE;
+
+    if (tiles->empty[tile] == size) {
+        return QIX_TILE_EMPTY;
+    } else if (tiles->filled[tile] == size) {
+        return QIX_TILE_FILLED;
+    } else if (tiles->border[tile] == size) {
+        return QIX_TILE_BORDER;
+    }
+
+    return QIX_TILE_MIXED;
+}
+
+rgb565_t qix_tile_color(qix_tile_kind_t kind)
+{
+    switch (kind) {
+    case QIX_TILE_EMPTY:
+        return BACKGROUND_COLOR;
+    case QIX_TILE_FILLED:
+        return FILL_COLOR;
+    case QIX_TILE_BORDER:
+    default:
+        return BORDER_COLOR;
+    }
+}
+
+qix_tile_kind_t qix_quad_kind(const qix_state_t *state, int level, int nx,
+                              int ny)
+{
+    if (level == 0 && nx < QIX_TILES_X && ny < QIX_TILES_Y) {
+        return qix_tile_kind(state, ny * QIX_TILES_X + nx);
+    }
+
+    qix_rect_t rect = quad_rect(level, nx, ny);
+    int area = (rect.x2 - rect.x1) * (rect.y2 - rect.y1);
+
+    if (area == 0
+        || quad_count(state, BACKGROUND_COLOR, level, nx, ny) == area) {
+        return QIX_TILE_EMPTY;
+    } else if (quad_count(state, FILL_COLOR, level, nx, ny) == area) {
+        return QIX_TILE_FILLED;
+    } else if (quad_count(state, BORDER_COLOR, level, nx, ny) == area) {
+        return QIX_TILE_BORDER;
+    }
+
+    return QIX_TILE_MIXED;
+}
+
+int qix_rect_count(const qix_state_t *state, int x, int y, int w, int h,
+                   rgb565_t color)
+{
+    qix_rect_t rect = {
+        x < 0 ? 0 : x,
+        y < 0 ? 0 : y,
+        x + w > SCREEN_WIDTH ? SCREEN_WIDTH : x + w,
+        y + h > SCREEN_HEIGHT ? SCREEN_HEIGHT : y + h
+    };
+    if (rect.x1 >= rect.x2 || rect.y1 >= rect.y2) {
+        return 0;
+    }
+
+    if (color == BACKGROUND_COLOR || color == FILL_COLOR
+        || color == BORDER_COLOR) {
+        return count_rect(state, rect, color, QIX_QUAD_LEVELS, 0, 0);
+    }
+
+    int sum = 0;
+    for (int px = rect.x1; px < rect.x2; ++px) {
+        for (int py = rect.y1; py < rect.y2; ++py) {
+            sum += state->background[px][py] == color;
+        }
+    }
+
+    return sum;
+}
+
+void qix_refresh_tiles(qix_state_t *state)
+{
+    qix_tiles_t *tiles = &state->tiles;
+    qix_quadtree_t *tree = &state->quadtree;
+
+    memset(tiles, 0, sizeof(*tiles));
+    memset(tiles->dirty, 1, sizeof(tiles->dirty));
+    for (int x = 0; x < SCREEN_WIDTH; ++x) {
+        for (int y = 0; y < SCREEN_HEIGHT; ++y) {
+            uint16_t *counts = tile_counts(tiles, state->background[x][y]);
+            if (counts) {
+                ++counts[y / QIX_TILE_SIZE * QIX_TILES_X + x / QIX_TILE_SIZE];
+            }
+        }
+    }
+
+    memset(tree, 0, sizeof(*tree));
+    for (int tile = 0; tile < QIX_TILES; ++tile) {
+        count_quad(tree->empty, tile, tiles->empty[tile]);
+        count_quad(tree->filled, tile, tiles->filled[tile]);
+        count_quad(tree->border, tile, tiles->border[tile]);
+    }
+}
+
+static uint32_t next_random(qix_state_t *state)
+{
+    uint32_t x = state->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    state->rng = x;
+
+    return x;
+}
+
+static int random_direction(qix_state_t *state)
+{
+    return (next_random(state) % RIGHT) + 1;
+}
+
+static rgb565_t cell(const qix_state_t *state, int x, int y)
+{
+    if (state->territory.arena != state->background) {
+        return territory_cell(&state->territory, x, y);
+    }
+
+    if (x < 0 || x >= SCREEN_WIDTH || y < 0 || y >= SCREEN_HEIGHT) {
+        return BORDER_COLOR;
+    }
+
+    return state->background[x][y];
+}
+
+static void init_player(const qix_state_t *state, entity_t *player)
+{
+    player->invul = false;
+    player->hit_anim_counter = 0;
+    player->next_action_counter = 0;
+    player->xx = 0;
+    player->yy = 0;
+    player->direction = NO_INPUT;
+    player->speed = state->params.player_speed;
+    player->HP = state->params.player_hp;
+    player->color = PLAYER_COLOR;
+}
+
+static void init_qix(qix_state_t *state, int i)
+{
+    qix_pool_t *qixes = &state->qixes;
+
+    qixes->invul[i] = false;
+    qixes->hit_anim_counter[i] = 0;
+    qixes->next_action_counter[i] = 0;
+    qixes->xx[i] = SCREEN_WIDTH / 2;
+    qixes->yy[i] = SCREEN_HEIGHT / 2;
+    qixes->direction[i] = random_direction(state);
+    qixes->subx[i] = 0;
+    qixes->suby[i] = 0;
+    qixes->speed[i] = state->params.qix_speed;
+    qixes->color[i] = qix_color[i % NQIXES];
+}
+
+static void set_cell(qix_state_t *state, int x, int y, rgb565_t color)
+{
+    rgb565_t old_color = state->background[x][y];
+    if (old_color == BACKGROUND_COLOR || color == BACKGROUND_COLOR) {
+        touch_column(state, x);
+    }
+    state->background[x][y] = color;
+    mirror_cells(state, x, y, 1, color);
+    count_tile(state, y / QIX_TILE_SIZE * QIX_TILES_X + x / QIX_TILE_SIZE,
+               old_color, color, 1);
+
+    if (color == TRAIL_COLOR) {
+        state->grid.flags[grid_index(x, y)] |= QIX_GRID_TRAIL;
+    } else if (color == FILL_COLOR) {
+        state->grid.flags[grid_index(x, y)] |= QIX_GRID_FILL;
+    }
+}
+
+static void set_cells(qix_state_t *state, int x, int y, int n,
+                      rgb565_t old_color, rgb565_t color)
+{
+    fb_fill(&state->background[x][y], n, n, 1, color);
+    mirror_cells(state, x, y, n, color);
+    touch_column(state, x);
+
+    for (int ty = y / QIX_TILE_SIZE; ty <= (y + n - 1) / QIX_TILE_SIZE;
+         ++ty) {
+        int y1 = ty * QIX_TILE_SIZE > y ? ty * QIX_TILE_SIZE : y;
+        int y2 = (ty + 1) * QIX_TILE_SIZE < y + n ? (ty + 1) * QIX_TILE_SIZE
+            : y + n;
+        count_tile(state, ty * QIX_TILES_X + x / QIX_TILE_SIZE, old_color,
+                   color, y2 - y1);
+    }
+
+    unsigned int flag = color == TRAIL_COLOR ? QIX_GRID_TRAIL
+        : color == FILL_COLOR ? QIX_GRID_FILL : 0;
+    if (flag) {
+        for (int gy = y / QIX_GRID_CELL; gy <= (y + n - 1) / QIX_GRID_CELL;
+             ++gy) {
+            state->grid.flags[grid_index(x, gy * QIX_GRID_CELL)] |= flag;
+        }
+    }
+}
+
+static void mirror_cells(qix_state_t *state, int x, int y, int n,
+                         rgb565_t color)
+{
+    if (state->territory.arena == state->background) {
+        return;
+    }
+
+    // The background is whole, the game goes on reading it.
+    if (territory_set_cells(&state->territory, x, y, n, color)) {
+        rle_free(&state->rle);
+        territory_flat(&state->territory, state->background);
+    }
+}
+
+static void mirror_column(qix_state_t *state, int x)
+{
+    const rgb565_t *column = state->background[x];
+
+    for (int y = 0; y < SCREEN_HEIGHT
+         && state->territory.arena != state->background;) {
+        int end = y + 1;
+        while (end < SCREEN_HEIGHT && column[end] == column[y]) {
+            ++end;
+        }
+        mirror_cells(state, x, y, end - y, column[y]);
+        y = end;
+    }
+}
+
+static uint16_t *tile_counts(qix_tiles_t *tiles, rgb565_t color)
+{
+    switch (color) {
+    case BACKGROUND_COLOR:
+        return tiles->empty;
+    case FILL_COLOR:
+        return tiles->filled;
+    case BORDER_COLOR:
+        return tiles->border;
+    default:
+        return NULL;
+    }
+}
+
+static void count_tile(qix_state_t *state, int tile, rgb565_t old_color,
+                       rgb565_t color, int n)
+{
+    if (old_color == color) {
+        return;
+    }
+
+    uint16_t *old_counts = tile_counts(&state->tiles, old_color);
+    uint16_t *counts = tile_counts(&state->tiles, color);
+    if (old_counts) {
+        old_counts[tile] -= n;
+    }
+    if (counts) {
+        counts[tile] += n;
+    }
+    state->tiles.dirty[tile] = 1;
+
+    int32_t *old_quad = quad_counts(&state->quadtree, old_color);
+    int32_t *quad = quad_counts(&state->quadtree, color);
+    if (old_quad) {
+        count_quad(old_quad, tile, -n);
+    }
+    if (quad) {
+        count_quad(quad, tile, n);
+    }
+}
+
+static int32_t *quad_counts(qix_quadtree_t *tree, rgb565_t color)
+{
+    switch (color) {
+    case BACKGROUND_COLOR:
+        return tree->empty;
+    case FILL_COLOR:
+        return tree->filled;
+    case BORDER_COLOR:
+        return tree->border;
+    default:
+        return NULL;
+    }
+}
+
+static void count_quad(int32_t *counts, int tile, int n)
+{
+    int tx = tile % QIX_TILES_X, ty = tile / QIX_TILES_X;
+
+    for (int level = 1; level <= QIX_QUAD_LEVELS; ++level) {
+        counts[quad_node(level, tx >> level, ty >> level)] += n;
+    }
+}
+
+static int quad_node(int level, int nx, int ny)
+{
+    // Levels are stored from the bottom, each one row by row, so the ones
+    // below take a geometric series of nodes.
+    int below = QIX_QUAD_SIDE >> (level - 1);
+    int offset = (QIX_QUAD_SIDE * QIX_QUAD_SIDE - below * below) / 3;
+
+    return offset + ny * (QIX_QUAD_SIDE >> level) + nx;
+}
+
+static qix_rect_t quad_rect(int level, int nx, int ny)
+{
+    int size = QIX_TILE_SIZE << level;
+    int x1 = nx * size, y1 = ny * size;
+    int x2 = x1 + size < SCREEN_WIDTH ? x1 + size : SCREEN_WIDTH;
+    int y2 = y1 + size < SCREEN_HEIGHT ? y1 + size : SCREEN_HEIGHT;
+
+    if (x1 >= x2 || y1 >= y2) {
+        return (qix_rect_t){0, 0, 0, 0};
+    }
+
+    return (qix_rect_t){x1, y1, x2, y2};
+}
+
+static int quad_count(const qix_state_t *state, rgb565_t color, int level,
+                      int nx, int ny)
+{
+    if (level == 0 && (nx >= QIX_TILES_X || ny >= QIX_TILES_Y)) {
+        return 0;
+    }
+
+    const qix_tiles_t *tiles = &state->tiles;
+    const qix_quadtree_t *tree = &state->quadtree;
+    int i = level == 0 ? ny * QIX_TILES_X + nx : quad_node(level, nx, ny);
+    switch (color) {
+    case BACKGROUND_COLOR:
+        return level == 0 ? tiles->empty[i] : tree->empty[i];
+    case FILL_COLOR:
+        return level == 0 ? tiles->filled[i] : tree->filled[i];
+    case BORDER_COLOR:
+        return level == 0 ? tiles->border[i] : tree->border[i];
+    default:
+        return 0;
+    }
+}
+
+static int count_rect(const qix_state_t *state, qix_rect_t rect,
+                      rgb565_t color, int level, int nx, int ny)
+{
+    qix_rect_t node = quad_rect(level, nx, ny);
+    int x1 = node.x1 > rect.x1 ? node.x1 : rect.x1;
+    int y1 = node.y1 > rect.y1 ? node.y1 : rect.y1;
+    int x2 = node.x2 < rect.x2 ? node.x2 : rect.x2;
+    int y2 = node.y2 < rect.y2 ? node.y2 : rect.y2;
+    if (x1 >= x2 || y1 >= y2) {
+        return 0;
+    }
+
+    int n = quad_count(state, color, level, nx, ny);
+    int area = (node.x2 - node.x1) * (node.y2 - node.y1);
+    if (n == 0 || (x2 - x1) * (y2 - y1) == area) {
+        return n;
+    } else if (n == area) {
+        return (x2 - x1) * (y2 - y1);
+    }
+
+    if (level > 0) {
+        int sum = 0;
+        for (int i = 0; i < 4; ++i) {
+            sum += count_rect(state, rect, color, level - 1,
+                              2 * nx + i % 2, 2 * ny + i / 2);
+        }
+        return sum;
+    }
+
+    int sum = 0;
+    for (int x = x1; x < x2; ++x) {
+        for (int y = y1; y < y2; ++y) {
+            sum += state->background[x][y] == color;
+        }
+    }
+
+    return sum;
+}
+
+static int grid_index(int x, int y)
+{
+    int gx = x < 0 ? 0 : x >= SCREEN_WIDTH ? QIX_GRID_WIDTH - 1 : x / QIX_GRID_CELL;
+    int gy = y < 0 ? 0 : y >= SCREEN_HEIGHT ? QIX_GRID_HEIGHT - 1 : y / QIX_GRID_CELL;
+
+    return gy * QIX_GRID_WIDTH + gx;
+}
+
+static unsigned int grid_flags(const qix_state_t *state, qix_rect_t rect)
+{
+    // The rectangle lies on the screen, no clamping is needed.
+    int gx1 = rect.x1 / QIX_GRID_CELL, gx2 = (rect.x2 - 1) / QIX_GRID_CELL;
+    int gy1 = rect.y1 / QIX_GRID_CELL, gy2 = (rect.y2 - 1) / QIX_GRID_CELL;
+    unsigned int flags = 0;
+
+    for (int gy = gy1; gy <= gy2; ++gy) {
+        for (int gx = gx1; gx <= gx2; ++gx) {
+            flags |= state->grid.flags[gy * QIX_GRID_WIDTH + gx];
+        }
+    }
+
+    return flags;
+}
+
+static void build_qix_grid(qix_state_t *state)
+{
+    const qix_pool_t *qixes = &state->qixes;
+    qix_grid_t *grid = &state->grid;
+    uint16_t cell_of[QIX_MAX_QIXES];
+
+    memset(grid->start, 0, sizeof(grid->start));
+    for (int i = 0; i < qixes->count; ++i) {
+        cell_of[i] = grid_index(qixes->xx[i], qixes->yy[i]);
+        ++grid->start[cell_of[i] + 1];
+    }
+
+    for (int c = 0; c < QIX_GRID_SIZE; ++c) {
+        grid->start[c + 1] += grid->start[c];
+    }
+
+    uint16_t next[QIX_GRID_SIZE];
+    memcpy(next, grid->start, sizeof(next));
+    for (int i = 0; i < qixes->count; ++i) {
+        grid->items[next[cell_of[i]]++] = i;
+    }
+}
+
+static void hit_player(qix_state_t *state)
+{
+    state->player.invul = true;
+    --state->player.HP;
+    state->events |= QIX_EVENT_HIT;
+}
+
+static void update_player_hit_anim(qix_state_t *state)
+{
+    entity_t *player = &state->player;
+
+    if (player->invul
+        && (player->hit_anim_counter++ % PLAYER_HIT_ANIM_PERIOD == 0)) {
+        player->color = player->color == PLAYER_COLOR ? RED : PLAYER_COLOR;
+        if (player->hit_anim_counter > PLAYER_HIT_ANIM_LENGTH) {
+            player->invul = false;
+            player->hit_anim_counter = 0;
+            player->color = PLAYER_COLOR;
+        }
+    }
+}
+
+static bool inside_screen(const qix_state_t *state, int x, int y, int speed)
+{
+    // The body and the room it needs for a step up or to the left are
+    // inside at once if the tiles under them, the lowest level of the
+    // quadtree, count no border. Border is only ever around the arena, so
+    // the tiles along it are told by the coordinates rather than by
+    // counting its pixels.
+    qix_rect_t room = {x - speed, y - speed, x + ENTITY_WIDTH + 1,
+                       y + ENTITY_HEIGHT + 1};
+    if (room.x1 < 0 || room.y1 < 0 || room.x2 > SCREEN_WIDTH
+        || room.y2 > SCREEN_HEIGHT) {
+        return false;
+    }
+
+    const uint16_t *border = state->tiles.border;
+    int tx1 = room.x1 / QIX_TILE_SIZE, tx2 = (room.x2 - 1) / QIX_TILE_SIZE;
+    int ty1 = room.y1 / QIX_TILE_SIZE, ty2 = (room.y2 - 1) / QIX_TILE_SIZE;
+    if (tx2 - tx1 <= 1 && ty2 - ty1 <= 1
+        && (border[ty1 * QIX_TILES_X + tx1] | border[ty1 * QIX_TILES_X + tx2]
+            | border[ty2 * QIX_TILES_X + tx1]
+            | border[ty2 * QIX_TILES_X + tx2]) == 0) {
+        return true;
+    }
+
+    return room.x1 >= BORDER_WIDTH && room.x2 <= SCREEN_WIDTH - BORDER_WIDTH
+        && room.y1 >= BORDER_HEIGHT && room.y2 <= SCREEN_HEIGHT - BORDER_HEIGHT;
+}
+
+static bool collission_check_single(const entity_t *player,
+                                    const qix_pool_t *qixes, int i)
+{
+    int qx = qixes->xx[i], qy = qixes->yy[i];
+
+    return( ( (player->xx >= qx && player->xx <= qx+ENTITY_WIDTH)
+      || (player->xx+ENTITY_WIDTH >= qx && player->xx+ENTITY_WIDTH <= qx+ENTITY_WIDTH) )
+      && ((player->yy >= qy && player->yy <= qy+ENTITY_HEIGHT)
+      || (player->yy+ENTITY_HEIGHT >= qy && player->yy+ENTITY_HEIGHT <= qy+ENTITY_HEIGHT)));
+}
+
+static bool collission_check(const qix_state_t *state)
+{
+    const entity_t *player = &state->player;
+    const qix_grid_t *grid = &state->grid;
+
+    // A touching qix has its corner within one entity size of the player's.
+    int c1 = grid_index(player->xx - ENTITY_WIDTH, player->yy - ENTITY_HEIGHT);
+    int c2 = grid_index(player->xx + ENTITY_WIDTH, player->yy + ENTITY_HEIGHT);
+    int gx1 = c1 % QIX_GRID_WIDTH, gy1 = c1 / QIX_GRID_WIDTH;
+    int gx2 = c2 % QIX_GRID_WIDTH, gy2 = c2 / QIX_GRID_WIDTH;
+
+    for (int gy = gy1; gy <= gy2; ++gy) {
+        for (int gx = gx1; gx <= gx2; ++gx) {
+            int c = gy * QIX_GRID_WIDTH + gx;
+            for (int k = grid->start[c]; k < grid->start[c + 1]; ++k) {
+                if (collission_check_single(player, &state->qixes,
+                                            grid->items[k])) {
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+static input_t opposing_direction(enum input_t input)
+{
+    switch (input) {
+        case UP: return DOWN;
+        case DOWN: return UP;
+        case LEFT: return RIGHT;
+        case RIGHT: return LEFT;
+        default: return NO_INPUT;
+    }
+}
+
+static void update_no_check(int *xx, int *yy, int direction, int speed)
+{
+    switch (direction) {
+    case UP:
+        *yy = *yy - speed < 0 ? 0 : *yy - speed;
+        break;
+    case DOWN:
+        *yy = *yy + speed + ENTITY_HEIGHT >= SCREEN_HEIGHT
+            ? SCREEN_HEIGHT - ENTITY_HEIGHT : *yy + speed;
+        break;
+    case LEFT:
+        *xx = *xx - speed < 0 ? 0 : *xx - speed;
+        break;
+    case RIGHT:
+        *xx = *xx + speed + ENTITY_WIDTH >= SCREEN_WIDTH
+            ? SCREEN_WIDTH - ENTITY_WIDTH : *xx + speed;
+        break;
+    default:
+        break;
+    }
+}
+
+static void qix_next(const qix_pool_t *qixes, int i, int *fx, int *fy)
+{
+    int speed = qixes->speed[i];
+    int max_x = (SCREEN_WIDTH - ENTITY_WIDTH) * QIX_FP_ONE;
+    int max_y = (SCREEN_HEIGHT - ENTITY_HEIGHT) * QIX_FP_ONE;
+
+    *fx = qixes->xx[i] * QIX_FP_ONE + qixes->subx[i];
+    *fy = qixes->yy[i] * QIX_FP_ONE + qixes->suby[i];
+    switch (qixes->direction[i]) {
+    case UP:
+        *fy = *fy - speed < 0 ? 0 : *fy - speed;
+        break;
+    case DOWN:
+        *fy = *fy + speed >= max_y ? max_y : *fy + speed;
+        break;
+    case LEFT:
+        *fx = *fx - speed < 0 ? 0 : *fx - speed;
+        break;
+    case RIGHT:
+        *fx = *fx + speed >= max_x ? max_x : *fx + speed;
+        break;
+    default:
+        break;
+    }
+}
+
+static qix_rect_t sweep_rect(int x, int y, int fx, int fy)
+{
+    int nx = fx >> QIX_FP_SHIFT, ny = fy >> QIX_FP_SHIFT;
+    int x1 = nx < x ? nx : x, y1 = ny < y ? ny : y;
+    int x2 = nx > x ? nx : x, y2 = ny > y ? ny : y;
+
+    // Corners of a body lie ENTITY_WIDTH apart, so it spans one pixel more.
+    x2 = x2 + ENTITY_WIDTH + 1 > SCREEN_WIDTH ? SCREEN_WIDTH
+        : x2 + ENTITY_WIDTH + 1;
+    y2 = y2 + ENTITY_HEIGHT + 1 > SCREEN_HEIGHT ? SCREEN_HEIGHT
+        : y2 + ENTITY_HEIGHT + 1;
+
+    return (qix_rect_t){x1, y1, x2, y2};
+}
+
+static bool sweep_stop_if_hit_color(const qix_state_t *state, int x, int y,
+                                    int fx, int fy, int direction,
+                                    rgb565_t color)
+{
+    int dx = (fx >> QIX_FP_SHIFT) - x, dy = (fy >> QIX_FP_SHIFT) - y;
+
+    // Paths of the front corners from where they are to where they get.
+    switch (direction) {
+    case UP:
+        return qix_rect_count(state, x, y + dy, 1, 1 - dy, color)
+            && qix_rect_count(state, x + ENTITY_WIDTH, y + dy, 1, 1 - dy,
+                              color);
+    case DOWN:
+        return qix_rect_count(state, x, y + ENTITY_HEIGHT, 1, 1 + dy, color)
+            && qix_rect_count(state, x + ENTITY_WIDTH, y + ENTITY_HEIGHT, 1,
+                              1 + dy, color);
+    case LEFT:
+        return qix_rect_count(state, x + dx, y, 1 - dx, 1, color)
+            && qix_rect_count(state, x + dx, y + ENTITY_HEIGHT, 1 - dx, 1,
+                              color);
+    case RIGHT:
+        return qix_rect_count(state, x + ENTITY_WIDTH, y, 1 + dx, 1, color)
+            && qix_rect_count(state, x + ENTITY_WIDTH, y + ENTITY_HEIGHT,
+                              1 + dx, 1, color);
+    default:
+        return false;
+    }
+}
+
+static bool trail_in_rect(const qix_state_t *state, qix_rect_t rect)
+{
+    const qix_trail_index_t *index = &state->trail_segments;
+
+    for (int s = 0; s < index->count; ++s) {
+        const qix_rect_t *seg = &index->segments[s];
+        int x1 = seg->x1 > rect.x1 ? seg->x1 : rect.x1;
+        int y1 = seg->y1 > rect.y1 ? seg->y1 : rect.y1;
+        int x2 = seg->x2 < rect.x2 ? seg->x2 : rect.x2;
+        int y2 = seg->y2 < rect.y2 ? seg->y2 : rect.y2;
+
+        // The last segment may cover more than trail once the index is full.
+        for (int x = x1; x < x2; ++x) {
+            for (int y = y1; y < y2; ++y) {
+                if (state->background[x][y] == TRAIL_COLOR) {
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+static bool held_trail_in_rect(const qix_state_t *state, qix_rect_t rect)
+{
+    const qix_trail_index_t *index = &state->capture.held;
+
+    for (int s = 0; s < index->count; ++s) {
+        const qix_rect_t *seg = &index->segments[s];
+        int x1 = seg->x1 > rect.x1 ? seg->x1 : rect.x1;
+        int y1 = seg->y1 > rect.y1 ? seg->y1 : rect.y1;
+        int x2 = seg->x2 < rect.x2 ? seg->x2 : rect.x2;
+        int y2 = seg->y2 < rect.y2 ? seg->y2 : rect.y2;
+
+        // Pixels painted before are not laid by the commit.
+        for (int x = x1; x < x2; ++x) {
+            for (int y = y1; y < y2; ++y) {
+                if (state->background[x][y] == BACKGROUND_COLOR) {
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+static void check_and_update(qix_state_t *state, int i)
+{
+    qix_pool_t *qixes = &state->qixes;
+    int x = qixes->xx[i], y = qixes->yy[i];
+    int speed = (qixes->speed[i] + QIX_FP_ONE - 1) >> QIX_FP_SHIFT;
+    int fx, fy;
+
+    if (inside_screen(state, x, y, speed)) {
+        if (qixes->next_action_counter[i]++ > state->params.next_action_trigger){
+            qixes->direction[i] = random_direction(state);
+            qixes->next_action_counter[i] = 0;
+        }
+
+        // Fill and trail are looked for along the whole step, so a fast
+        // qix cannot jump over them.
+        qix_next(qixes, i, &fx, &fy);
+        qix_rect_t sweep = sweep_rect(x, y, fx, fy);
+        unsigned int flags = grid_flags(state, sweep);
+
+        if (flags & QIX_GRID_FILL) {
+            if (sweep_stop_if_hit_color(state, x, y, fx, fy,
+                                        qixes->direction[i], FILL_COLOR)) {
+                qixes->direction[i] = opposing_direction(qixes->direction[i]);
+            }
+
+            if (collision_full_body(state, x, y, FILL_COLOR)) {
+                qixes->speed[i] = 0;
+            }
+
+            qix_next(qixes, i, &fx, &fy);
+            sweep = sweep_rect(x, y, fx, fy);
+            flags = grid_flags(state, sweep);
+        }
+
+        if (!qixes->invul[i] && !state->player.invul) {
+            // The trail of a capture in progress is captured already, the
+            // trail laid while it runs on the worker thread is held.
+            if (((flags & QIX_GRID_TRAIL) && !qix_capture_pending(state)
+                 && trail_in_rect(state, sweep))
+                || (state->capture.running
+                    && held_trail_in_rect(state, sweep))) {
+                qixes->direction[i] = opposing_direction(qixes->direction[i]);
+                qixes->invul[i] = true;
+                hit_player(state);
+                qix_next(qixes, i, &fx, &fy);
+            }
+        } else if (qixes->hit_anim_counter[i]++ > QIX_HIT_ANIM_LENGTH) {
+            qixes->hit_anim_counter[i] = 0;
+            qixes->invul[i] = false;
+        }
+    } else {
+        qixes->direction[i] = opposing_direction(qixes->direction[i]);
+        qix_next(qixes, i, &fx, &fy);
+    }
+
+    qixes->xx[i] = fx >> QIX_FP_SHIFT;
+    qixes->yy[i] = fy >> QIX_FP_SHIFT;
+    qixes->subx[i] = fx & (QIX_FP_ONE - 1);
+    qixes->suby[i] = fy & (QIX_FP_ONE - 1);
+}
+
+static void update_qixes(qix_state_t *state)
+{
+    for (int i = 0; i < state->qixes.count; ++i) {
+        check_and_update(state, i);
+    }
+}
+
+static void add_trail_to_background(qix_state_t *state)
+{
+    const entity_t *player = &state->player;
+    int midx = player->xx + ((ENTITY_WIDTH - TRAIL_WIDTH + 1) / 2);
+    int midy = player->yy + ((ENTITY_HEIGHT - TRAIL_WIDTH + 1) / 2);
+
+    int x1, x2, y1, y2;
+    x1 = midx;
+    x2 = x1 + TRAIL_WIDTH;
+    y1 = midy;
+    y2 = y1 + TRAIL_WIDTH;
+
+    if (paint_trail(state, x1, y1, x2, y2)) {
+        record_trail(state);
+    }
+}
+
+static void add_whole_trail_to_background(qix_state_t *state)
+{
+    const entity_t *player = &state->player;
+    int midx = player->xx + ((ENTITY_WIDTH - TRAIL_WIDTH + 1) / 2);
+    int midy = player->yy + ((ENTITY_HEIGHT - TRAIL_WIDTH + 1) / 2);
+
+    int x1, x2, y1, y2;
+    x1 = midx;
+    x2 = x1 + TRAIL_WIDTH;
+    y1 = midy;
+    y2 = y1 + TRAIL_WIDTH;
+
+    switch (player->direction) {
+    case UP:
+        y1 = player->yy;
+        y2 = y1 + ENTITY_HEIGHT / 2;
+        break;
+    case DOWN:
+        y2 = player->yy + ENTITY_HEIGHT;
+        break;
+    case LEFT:
+        x1 = player->xx;
+        x2 = x1 + ENTITY_WIDTH / 2;
+        break;
+    case RIGHT:
+        x2 = player->xx + ENTITY_WIDTH;
+        break;
+    }
+
+    paint_trail(state, x1, y1, x2, y2);
+    record_trail(state);
+}
+
+static bool paint_trail(qix_state_t *state, int x1, int y1, int x2, int y2)
+{
+    qix_capture_t *cap = &state->capture;
+    qix_rect_t rect = {x1, y1, x2, y2};
+    bool painted = false;
+
+    // The worker of a capture reads the background, which must not change
+    // under it, so the trail is held until the commit. Only when there is
+    // no room left to hold it, the worker is waited for.
+    for (int y = y1; y < y2 && cap->running; ++y) {
+        for (int x = x1; x < x2; ++x) {
+            if (state->background[x][y] != BACKGROUND_COLOR) {
+                continue;
+            } else if (cap->held.count < QIX_MAX_TRAIL_SEGMENTS) {
+                index_trail(&cap->held, rect);
+                return true;
+            }
+            qix_capture_advance(state, INT_MAX);
+            break;
+        }
+    }
+
+    for (int y = y1; y < y2; ++y) {
+        for (int x = x1; x < x2; ++x) {
+            if (state->background[x][y] == BACKGROUND_COLOR) {
+                set_cell(state, x, y, TRAIL_COLOR);
+                painted = true;
+            }
+        }
+    }
+
+    if (painted) {
+        index_trail(&state->trail_segments, rect);
+    }
+
+    return painted;
+}
+
+static void record_trail(qix_state_t *state)
+{
+    const entity_t *player = &state->player;
+    qix_trail_path_t *path = &state->trail_path;
+    int x = player->xx + ENTITY_WIDTH / 2;
+    int y = player->yy + ENTITY_HEIGHT / 2;
+
+    if (state->prev_color != BACKGROUND_COLOR
+        && state->prev_color != TRAIL_COLOR) {
+        path->count = 0;
+        path->broken = false;
+    }
+
+    int n = path->count;
+    if (path->broken || (n > 0 && x == path->x[n - 1] && y == path->y[n - 1])) {
+        return;
+    }
+
+    if (n > 0) {
+        int dx = x - path->x[n - 1], dy = y - path->y[n - 1];
+        // Squares of the trail laid farther apart or aside do not join.
+        if ((dx != 0 && dy != 0)
+            || dx * dx + dy * dy > TRAIL_WIDTH * TRAIL_WIDTH) {
+            path->broken = true;
+            return;
+        }
+        if (n > 1) {
+            int px = path->x[n - 1] - path->x[n - 2];
+            int py = path->y[n - 1] - path->y[n - 2];
+            if (px * dx + py * dy < 0) {
+                path->broken = true;
+                return;
+            } else if (px * dy == py * dx) {
+                // Straight on, the last corner moves.
+                path->x[n - 1] = x;
+                path->y[n - 1] = y;
+                return;
+            }
+        }
+    }
+
+    if (n == QIX_MAX_PATH_VERTICES) {
+        path->broken = true;
+        return;
+    }
+    path->x[n] = x;
+    path->y[n] = y;
+    path->count = n + 1;
+}
+
+static void index_trail(qix_trail_index_t *index, qix_rect_t rect)
+{
+    if (index->count > 0) {
+        qix_rect_t *last = &index->segments[index->count - 1];
+        bool same_columns = rect.x1 == last->x1 && rect.x2 == last->x2
+            && rect.y1 <= last->y2 && rect.y2 >= last->y1;
+        bool same_rows = rect.y1 == last->y1 && rect.y2 == last->y2
+            && rect.x1 <= last->x2 && rect.x2 >= last->x1;
+
+        // A straight run goes on, or there is no room for another one.
+        if (same_columns || same_rows
+            || index->count == QIX_MAX_TRAIL_SEGMENTS) {
+            last->x1 = rect.x1 < last->x1 ? rect.x1 : last->x1;
+            last->y1 = rect.y1 < last->y1 ? rect.y1 : last->y1;
+            last->x2 = rect.x2 > last->x2 ? rect.x2 : last->x2;
+            last->y2 = rect.y2 > last->y2 ? rect.y2 : last->y2;
+            return;
+        }
+    }
+
+    index->segments[index->count++] = rect;
+}
+
+static qix_tile_kind_t rect_kind(const qix_state_t *state, qix_rect_t rect)
+{
+    int tx1 = rect.x1 / QIX_TILE_SIZE, tx2 = (rect.x2 - 1) / QIX_TILE_SIZE;
+    int ty1 = rect.y1 / QIX_TILE_SIZE, ty2 = (rect.y2 - 1) / QIX_TILE_SIZE;
+
+    if (tx2 - tx1 <= 1 && ty2 - ty1 <= 1) {
+        qix_tile_kind_t kind = qix_tile_kind(state, ty1 * QIX_TILES_X + tx1);
+        if (kind != qix_tile_kind(state, ty1 * QIX_TILES_X + tx2)
+            || kind != qix_tile_kind(state, ty2 * QIX_TILES_X + tx1)
+            || kind != qix_tile_kind(state, ty2 * QIX_TILES_X + tx2)) {
+            return QIX_TILE_MIXED;
+        }
+        return kind;
+    }
+
+    int level = 1;
+    while (level < QIX_QUAD_LEVELS
+           && (tx1 >> level != tx2 >> level || ty1 >> level != ty2 >> level)) {
+        ++level;
+    }
+
+    return qix_quad_kind(state, level, tx1 >> level, ty1 >> level);
+}
+
+static qix_rect_t body_rect(int x, int y)
+{
+    // Corners of a body lie ENTITY_WIDTH apart, so it spans one pixel more.
+    return (qix_rect_t){x, y, x + ENTITY_WIDTH + 1, y + ENTITY_HEIGHT + 1};
+}
+
+static bool collision_full_body(const qix_state_t *state, int x, int y,
+                                rgb565_t color)
+{
+    // A body within a uniform node is answered by the quadtree.
+    qix_rect_t body = body_rect(x, y);
+    if (x >= 0 && y >= 0 && body.x2 <= SCREEN_WIDTH
+        && body.y2 <= SCREEN_HEIGHT) {
+        qix_tile_kind_t kind = rect_kind(state, body);
+        if (kind != QIX_TILE_MIXED) {
+            return qix_tile_color(kind) == color;
+        }
+    }
+
+    return cell(state, x, y) == color
+        && cell(state, x+ENTITY_WIDTH, y) == color
+        && cell(state, x, y+ENTITY_HEIGHT) == color
+        && cell(state, x+ENTITY_WIDTH, y+ENTITY_HEIGHT) == color;
+}
+
+static bool collision_with_color(const qix_state_t *state, int x, int y,
+                                 rgb565_t color)
+{
+    qix_rect_t body = body_rect(x, y);
+    if (x >= 0 && y >= 0 && body.x2 <= SCREEN_WIDTH
+        && body.y2 <= SCREEN_HEIGHT) {
+        qix_tile_kind_t kind = rect_kind(state, body);
+        if (kind != QIX_TILE_MIXED) {
+            return qix_tile_color(kind) == color;
+        }
+    }
+
+    return cell(state, x, y) == color
+        || cell(state, x+ENTITY_WIDTH, y) == color
+        || cell(state, x, y+ENTITY_HEIGHT) == color
+        || cell(state, x+ENTITY_WIDTH, y+ENTITY_HEIGHT) == color;
+}
+
+static void update_prev_color(qix_state_t *state)
+{
+    const entity_t *player = &state->player;
+    int midx = player->xx + ENTITY_WIDTH / 2;
+    int midy = player->yy + ENTITY_HEIGHT / 2;
+
+    switch (player->direction) {
+    case UP:
+        state->prev_color = cell(state, midx, midy - 1);
+        break;
+    case LEFT:
+        state->prev_color = cell(state, midx - 1, midy);
+        break;
+    case DOWN:
+    case RIGHT:
+        state->prev_color = cell(state, midx, midy);
+        break;
+    }
+
+    if (state->prev_color == TRAIL_COLOR && qix_capture_pending(state)) {
+        state->prev_color = FILL_COLOR;
+    }
+}
+
+static bool entity_speed_stop_if_hit_color(const qix_state_t *state,
+                                           int x, int y, int direction,
+                                           rgb565_t color)
+{
+    int x1 = x, x2 = x + ENTITY_WIDTH;
+    int y1 = y, y2 = y + ENTITY_HEIGHT;
+
+    switch (direction) {
+    case UP:
+        return cell(state, x1, y1) == color && cell(state, x2, y1) == color;
+    case DOWN:
+        return cell(state, x1, y2) == color && cell(state, x2, y2) == color;
+    case LEFT:
+        return cell(state, x1, y1) == color && cell(state, x1, y2) == color;
+    case RIGHT:
+        return cell(state, x2, y1) == color && cell(state, x2, y2) == color;
+    default:
+        return false;
+    }
+}
+
+static bool player_hits_trail(const qix_state_t *state)
+{
+    const entity_t *player = &state->player;
+    int x1 = player->xx, x2 = x1 + ENTITY_WIDTH;
+    int y1 = player->yy, y2 = y1 + ENTITY_HEIGHT;
+
+    if (!qix_capture_pending(state)) {
+        return entity_speed_stop_if_hit_color(state, x1, y1,
+                                              player->direction, TRAIL_COLOR);
+    } else if (!state->capture.running) {
+        return false;
+    }
+
+    qix_rect_t a, b;
+    switch (player->direction) {
+    case UP:
+        a = (qix_rect_t){x1, y1, x1 + 1, y1 + 1};
+        b = (qix_rect_t){x2, y1, x2 + 1, y1 + 1};
+        break;
+    case DOWN:
+        a = (qix_rect_t){x1, y2, x1 + 1, y2 + 1};
+        b = (qix_rect_t){x2, y2, x2 + 1, y2 + 1};
+        break;
+    case LEFT:
+        a = (qix_rect_t){x1, y1, x1 + 1, y1 + 1};
+        b = (qix_rect_t){x1, y2, x1 + 1, y2 + 1};
+        break;
+    case RIGHT:
+        a = (qix_rect_t){x2, y1, x2 + 1, y1 + 1};
+        b = (qix_rect_t){x2, y2, x2 + 1, y2 + 1};
+        break;
+    default:
+        return false;
+    }
+
+    return held_trail_in_rect(state, a) && held_trail_in_rect(state, b);
+}
+
+static void update_player(qix_state_t *state)
+{
+    entity_t *player = &state->player;
+
+    // A new trail must not run across an area which is still being filled
+    // bit by bit. On the worker thread, the trail is held instead.
+    if (qix_capture_pending(state) && !state->capture.running
+        && trail_on_background(state)) {
+        qix_capture_advance(state, INT_MAX);
+    }
+
+    update_prev_color(state);
+    add_trail_to_background(state);
+    update_no_check(&player->xx, &player->yy, player->direction,
+                    player->speed);
+
+    if (!player->invul && collission_check(state)) {
+        hit_player(state);
+    }
+
+    if (player_hits_trail(state)) {
+        player->speed = 0;
+        if (!player->invul) {
+            hit_player(state);
+        }
+    } else {
+        player->speed = state->params.player_speed;
+    }
+
+    if ((collision_with_color(state, player->xx, player->yy, BORDER_COLOR)
+         || collision_with_color(state, player->xx, player->yy, FILL_COLOR))
+            && (state->prev_color == BACKGROUND_COLOR
+                || state->prev_color == TRAIL_COLOR)) {
+        add_whole_trail_to_background(state);
+        floodfill_least_area(state);
+    }
+}
+
+static void repaint(qix_state_t *state, rgb565_t old_color, rgb565_t new_color)
+{
+    for (int tile = 0; tile < QIX_TILES; ++tile) {
+        // A uniform tile of another color has nothing to repaint.
+        qix_tile_kind_t kind = qix_tile_kind(state, tile);
+        if (kind != QIX_TILE_MIXED && qix_tile_color(kind) != old_color) {
+            continue;
+        }
+
+        int x = tile % QIX_TILES_X * QIX_TILE_SIZE;
+        int y = tile / QIX_TILES_X * QIX_TILE_SIZE;
+        qix_rect_t rect = {x, y, x + QIX_TILE_SIZE, y + QIX_TILE_SIZE};
+        repaint_rect(state, rect, old_color, new_color);
+    }
+
+    if (old_color == TRAIL_COLOR) {
+        state->trail_segments.count = 0;
+        state->trail_path.count = 0;
+        state->trail_path.broken = false;
+        clear_trail_flags(state);
+    }
+}
+
+static void repaint_rect(qix_state_t *state, qix_rect_t rect,
+                         rgb565_t old_color, rgb565_t new_color)
+{
+    bool touches_free = old_color == BACKGROUND_COLOR
+        || new_color == BACKGROUND_COLOR;
+    unsigned int flag = new_color == TRAIL_COLOR ? QIX_GRID_TRAIL
+        : new_color == FILL_COLOR ? QIX_GRID_FILL : 0;
+
+    // Repainted piece by piece of one tile, which lies in one grid cell.
+    for (int ty = rect.y1 / QIX_TILE_SIZE; ty * QIX_TILE_SIZE < rect.y2;
+         ++ty) {
+        int y1 = ty * QIX_TILE_SIZE > rect.y1 ? ty * QIX_TILE_SIZE : rect.y1;
+        int y2 = (ty + 1) * QIX_TILE_SIZE < rect.y2
+            ? (ty + 1) * QIX_TILE_SIZE : rect.y2;
+        for (int tx = rect.x1 / QIX_TILE_SIZE; tx * QIX_TILE_SIZE < rect.x2;
+             ++tx) {
+            int x1 = tx * QIX_TILE_SIZE > rect.x1 ? tx * QIX_TILE_SIZE
+                : rect.x1;
+            int x2 = (tx + 1) * QIX_TILE_SIZE < rect.x2
+                ? (tx + 1) * QIX_TILE_SIZE : rect.x2;
+
+            // Columns of the arena are the rows of the kernel.
+            int n = fb_replace(&state->background[x1][y1], SCREEN_HEIGHT,
+                               y2 - y1, x2 - x1, old_color, new_color);
+            if (n == 0) {
+                continue;
+            }
+
+            count_tile(state, ty * QIX_TILES_X + tx, old_color, new_color,
+                       n);
+            state->grid.flags[grid_index(x1, y1)] |= flag;
+            for (int x = x1; x < x2; ++x) {
+                if (touches_free) {
+                    touch_column(state, x);
+                }
+                // Runs of the new color, whether replaced or not.
+                for (int y = y1; y < y2; ++y) {
+                    int end = y;
+                    while (end < y2 && state->background[x][end] == new_color) {
+                        ++end;
+                    }
+                    if (end > y) {
+                        mirror_cells(state, x, y, end - y, new_color);
+                        y = end;
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void clear_trail_flags(qix_state_t *state)
+{
+    for (int c = 0; c < QIX_GRID_SIZE; ++c) {
+        state->grid.flags[c] &= ~QIX_GRID_TRAIL;
+    }
+}
+
+static void floodfill_least_area(qix_state_t *state)
+{
+    const entity_t *player = &state->player;
+    int x1, y1, x2, y2;
+    x1 = y1 = x2 = y2 = 0;
+    switch (player->direction) {
+    case UP:
+        x1 = player->xx;
+        x2 = player->xx + ENTITY_WIDTH;
+        y1 = y2 = player->yy + ENTITY_HEIGHT;
+        break;
+    case DOWN:
+        x1 = player->xx;
+        x2 = player->xx + ENTITY_WIDTH;
+        y1 = y2 = player->yy;
+        break;
+    case LEFT:
+        x1 = x2 = player->xx + ENTITY_WIDTH;
+        y1 = player->yy;
+        y2 = player->yy + ENTITY_HEIGHT;
+        break;
+    case RIGHT:
+        x1 = x2 = player->xx;
+        y1 = player->yy;
+        y2 = player->yy + ENTITY_HEIGHT;
+        break;
+    default:
+        break;
+    }
+
+    // The trail held for the capture on the worker thread is painted by
+    // the commit, before the sides are looked at.
+    if (state->capture.running) {
+        qix_capture_advance(state, INT_MAX);
+    }
+
+    // One side is empty, the least area is nothing. The trail goes on.
+    if (cell(state, x1, y1) != BACKGROUND_COLOR
+        || cell(state, x2, y2) != BACKGROUND_COLOR) {
+        return;
+    }
+
+    qix_capture_t *cap = &state->capture;
+    if (qix_capture_pending(state)) {
+        qix_capture_advance(state, INT_MAX);
+    }
+
+    memset(cap->mark, 0, sizeof(cap->mark));
+    cap->seed_x[0] = x1;
+    cap->seed_y[0] = y1;
+    cap->seed_x[1] = x2;
+    cap->seed_y[1] = y2;
+
+    // The trail laid from now on is the next one.
+    cap->path = state->trail_path;
+    cap->estimated = false;
+    state->trail_path.count = 0;
+    state->trail_path.broken = false;
+
+    snapshot_qixes(state);
+    if (state->params.async_capture && start_worker(state)) {
+        return;
+    }
+    if (!choose_by_outline(state) && !choose_by_regions(state)) {
+        measure_sides(state);
+    }
+
+    if (state->params.capture_step_px == 0) {
+        qix_capture_advance(state, INT_MAX);
+    }
+}
+
+static bool in_bounds(int x, int y)
+{
+    return x >= 0 && x < SCREEN_WIDTH && y >= 0 && y < SCREEN_HEIGHT;
+}
+
+static uint32_t *queue_slot(qix_capture_t *cap, int q, int i)
+{
+    return &cap->queue[q == 0 ? i : SCREEN_WIDTH * SCREEN_HEIGHT - 1 - i];
+}
+
+static int enqueue(qix_state_t *state, int q, int x, int y,
+                   rgb565_t color, uint8_t match, uint8_t set)
+{
+    qix_capture_t *cap = &state->capture;
+    qix_span_queue_t *queue = &cap->queues[q];
+
+    if (!in_bounds(x, y) || state->background[x][y] != color) {
+        return y;
+    }
+
+    if (cap->mark[x][y] != match) {
+        // Reached by the search of the other side.
+        if (cap->mark[x][y] != set) {
+            cap->met = true;
+        }
+        return y;
+    }
+
+    const rgb565_t *column = state->background[x];
+    const uint8_t *marks = cap->mark[x];
+    int y1 = y, y2 = y;
+    while (y1 > 0 && column[y1 - 1] == color && marks[y1 - 1] == match) {
+        --y1;
+    }
+    while (y2 < SCREEN_HEIGHT - 1 && column[y2 + 1] == color
+           && marks[y2 + 1] == match) {
+        ++y2;
+    }
+
+    // Marked when queued, so every pixel is queued at most once.
+    memset(&cap->mark[x][y1], set, y2 - y1 + 1);
+    *queue_slot(cap, q, queue->tail++) = (uint32_t)x << SPAN_X_SHIFT
+        | (uint32_t)y1 << SPAN_Y_SHIFT | y2;
+    queue->pixels += y2 - y1 + 1;
+
+    for (int i = 0; i < cap->nqixes && !queue->qix; ++i) {
+        queue->qix = x >= cap->qix_x[i] && x <= cap->qix_x[i] + ENTITY_WIDTH
+            && y1 <= cap->qix_y[i] + ENTITY_HEIGHT && y2 >= cap->qix_y[i];
+    }
+
+    return y2;
+}
+
+static int search(qix_state_t *state, int q, int budget, rgb565_t color,
+                  uint8_t match, uint8_t set, rgb565_t new_color)
+{
+    qix_capture_t *cap = &state->capture;
+    qix_span_queue_t *queue = &cap->queues[q];
+    int done = 0;
+
+    while (queue->head < queue->tail && done < budget) {
+        uint32_t span = *queue_slot(cap, q, queue->head++);
+        int x = span >> SPAN_X_SHIFT;
+        int y1 = span >> SPAN_Y_SHIFT & SPAN_Y_MASK, y2 = span & SPAN_Y_MASK;
+
+        if (new_color != color) {
+            set_cells(state, x, y1, y2 - y1 + 1, color, new_color);
+        }
+
+        // Spans above and below have been taken in whole, only the
+        // neighbouring columns can continue the area.
+        for (int y = y1; y <= y2; ++y) {
+            y = enqueue(state, q, x - 1, y, color, match, set);
+        }
+        for (int y = y1; y <= y2; ++y) {
+            y = enqueue(state, q, x + 1, y, color, match, set);
+        }
+        done += y2 - y1 + 1;
+    }
+
+    return done;
+}
+
+static int fill(qix_state_t *state, int budget, int area, rgb565_t color,
+                uint8_t match, rgb565_t new_color)
+{
+    if (state->params.fill_threads > 1 && budget >= QIX_PARALLEL_FILL_PX
+        && area >= QIX_PARALLEL_FILL_PX) {
+        return parallel_fill(state, budget, color, match, new_color);
+    }
+
+    return search(state, 0, budget, color, match, MARK_FILLED, new_color);
+}
+
+static int parallel_fill(qix_state_t *state, int budget, rgb565_t color,
+                         uint8_t match, rgb565_t new_color)
+{
+    qix_capture_t *cap = &state->capture;
+    qix_fill_pool_t *pool = &cap->helpers;
+    qix_span_queue_t *queue = &cap->queues[0];
+    fill_thread_t threads[QIX_MAX_FILL_THREADS];
+    fill_job_t job = {
+        .state = state,
+        .pool = pool,
+        .threads = threads,
+        .color = color,
+        .new_color = new_color,
+        .match = match,
+        .set = MARK_FILLED,
+        .nthreads = state->params.fill_threads,
+        .budget = budget,
+        .busy = 0,
+        .waiting = 0
+    };
+
+    int helpers = start_fill_helpers(state, job.nthreads - 1);
+    for (int i = 0; i < job.nthreads; ++i) {
+        job.count[i] = 0;
+        memset(&threads[i], 0, sizeof(threads[i]));
+        threads[i].job = &job;
+        threads[i].stacks = 1u << i;
+    }
+    for (int i = helpers + 1; i < job.nthreads; ++i) {
+        threads[0].stacks |= 1u << i;
+    }
+
+    for (int i = queue->head; i < queue->tail; ++i) {
+        uint32_t span = *queue_slot(cap, 0, i);
+        int id = fill_owner(&job, span >> SPAN_X_SHIFT);
+        cap->stacks[id][job.count[id]++] = span;
+    }
+    queue->head = queue->tail = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->job = &job;
+    pool->working = helpers;
+    ++pool->round;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_fill_thread(&threads[0]);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->working > 0) {
+        pthread_cond_wait(&pool->left, &pool->lock);
+    }
+    pool->job = NULL;
+    pthread_mutex_unlock(&pool->lock);
+
+    int done = 0;
+    for (int i = 0; i < job.nthreads; ++i) {
+        const fill_thread_t *thread = &threads[i];
+        done += thread->done;
+        queue->pixels += thread->claimed;
+        for (int tile = 0; tile < QIX_TILES; ++tile) {
+            if (thread->tiles[tile]) {
+                count_tile(state, tile, color, new_color, thread->tiles[tile]);
+            }
+        }
+        // The territory is written here, not by every thread at once.
+        for (int x = 0; x < SCREEN_WIDTH; ++x) {
+            if (thread->columns[x]) {
+                touch_column(state, x);
+                mirror_column(state, x);
+            }
+        }
+        for (int g = 0; g < QIX_GRID_SIZE; ++g) {
+            state->grid.flags[g] |= thread->flags[g];
+        }
+    }
+
+    // Entries left when the budget has run out wait for the next call.
+    for (int i = 0; i < job.nthreads; ++i) {
+        for (int j = 0; j < job.count[i]; ++j) {
+            uint32_t entry = cap->stacks[i][j];
+            if (!(entry & FILL_PROBE)) {
+                *queue_slot(cap, 0, queue->tail++) = entry;
+                continue;
+            }
+
+            int x = (entry & ~FILL_PROBE) >> SPAN_X_SHIFT;
+            int y2 = entry & SPAN_Y_MASK;
+            for (int y = entry >> SPAN_Y_SHIFT & SPAN_Y_MASK; y <= y2; ++y) {
+                y = enqueue(state, 0, x, y, color, match, MARK_FILLED);
+            }
+        }
+    }
+
+    return done;
+}
+
+static int fill_owner(const fill_job_t *job, int x)
+{
+    return x / QIX_TILE_SIZE % job->nthreads;
+}
+
+static int start_fill_helpers(qix_state_t *state, int wanted)
+{
+    qix_fill_pool_t *pool = &state->capture.helpers;
+
+    if (!pool->ready) {
+        pthread_mutex_init(&pool->lock, NULL);
+        pthread_cond_init(&pool->wake, NULL);
+        pthread_cond_init(&pool->more, NULL);
+        pthread_cond_init(&pool->left, NULL);
+        pool->ready = true;
+        pool->quit = false;
+        pool->named = 0;
+        pool->job = NULL;
+        pool->round = 0;
+        pool->working = 0;
+    }
+
+    while (pool->count < wanted
+           && pthread_create(&pool->threads[pool->count], NULL,
+                             fill_helper_main, state) == 0) {
+        ++pool->count;
+    }
+
+    return pool->count < wanted ? pool->count : wanted;
+}
+
+static void stop_fill_helpers(qix_state_t *state)
+{
+    qix_fill_pool_t *pool = &state->capture.helpers;
+
+    if (!pool->ready) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->count; ++i) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->left);
+    pthread_cond_destroy(&pool->more);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    pool->ready = false;
+    pool->count = 0;
+}
+
+static void *fill_helper_main(void *arg)
+{
+    qix_state_t *state = arg;
+    qix_fill_pool_t *pool = &state->capture.helpers;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    int id = ++pool->named;
+    for (;;) {
+        while (!pool->quit && (pool->round == seen || !pool->job)) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (pool->quit) {
+            break;
+        }
+
+        // Fills with fewer threads than helpers leave the rest asleep,
+        // they are not counted as working.
+        fill_job_t *job = pool->job;
+        seen = pool->round;
+        if (id >= job->nthreads) {
+            continue;
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+        run_fill_thread(&job->threads[id]);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->working == 0) {
+            pthread_cond_signal(&pool->left);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+static void run_fill_thread(fill_thread_t *thread)
+{
+    bool busy = false;
+    uint32_t entry;
+    int id;
+
+    while (take_entry(thread, busy, &id, &entry)) {
+        busy = true;
+        if (entry & FILL_PROBE) {
+            int x = (entry & ~FILL_PROBE) >> SPAN_X_SHIFT;
+            int y2 = entry & SPAN_Y_MASK;
+            for (int y = entry >> SPAN_Y_SHIFT & SPAN_Y_MASK; y <= y2; ++y) {
+                y = claim_span(thread, id, x, y);
+            }
+        } else {
+            fill_span(thread, id, entry);
+        }
+    }
+}
+
+static void fill_span(fill_thread_t *thread, int id, uint32_t span)
+{
+    fill_job_t *job = thread->job;
+    int x = span >> SPAN_X_SHIFT;
+    int y1 = span >> SPAN_Y_SHIFT & SPAN_Y_MASK, y2 = span & SPAN_Y_MASK;
+
+    if (job->new_color != job->color) {
+        int n = y2 - y1 + 1;
+        fb_fill(&job->state->background[x][y1], n, n, 1, job->new_color);
+    }
+
+    // Changes set_cells() would make, merged once the fill stops.
+    for (int ty = y1 / QIX_TILE_SIZE; ty <= y2 / QIX_TILE_SIZE; ++ty) {
+        int first = ty * QIX_TILE_SIZE > y1 ? ty * QIX_TILE_SIZE : y1;
+        int last = (ty + 1) * QIX_TILE_SIZE <= y2
+            ? (ty + 1) * QIX_TILE_SIZE - 1 : y2;
+        thread->tiles[ty * QIX_TILES_X + x / QIX_TILE_SIZE] +=
+            last - first + 1;
+    }
+    thread->columns[x] = true;
+    unsigned int flag = job->new_color == TRAIL_COLOR ? QIX_GRID_TRAIL
+        : job->new_color == FILL_COLOR ? QIX_GRID_FILL : 0;
+    for (int gy = y1 / QIX_GRID_CELL; flag && gy <= y2 / QIX_GRID_CELL;
+         ++gy) {
+        thread->flags[grid_index(x, gy * QIX_GRID_CELL)] |= flag;
+    }
+
+    for (int nx = x - 1; nx <= x + 1; nx += 2) {
+        if (nx < 0 || nx >= SCREEN_WIDTH) {
+            continue;
+        }
+
+        int owner = fill_owner(job, nx);
+        if (owner != id) {
+            push_entry(job, owner, FILL_PROBE | (uint32_t)nx << SPAN_X_SHIFT
+                       | (span & ~(~0u << SPAN_X_SHIFT)));
+            continue;
+        }
+        for (int y = y1; y <= y2; ++y) {
+            y = claim_span(thread, id, nx, y);
+        }
+    }
+
+    thread->done += y2 - y1 + 1;
+    __atomic_sub_fetch(&job->budget, y2 - y1 + 1, __ATOMIC_RELAXED);
+}
+
+static int claim_span(fill_thread_t *thread, int id, int x, int y)
+{
+    fill_job_t *job = thread->job;
+    const rgb565_t *column = job->state->background[x];
+    uint8_t *marks = job->state->capture.mark[x];
+
+    if (column[y] != job->color || marks[y] != job->match) {
+        return y;
+    }
+
+    int y1 = y, y2 = y;
+    while (y1 > 0 && column[y1 - 1] == job->color
+           && marks[y1 - 1] == job->match) {
+        --y1;
+    }
+    while (y2 < SCREEN_HEIGHT - 1 && column[y2 + 1] == job->color
+           && marks[y2 + 1] == job->match) {
+        ++y2;
+    }
+
+    memset(&marks[y1], job->set, y2 - y1 + 1);
+    push_entry(job, id, (uint32_t)x << SPAN_X_SHIFT
+               | (uint32_t)y1 << SPAN_Y_SHIFT | y2);
+    thread->claimed += y2 - y1 + 1;
+
+    return y2;
+}
+
+static void push_entry(fill_job_t *job, int id, uint32_t entry)
+{
+    // A stack holds at most the disjoint spans of the columns of its
+    // thread and one entry per span filled next to them by the others,
+    // which is within QIX_FILL_STACK_SPANS.
+    pthread_mutex_lock(&job->pool->lock);
+    job->state->capture.stacks[id][job->count[id]++] = entry;
+    if (job->waiting > 0) {
+        pthread_cond_broadcast(&job->pool->more);
+    }
+    pthread_mutex_unlock(&job->pool->lock);
+}
+
+static bool take_entry(fill_thread_t *thread, bool busy, int *id,
+                       uint32_t *entry)
+{
+    fill_job_t *job = thread->job;
+    bool found = false;
+
+    pthread_mutex_lock(&job->pool->lock);
+    if (busy) {
+        --job->busy;
+    }
+    while (!found && __atomic_load_n(&job->budget, __ATOMIC_RELAXED) > 0) {
+        int left = 0;
+        for (int i = 0; i < job->nthreads && !found; ++i) {
+            if (thread->stacks & 1u << i && job->count[i] > 0) {
+                *entry = job->state->capture.stacks[i][--job->count[i]];
+                *id = i;
+                found = true;
+            }
+            left += job->count[i];
+        }
+        if (found) {
+            ++job->busy;
+        } else if (job->busy == 0 && left == 0) {
+            // Only threads with entries push, nothing more can come.
+            break;
+        } else {
+            ++job->waiting;
+            pthread_cond_wait(&job->pool->more, &job->pool->lock);
+            --job->waiting;
+        }
+    }
+
+    // Threads waiting for the one leaving have to check again.
+    if (!found && job->waiting > 0) {
+        pthread_cond_broadcast(&job->pool->more);
+    }
+    pthread_mutex_unlock(&job->pool->lock);
+
+    return found;
+}
+
+static void measure_sides(qix_state_t *state)
+{
+    qix_capture_t *cap = &state->capture;
+
+    cap->phase = QIX_CAPTURE_MEASURE;
+    cap->met = cap->whole = false;
+    memset(cap->queues, 0, sizeof(cap->queues));
+
+    for (int side = 0; side < 2; ++side) {
+        enqueue(state, side, cap->seed_x[side], cap->seed_y[side],
+                BACKGROUND_COLOR, 0, side + 1);
+    }
+}
+
+static int measure(qix_state_t *state, int budget)
+{
+    qix_capture_t *cap = &state->capture;
+
+    if (cap->met && !cap->whole) {
+        measure_whole(state);
+    }
+
+    int side = side_to_measure(cap);
+    int done = search(state, side, budget < MEASURE_CHUNK_PX ? budget
+                      : MEASURE_CHUNK_PX, BACKGROUND_COLOR, 0, side + 1,
+                      BACKGROUND_COLOR);
+    if (!cap->met || cap->whole) {
+        choose_side(state);
+    }
+
+    return done;
+}
+
+static void measure_whole(qix_state_t *state)
+{
+    qix_capture_t *cap = &state->capture;
+
+    cap->whole = true;
+    memset(cap->mark, 0, sizeof(cap->mark));
+    memset(cap->queues, 0, sizeof(cap->queues));
+    enqueue(state, 0, cap->seed_x[0], cap->seed_y[0], BACKGROUND_COLOR, 0, 1);
+}
+
+static int side_to_measure(const qix_capture_t *cap)
+{
+    const qix_span_queue_t *q = cap->queues;
+
+    if (cap->whole || q[1].head == q[1].tail) {
+        return 0;
+    }
+    if (q[0].head == q[0].tail) {
+        return 1;
+    }
+    if (q[0].qix != q[1].qix) {
+        return q[0].qix ? 1 : 0;
+    }
+
+    return q[0].pixels <= q[1].pixels ? 0 : 1;
+}
+
+static bool choose_side(qix_state_t *state)
+{
+    qix_capture_t *cap = &state->capture;
+    const qix_span_queue_t *q = cap->queues;
+    bool done0 = q[0].head == q[0].tail, done1 = q[1].head == q[1].tail;
+
+    if (cap->whole) {
+        if (!done0) {
+            return false;
+        }
+
+        // Both sides are the same area.
+        q = &cap->queues[0];
+        cap->area[0] = cap->area[1] = q->pixels;
+        cap->chosen = capture_rule(q->qix, q->qix, q->pixels, q->pixels);
+    } else {
+        bool free0 = done0 && !q[0].qix, free1 = done1 && !q[1].qix;
+
+        // A side free of qixes is chosen once the other one has a qix or
+        // is known to be larger, it would be chosen otherwise.
+        if ((done0 && done1)
+            || (free0 && (q[1].qix || q[1].pixels > q[0].pixels))
+            || (free1 && (q[0].qix || q[0].pixels >= q[1].pixels))) {
+            cap->chosen = capture_rule(q[0].qix, q[1].qix, q[0].pixels,
+                                       q[1].pixels);
+        } else {
+            return false;
+        }
+        cap->area[0] = q[0].pixels;
+        cap->area[1] = q[1].pixels;
+    }
+
+    cap->repaint_trail = cap->area[0] > 0 && cap->area[1] > 0;
+    fill_side(state);
+
+    return true;
+}
+
+static int capture_rule(bool qix0, bool qix1, long area0, long area1)
+{
+    if (qix0 != qix1) {
+        return qix0 ? 1 : 0;
+    }
+
+    return area0 < area1 ? 0 : 1;
+}
+
+static void snapshot_qixes(qix_state_t *state)
+{
+    qix_capture_t *cap = &state->capture;
+    const qix_pool_t *qixes = &state->qixes;
+
+    cap->nqixes = qixes->count;
+    for (int i = 0; i < qixes->count; ++i) {
+        cap->qix_x[i] = qixes->xx[i];
+        cap->qix_y[i] = qixes->yy[i];
+    }
+}
+
+static void fill_side(qix_state_t *state)
+{
+    qix_capture_t *cap = &state->capture;
+
+    cap->phase = QIX_CAPTURE_FILL;
+    memset(cap->queues, 0, sizeof(cap->queues));
+
+    // Measured areas are marked, otherwise no pixel is.
+    int x = cap->seed_x[cap->chosen], y = cap->seed_y[cap->chosen];
+    if (in_bounds(x, y)) {
+        cap->fill_mark = cap->mark[x][y];
+        enqueue(state, 0, x, y, BACKGROUND_COLOR, cap->fill_mark,
+                MARK_FILLED);
+    }
+}
+
+static bool choose_by_regions(qix_state_t *state)
+{
+    qix_capture_t *cap = &state->capture;
+    qix_regions_t *regions = &state->regions;
+
+    if (!refresh_regions(state)) {
+        return false;
+    }
+
+    int root[2];
+    for (int side = 0; side < 2; ++side) {
+        root[side] = region_at(regions, cap->seed_x[side], cap->seed_y[side]);
+        cap->area[side] = regions->area[root[side]];
+    }
+
+    // A qix is in the regions its corners span, like in the search.
+    bool qix[2] = {false, false};
+    for (int i = 0; i < cap->nqixes; ++i) {
+        int x1 = cap->qix_x[i] < 0 ? 0 : cap->qix_x[i];
+        int x2 = cap->qix_x[i] + ENTITY_WIDTH;
+        int y1 = cap->qix_y[i], y2 = cap->qix_y[i] + ENTITY_HEIGHT;
+
+        for (int x = x1; x <= x2 && x < SCREEN_WIDTH; ++x) {
+            for (int j = 0; j < regions->count[x]; ++j) {
+                if (regions->y1[x][j] > y2 || regions->y2[x][j] < y1) {
+                    continue;
+                }
+
+                int r = find_region(regions, x * QIX_MAX_COLUMN_SPANS + j);
+                qix[0] = qix[0] || r == root[0];
+                qix[1] = qix[1] || r == root[1];
+            }
+        }
+    }
+
+    // If the trail has not split the area, both sides are one region and
+    // the rule picks the second side, which fills it whole.
+    cap->chosen = capture_rule(qix[0], qix[1], cap->area[0], cap->area[1]);
+    cap->repaint_trail = cap->area[0] > 0 && cap->area[1] > 0;
+    fill_side(state);
+
+    return true;
+}
+
+static bool choose_by_outline(qix_state_t *state)
+{
+    qix_capture_t *cap = &state->capture;
+    const qix_trail_path_t *path = &cap->path;
+    int n = path->count;
+
+    if (path->broken || n < 2) {
+        return false;
+    }
+
+    // Both seeds lie beside the last run of the path, one on each side.
+    int dx = path->x[n - 1] - path->x[n - 2];
+    int dy = path->y[n - 1] - path->y[n - 2];
+    int run = dx * dx + dy * dy;
+    bool right[2];
+    for (int side = 0; side < 2; ++side) {
+        int ox = 2 * (cap->seed_x[side] - path->x[n - 2]) + 1;
+        int oy = 2 * (cap->seed_y[side] - path->y[n - 2]) + 1;
+        int along = dx * ox + dy * oy;
+        if (along <= 0 || along >= 2 * run) {
+            return false;
+        }
+        right[side] = dx * oy - dy * ox > 0;
+    }
+    if (right[0] == right[1]) {
+        return false;
+    }
+
+    int end, corners, reach;
+    // A traced hole has the free pixels on its outer side, counterclockwise.
+    if (!trace_outline(state, cap->seed_x[0], cap->seed_y[0])
+        || !build_side(cap, &end, &corners, &reach) || !path_clear(cap)) {
+        return false;
+    }
+    long whole = shoelace(cap->outline_x, cap->outline_y, cap->outline_count);
+    long side_area[2];
+    side_area[1] = shoelace(cap->side_x, cap->side_y, cap->side_count);
+    side_area[0] = whole - side_area[1];
+    if (whole <= 0 || side_area[0] <= 0 || side_area[1] <= 0) {
+        return false;
+    }
+
+    // The trail reaches half its width to either side of the path, less on
+    // the inner side of a turn and more on the outer one.
+    long length = 0;
+    int turns = 0;
+    for (int i = 1; i < n; ++i) {
+        length += abs(path->x[i] - path->x[i - 1])
+            + abs(path->y[i] - path->y[i - 1]);
+        if (i + 1 < n) {
+            int cross = (path->x[i] - path->x[i - 1])
+                * (path->y[i + 1] - path->y[i])
+                - (path->y[i] - path->y[i - 1])
+                * (path->x[i + 1] - path->x[i]);
+            turns += cross > 0 ? 1 : cross < 0 ? -1 : 0;
+        }
+    }
+    // Trail off the path, e.g. left along the edge of the captured area,
+    // would join areas the polygons keep apart. The tile summary counts
+    // the screen at its root.
+    long trail_px = (long)SCREEN_SIZE
+        - qix_rect_count(state, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT,
+                         BACKGROUND_COLOR)
+        - qix_rect_count(state, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, FILL_COLOR)
+        - qix_rect_count(state, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT,
+                         BORDER_COLOR);
+    if (trail_px > TRAIL_WIDTH * (length + reach)) {
+        return false;
+    }
+
+    long band[2] = {
+        TRAIL_WIDTH / 2 * length + TRAIL_WIDTH * turns,
+        TRAIL_WIDTH / 2 * length - TRAIL_WIDTH * turns
+    };
+    long estimate[2] = {
+        side_area[0] / 2 - band[0], side_area[1] / 2 - band[1]
+    };
+
+    bool qix[2] = {false, false};
+    for (int i = 0; i < cap->nqixes; ++i) {
+        int sides = place_qix(cap, i, end, corners);
+        if (sides < 0) {
+            return false;
+        }
+        qix[right[0] ? 0 : 1] |= (sides & 1) != 0;
+        qix[right[0] ? 1 : 0] |= (sides & 2) != 0;
+    }
+
+    int area[2];
+    for (int side = 0; side < 2; ++side) {
+        long a = estimate[right[side] ? 1 : 0];
+        area[side] = a < 0 ? 0 : a;
+    }
+    // Only clear choices are taken from the estimate.
+    if (qix[0] == qix[1] && abs(area[0] - area[1]) <= OUTLINE_SLACK_PX) {
+        return false;
+    }
+
+    cap->area[0] = area[0];
+    cap->area[1] = area[1];
+    cap->chosen = capture_rule(qix[0], qix[1], area[0], area[1]);
+    cap->repaint_trail = true;
+    cap->estimated = true;
+    fill_side(state);
+
+    return true;
+}
+
+static bool in_outline(const qix_state_t *state, int x, int y)
+{
+    return in_bounds(x, y) && (state->background[x][y] == BACKGROUND_COLOR
+                               || state->background[x][y] == TRAIL_COLOR);
+}
+
+static bool trace_outline(qix_state_t *state, int x, int y)
+{
+    // Steps by direction east, south, west and north, and the pixels ahead
+    // of a corner on the right and on the left of the direction.
+    static const int step_x[4] = {1, 0, -1, 0}, step_y[4] = {0, 1, 0, -1};
+    static const int right_x[4] = {0, -1, -1, 0};
+    static const int right_y[4] = {0, 0, -1, -1};
+    static const int left_x[4] = {0, 0, -1, -1};
+    static const int left_y[4] = {-1, 0, 0, -1};
+    qix_capture_t *cap = &state->capture;
+
+    // Up to the edge, which is followed east with the pixels below it.
+    while (in_outline(state, x, y - 1)) {
+        --y;
+    }
+
+    cap->outline_count = 0;
+    int cx = x, cy = y, d = 0;
+    for (long steps = 0; steps <= 4L * SCREEN_SIZE; ++steps) {
+        int turn = d;
+        if (!in_outline(state, cx + right_x[d], cy + right_y[d])) {
+            turn = (d + 1) & 3;
+        } else if (in_outline(state, cx + left_x[d], cy + left_y[d])) {
+            turn = (d + 3) & 3;
+        }
+
+        bool back = steps > 0 && cx == x && cy == y && turn == 0;
+        if (turn != d) {
+            if (cap->outline_count == QIX_MAX_OUTLINE_VERTICES) {
+                return false;
+            }
+            cap->outline_x[cap->outline_count] = cx;
+            cap->outline_y[cap->outline_count++] = cy;
+        }
+        if (back) {
+            return true;
+        }
+        d = turn;
+        cx += step_x[d];
+        cy += step_y[d];
+    }
+
+    return false;
+}
+
+static bool build_side(qix_capture_t *cap, int *end_edge, int *corners_out,
+                       int *reach)
+{
+    const qix_trail_path_t *path = &cap->path;
+    int n = path->count, m = cap->outline_count;
+    int ex, ey, eoff, sx, sy, soff;
+    int end = nearest_on_outline(cap, path->x[n - 1], path->y[n - 1], &ex,
+                                 &ey, &eoff);
+    int start = nearest_on_outline(cap, path->x[0], path->y[0], &sx, &sy,
+                                   &soff);
+    if (end < 0 || start < 0 || (end == start && eoff == soff)) {
+        return false;
+    }
+
+    // Both ends have to run straight into the outline, the player leaving
+    // and hitting it head-on; otherwise the trail around an end may cut off
+    // pockets the polygons do not have.
+    int ahead = beyond_run(path->x[n - 2], path->y[n - 2], path->x[n - 1],
+                           path->y[n - 1], ex, ey);
+    int behind = beyond_run(path->x[1], path->y[1], path->x[0], path->y[0],
+                            sx, sy);
+    if (ahead < 1 || ahead > ENTITY_WIDTH / 2 || behind > 0
+        || behind < -ENTITY_WIDTH / 2) {
+        return false;
+    }
+
+    // Corners from after the end forward to the edge of the start.
+    int corners = (start - end + m) % m;
+    if (corners == 0 && soff < eoff) {
+        corners = m;
+    }
+
+    int k = 0;
+    for (int i = 0; i < n; ++i, ++k) {
+        cap->side_x[k] = path->x[i];
+        cap->side_y[k] = path->y[i];
+    }
+    cap->side_x[k] = ex;
+    cap->side_y[k++] = ey;
+    for (int i = 1; i <= corners; ++i, ++k) {
+        cap->side_x[k] = cap->outline_x[(end + i) % m];
+        cap->side_y[k] = cap->outline_y[(end + i) % m];
+    }
+    cap->side_x[k] = sx;
+    cap->side_y[k++] = sy;
+    cap->side_count = k;
+    *end_edge = end;
+    *corners_out = corners;
+    *reach = ahead + behind;
+
+    return true;
+}
+
+static int beyond_run(int x1, int y1, int x2, int y2, int x, int y)
+{
+    int ux = (x2 > x1) - (x2 < x1), uy = (y2 > y1) - (y2 < y1);
+
+    if ((x - x2) * uy != (y - y2) * ux) {
+        return INT_MIN;
+    }
+
+    return (x - x2) * ux + (y - y2) * uy;
+}
+
+static int place_qix(const qix_capture_t *cap, int i, int end, int corners)
+{
+    const qix_trail_path_t *path = &cap->path;
+    int n = path->count, m = cap->outline_count, last = cap->side_count - 1;
+    int box[4] = {cap->qix_x[i], cap->qix_y[i],
+                  cap->qix_x[i] + ENTITY_WIDTH + 1,
+                  cap->qix_y[i] + ENTITY_HEIGHT + 1};
+    int near = (TRAIL_WIDTH / 2) * (TRAIL_WIDTH / 2);
+
+    if (box[0] < 0 || box[1] < 0 || box[2] > SCREEN_WIDTH
+        || box[3] > SCREEN_HEIGHT) {
+        return -1;
+    }
+
+    // The trail stays out of the box: the path, which it follows on to the
+    // front of the player, and the lines closing the path to the outline.
+    for (int j = 0; j + 1 < n; ++j) {
+        int run[4] = {path->x[j], path->y[j], path->x[j + 1],
+                      path->y[j + 1]};
+        if (j + 2 == n) {
+            int ux = (run[2] > run[0]) - (run[2] < run[0]);
+            int uy = (run[3] > run[1]) - (run[3] < run[1]);
+            run[2] += ux * ENTITY_WIDTH / 2;
+            run[3] += uy * ENTITY_HEIGHT / 2;
+        }
+        if (segment_gap(box, run) < near) {
+            return -1;
+        }
+    }
+    int closing[2][4] = {
+        {cap->side_x[n - 1], cap->side_y[n - 1], cap->side_x[n],
+         cap->side_y[n]},
+        {cap->side_x[last], cap->side_y[last], cap->side_x[0],
+         cap->side_y[0]}
+    };
+    if (segment_gap(box, closing[0]) < near
+        || segment_gap(box, closing[1]) < near) {
+        return -1;
+    }
+
+    // Otherwise the box meets a side if its center lies within it, or if
+    // an edge of the outline bounding that side crosses the box.
+    int sides = 0, px = box[0] + box[2], py = box[1] + box[3];
+    if (point_in_polygon(cap->side_x, cap->side_y, cap->side_count, px,
+                         py)) {
+        sides |= 1;
+    } else if (point_in_polygon(cap->outline_x, cap->outline_y, m, px,
+                                py)) {
+        sides |= 2;
+    }
+    for (int j = 0; j < m && sides != 3; ++j) {
+        int x1 = cap->outline_x[j], y1 = cap->outline_y[j];
+        int x2 = cap->outline_x[(j + 1) % m], y2 = cap->outline_y[(j + 1) % m];
+        bool crosses = x1 == x2
+            ? x1 > box[0] && x1 < box[2] && (y1 > y2 ? y1 : y2) > box[1]
+                && (y1 < y2 ? y1 : y2) < box[3]
+            : y1 > box[1] && y1 < box[3] && (x1 > x2 ? x1 : x2) > box[0]
+                && (x1 < x2 ? x1 : x2) < box[2];
+        if (!crosses) {
+            continue;
+        }
+
+        // The edges the ends of the path are closed to bound both sides.
+        int after = (j - end + m) % m;
+        if (after == 0 || after == corners % m) {
+            return -1;
+        }
+        sides |= after < corners ? 1 : 2;
+    }
+
+    return sides;
+}
+
+static int nearest_on_outline(const qix_capture_t *cap, int x, int y,
+                              int *nx, int *ny, int *offset)
+{
+    int m = cap->outline_count, best = -1;
+    int best_gap = ENTITY_WIDTH * ENTITY_WIDTH + 1;
+
+    for (int i = 0; i < m; ++i) {
+        int x1 = cap->outline_x[i], y1 = cap->outline_y[i];
+        int x2 = cap->outline_x[(i + 1) % m], y2 = cap->outline_y[(i + 1) % m];
+        int px = x < (x1 < x2 ? x1 : x2) ? (x1 < x2 ? x1 : x2)
+            : x > (x1 > x2 ? x1 : x2) ? (x1 > x2 ? x1 : x2) : x;
+        int py = y < (y1 < y2 ? y1 : y2) ? (y1 < y2 ? y1 : y2)
+            : y > (y1 > y2 ? y1 : y2) ? (y1 > y2 ? y1 : y2) : y;
+        int gap = (px - x) * (px - x) + (py - y) * (py - y);
+        if (gap < best_gap) {
+            best = i;
+            best_gap = gap;
+            *nx = px;
+            *ny = py;
+            *offset = abs(px - x1) + abs(py - y1);
+        }
+    }
+
+    return best;
+}
+
+static bool path_clear(const qix_capture_t *cap)
+{
+    const qix_trail_path_t *path = &cap->path;
+    int n = path->count, m = cap->outline_count;
+    long length = 0;
+
+    for (int i = 1; i < n; ++i) {
+        length += abs(path->x[i] - path->x[i - 1])
+            + abs(path->y[i] - path->y[i - 1]);
+    }
+
+    long at = 0;
+    for (int i = 0; i + 1 < n; ++i) {
+        int a[4] = {path->x[i], path->y[i], path->x[i + 1], path->y[i + 1]};
+        int run = abs(a[2] - a[0]) + abs(a[3] - a[1]);
+
+        // Runs apart from their neighbours keep their trails apart.
+        for (int j = i + 2; j + 1 < n; ++j) {
+            int b[4] = {path->x[j], path->y[j], path->x[j + 1],
+                        path->y[j + 1]};
+            if (segment_gap(a, b) <= TRAIL_WIDTH * TRAIL_WIDTH) {
+                return false;
+            }
+        }
+
+        // Only the ends of the path may come near the outline.
+        long from = at > ENTITY_WIDTH ? at : ENTITY_WIDTH;
+        long to = at + run < length - ENTITY_WIDTH ? at + run
+            : length - ENTITY_WIDTH;
+        at += run;
+        if (from > to) {
+            continue;
+        }
+        int ux = (a[2] > a[0]) - (a[2] < a[0]);
+        int uy = (a[3] > a[1]) - (a[3] < a[1]);
+        long lo = from - (at - run), hi = to - (at - run);
+        int c[4] = {a[0] + ux * lo, a[1] + uy * lo, a[0] + ux * hi,
+                    a[1] + uy * hi};
+        for (int j = 0; j < m; ++j) {
+            int b[4] = {cap->outline_x[j], cap->outline_y[j],
+                        cap->outline_x[(j + 1) % m],
+                        cap->outline_y[(j + 1) % m]};
+            if (segment_gap(c, b) < (TRAIL_WIDTH / 2 + 1)
+                * (TRAIL_WIDTH / 2 + 1)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static int segment_gap(const int a[4], const int b[4])
+{
+    int ax1 = a[0] < a[2] ? a[0] : a[2], ax2 = a[0] < a[2] ? a[2] : a[0];
+    int ay1 = a[1] < a[3] ? a[1] : a[3], ay2 = a[1] < a[3] ? a[3] : a[1];
+    int bx1 = b[0] < b[2] ? b[0] : b[2], bx2 = b[0] < b[2] ? b[2] : b[0];
+    int by1 = b[1] < b[3] ? b[1] : b[3], by2 = b[1] < b[3] ? b[3] : b[1];
+    int dx = bx1 > ax2 ? bx1 - ax2 : ax1 > bx2 ? ax1 - bx2 : 0;
+    int dy = by1 > ay2 ? by1 - ay2 : ay1 > by2 ? ay1 - by2 : 0;
+
+    return dx * dx + dy * dy;
+}
+
+static long shoelace(const int16_t *x, const int16_t *y, int n)
+{
+    long sum = 0;
+
+    for (int i = 0, j = n - 1; i < n; j = i++) {
+        sum += (long)x[j] * y[i] - (long)x[i] * y[j];
+    }
+
+    return sum;
+}
+
+static bool point_in_polygon(const int16_t *x, const int16_t *y, int n,
+                             int px, int py)
+{
+    bool inside = false;
+
+    // Crossings of a ray to the right, the point lies on no edge.
+    for (int i = 0, j = n - 1; i < n; j = i++) {
+        long xi = 2 * x[i], yi = 2 * y[i], xj = 2 * x[j], yj = 2 * y[j];
+        if ((yi > py) != (yj > py)
+            && ((px - xi) * (yj - yi) < (py - yi) * (xj - xi)) == (yj > yi)) {
+            inside = !inside;
+        }
+    }
+
+    return inside;
+}
+
+static void touch_column(qix_state_t *state, int x)
+{
+    state->regions.dirty[x] = true;
+    state->regions.stale = true;
+}
+
+static bool refresh_regions(qix_state_t *state)
+{
+    qix_regions_t *regions = &state->regions;
+
+    if (!regions->stale) {
+        return !regions->overflow;
+    }
+
+    regions->overflow = false;
+    for (int x = 0; x < SCREEN_WIDTH; ++x) {
+        if (regions->dirty[x]) {
+            scan_column(state, x);
+        }
+        regions->overflow = regions->overflow
+            || regions->count[x] > QIX_MAX_COLUMN_SPANS;
+    }
+    regions->stale = false;
+    if (regions->overflow) {
+        return false;
+    }
+
+    for (int x = 0; x < SCREEN_WIDTH; ++x) {
+        for (int i = 0; i < regions->count[x]; ++i) {
+            regions->parent[x * QIX_MAX_COLUMN_SPANS + i] =
+                x * QIX_MAX_COLUMN_SPANS + i;
+        }
+    }
+
+    // Both columns are sorted, so touching spans are met in one sweep.
+    for (int x = 0; x + 1 < SCREEN_WIDTH; ++x) {
+        int i = 0, j = 0;
+        while (i < regions->count[x] && j < regions->count[x + 1]) {
+            if (regions->y1[x][i] <= regions->y2[x + 1][j]
+                && regions->y1[x + 1][j] <= regions->y2[x][i]) {
+                join_regions(regions, x * QIX_MAX_COLUMN_SPANS + i,
+                             (x + 1) * QIX_MAX_COLUMN_SPANS + j);
+            }
+            if (regions->y2[x][i] < regions->y2[x + 1][j]) {
+                ++i;
+            } else {
+                ++j;
+            }
+        }
+    }
+
+    for (int x = 0; x < SCREEN_WIDTH; ++x) {
+        for (int i = 0; i < regions->count[x]; ++i) {
+            regions->area[x * QIX_MAX_COLUMN_SPANS + i] = 0;
+        }
+    }
+    for (int x = 0; x < SCREEN_WIDTH; ++x) {
+        for (int i = 0; i < regions->count[x]; ++i) {
+            int r = find_region(regions, x * QIX_MAX_COLUMN_SPANS + i);
+            regions->area[r] += regions->y2[x][i] - regions->y1[x][i] + 1;
+        }
+    }
+
+    return true;
+}
+
+static void scan_column(qix_state_t *state, int x)
+{
+    qix_regions_t *regions = &state->regions;
+    const rgb565_t *column = state->background[x];
+    int n = 0;
+
+    for (int y = 0; y < SCREEN_HEIGHT; ++y) {
+        if (column[y] != BACKGROUND_COLOR) {
+            continue;
+        }
+
+        int first = y;
+        while (y + 1 < SCREEN_HEIGHT && column[y + 1] == BACKGROUND_COLOR) {
+            ++y;
+        }
+
+        // Spans beyond the capacity are only counted.
+        if (n < QIX_MAX_COLUMN_SPANS) {
+            regions->y1[x][n] = first;
+            regions->y2[x][n] = y;
+        }
+        ++n;
+    }
+
+    regions->count[x] = n;
+    regions->dirty[x] = false;
+}
+
+static int find_region(qix_regions_t *regions, int span)
+{
+    while (regions->parent[span] != span) {
+        regions->parent[span] = regions->parent[regions->parent[span]];
+        span = regions->parent[span];
+    }
+
+    return span;
+}
+
+static void join_regions(qix_regions_t *regions, int a, int b)
+{
+    a = find_region(regions, a);
+    b = find_region(regions, b);
+
+    if (a < b) {
+        regions->parent[b] = a;
+    } else if (b < a) {
+        regions->parent[a] = b;
+    }
+}
+
+static int region_at(qix_regions_t *regions, int x, int y)
+{
+    if (!in_bounds(x, y)) {
+        return -1;
+    }
+
+    for (int i = 0; i < regions->count[x]; ++i) {
+        if (y >= regions->y1[x][i] && y <= regions->y2[x][i]) {
+            return find_region(regions, x * QIX_MAX_COLUMN_SPANS + i);
+        }
+    }
+
+    return -1;
+}
+
+static void finish_capture(qix_state_t *state)
+{
+    qix_capture_t *cap = &state->capture;
+
+    cap->phase = QIX_CAPTURE_IDLE;
+    state->last_capture = cap->area[cap->chosen];
+    state->score += state->last_capture;
+    if (state->last_capture > 0) {
+        state->events |= QIX_EVENT_CAPTURE;
+    }
+}
+
+static bool start_worker(qix_state_t *state)
+{
+    qix_capture_t *cap = &state->capture;
+    qix_capture_worker_t *worker = &cap->worker;
+
+    if (!worker->ready) {
+        pthread_mutex_init(&worker->lock, NULL);
+        pthread_cond_init(&worker->wake, NULL);
+        pthread_cond_init(&worker->finished, NULL);
+        worker->quit = false;
+        worker->round = 0;
+        worker->done = 0;
+        if (pthread_create(&worker->thread, NULL, capture_worker_main,
+                           state) != 0) {
+            pthread_cond_destroy(&worker->finished);
+            pthread_cond_destroy(&worker->wake);
+            pthread_mutex_destroy(&worker->lock);
+            return false;
+        }
+        worker->ready = true;
+    }
+
+    cap->running = true;
+    cap->held.count = 0;
+
+    pthread_mutex_lock(&worker->lock);
+    __atomic_store_n(&worker->done, 0, __ATOMIC_RELAXED);
+    ++worker->round;
+    pthread_cond_signal(&worker->wake);
+    pthread_mutex_unlock(&worker->lock);
+
+    return true;
+}
+
+static void wait_worker(qix_state_t *state)
+{
+    qix_capture_worker_t *worker = &state->capture.worker;
+
+    pthread_mutex_lock(&worker->lock);
+    while (!worker->done) {
+        pthread_cond_wait(&worker->finished, &worker->lock);
+    }
+    pthread_mutex_unlock(&worker->lock);
+}
+
+static void stop_worker(qix_state_t *state)
+{
+    qix_capture_worker_t *worker = &state->capture.worker;
+
+    if (!worker->ready) {
+        return;
+    }
+
+    pthread_mutex_lock(&worker->lock);
+    worker->quit = true;
+    pthread_cond_signal(&worker->wake);
+    pthread_mutex_unlock(&worker->lock);
+    pthread_join(worker->thread, NULL);
+
+    pthread_cond_destroy(&worker->finished);
+    pthread_cond_destroy(&worker->wake);
+    pthread_mutex_destroy(&worker->lock);
+    worker->ready = false;
+}
+
+static void *capture_worker_main(void *arg)
+{
+    qix_state_t *state = arg;
+    qix_capture_worker_t *worker = &state->capture.worker;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&worker->lock);
+    for (;;) {
+        while (!worker->quit && worker->round == seen) {
+            pthread_cond_wait(&worker->wake, &worker->lock);
+        }
+        if (worker->quit) {
+            break;
+        }
+
+        seen = worker->round;
+        pthread_mutex_unlock(&worker->lock);
+        run_capture(state);
+        pthread_mutex_lock(&worker->lock);
+        __atomic_store_n(&worker->done, 1, __ATOMIC_RELEASE);
+        pthread_cond_signal(&worker->finished);
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    return NULL;
+}
+
+static void run_capture(qix_state_t *state)
+{
+    qix_capture_t *cap = &state->capture;
+
+    if (!choose_by_outline(state) && !choose_by_regions(state)) {
+        measure_sides(state);
+    }
+    while (cap->phase == QIX_CAPTURE_MEASURE) {
+        measure(state, MEASURE_CHUNK_PX);
+    }
+
+    // The color is kept, the queue is left holding every span of the area.
+    search(state, 0, INT_MAX, BACKGROUND_COLOR, cap->fill_mark, MARK_FILLED,
+           BACKGROUND_COLOR);
+}
+
+static void commit_capture(qix_state_t *state)
+{
+    qix_capture_t *cap = &state->capture;
+    const qix_span_queue_t *queue = &cap->queues[0];
+
+    wait_worker(state);
+    cap->running = false;
+
+    qix_rect_t box = {SCREEN_WIDTH, SCREEN_HEIGHT, 0, 0};
+    for (int i = 0; i < queue->tail; ++i) {
+        uint32_t span = *queue_slot(cap, 0, i);
+        int x = span >> SPAN_X_SHIFT;
+        int y1 = span >> SPAN_Y_SHIFT & SPAN_Y_MASK, y2 = span & SPAN_Y_MASK;
+        box.x1 = x < box.x1 ? x : box.x1;
+        box.y1 = y1 < box.y1 ? y1 : box.y1;
+        box.x2 = x + 1 > box.x2 ? x + 1 : box.x2;
+        box.y2 = y2 + 1 > box.y2 ? y2 + 1 : box.y2;
+    }
+
+    // Free nodes within the area are filled whole, the spans fill the rest
+    // tile by tile.
+    fill_free_nodes(state, box, QIX_QUAD_LEVELS, 0, 0);
+    for (int i = 0; i < queue->tail; ++i) {
+        uint32_t span = *queue_slot(cap, 0, i);
+        int x = span >> SPAN_X_SHIFT;
+        int y1 = span >> SPAN_Y_SHIFT & SPAN_Y_MASK, y2 = span & SPAN_Y_MASK;
+        for (int ty = y1 / QIX_TILE_SIZE; ty <= y2 / QIX_TILE_SIZE; ++ty) {
+            int tile = ty * QIX_TILES_X + x / QIX_TILE_SIZE;
+            int from = ty * QIX_TILE_SIZE > y1 ? ty * QIX_TILE_SIZE : y1;
+            int to = (ty + 1) * QIX_TILE_SIZE <= y2 ? (ty + 1) * QIX_TILE_SIZE
+                : y2 + 1;
+            if (qix_tile_kind(state, tile) != QIX_TILE_FILLED) {
+                set_cells(state, x, from, to - from, BACKGROUND_COLOR,
+                          FILL_COLOR);
+            }
+        }
+    }
+
+    if (cap->estimated) {
+        cap->area[cap->chosen] = queue->pixels;
+    }
+    if (cap->repaint_trail) {
+        cap->phase = QIX_CAPTURE_REPAINT;
+        cap->repaint_segment = 0;
+    } else {
+        finish_capture(state);
+    }
+}
+
+static void fill_free_nodes(qix_state_t *state, qix_rect_t box, int level,
+                            int nx, int ny)
+{
+    qix_rect_t node = quad_rect(level, nx, ny);
+    if (node.x1 >= box.x2 || node.x2 <= box.x1 || node.y1 >= box.y2
+        || node.y2 <= box.y1) {
+        return;
+    }
+
+    // A free node is connected, it is either wholly in the area or not.
+    qix_tile_kind_t kind = qix_quad_kind(state, level, nx, ny);
+    if (kind == QIX_TILE_EMPTY) {
+        if (rect_marked(&state->capture, node)) {
+            fill_node(state, level, nx, ny);
+        }
+        return;
+    } else if (kind != QIX_TILE_MIXED || level == 0) {
+        return;
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        fill_free_nodes(state, box, level - 1, 2 * nx + i % 2,
+                        2 * ny + i / 2);
+    }
+}
+
+static bool rect_marked(const qix_capture_t *cap, qix_rect_t rect)
+{
+    for (int x = rect.x1; x < rect.x2; ++x) {
+        for (int y = rect.y1; y < rect.y2; ++y) {
+            if (cap->mark[x][y] != MARK_FILLED) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static void fill_node(qix_state_t *state, int level, int nx, int ny)
+{
+    qix_tiles_t *tiles = &state->tiles;
+    qix_quadtree_t *tree = &state->quadtree;
+    qix_rect_t node = quad_rect(level, nx, ny);
+    int h = node.y2 - node.y1;
+    int area = (node.x2 - node.x1) * h;
+
+    for (int x = node.x1; x < node.x2; ++x) {
+        fb_fill(&state->background[x][node.y1], h, h, 1, FILL_COLOR);
+        mirror_cells(state, x, node.y1, h, FILL_COLOR);
+        touch_column(state, x);
+    }
+
+    for (int ty = node.y1 / QIX_TILE_SIZE; ty * QIX_TILE_SIZE < node.y2;
+         ++ty) {
+        for (int tx = node.x1 / QIX_TILE_SIZE; tx * QIX_TILE_SIZE < node.x2;
+             ++tx) {
+            int tile = ty * QIX_TILES_X + tx;
+            tiles->filled[tile] += tiles->empty[tile];
+            tiles->empty[tile] = 0;
+            tiles->dirty[tile] = 1;
+        }
+    }
+
+    // Nodes below and the node itself hold background only.
+    for (int l = 1; l <= level; ++l) {
+        int shift = level - l;
+        for (int cy = ny << shift; cy < (ny + 1) << shift; ++cy) {
+            for (int cx = nx << shift; cx < (nx + 1) << shift; ++cx) {
+                int i = quad_node(l, cx, cy);
+                tree->filled[i] += tree->empty[i];
+                tree->empty[i] = 0;
+            }
+        }
+    }
+    for (int l = level + 1; l <= QIX_QUAD_LEVELS; ++l) {
+        int i = quad_node(l, nx >> (l - level), ny >> (l - level));
+        tree->empty[i] -= area;
+        tree->filled[i] += area;
+    }
+
+    for (int gx = node.x1 / QIX_GRID_CELL; gx * QIX_GRID_CELL < node.x2;
+         ++gx) {
+        for (int gy = node.y1 / QIX_GRID_CELL; gy * QIX_GRID_CELL < node.y2;
+             ++gy) {
+            state->grid.flags[grid_index(gx * QIX_GRID_CELL,
+                                         gy * QIX_GRID_CELL)] |=
+                QIX_GRID_FILL;
+        }
+    }
+}
+
+static void paint_held_trail(qix_state_t *state)
+{
+    qix_trail_index_t *held = &state->capture.held;
+
+    // Pixels of the held trail captured meanwhile stay filled.
+    for (int s = 0; s < held->count; ++s) {
+        qix_rect_t rect = held->segments[s];
+        paint_trail(state, rect.x1, rect.y1, rect.x2, rect.y2);
+    }
+    held->count = 0;
+}
+
+static bool trail_on_background(const qix_state_t *state)
+{
+    const entity_t *player = &state->player;
+    int midx = player->xx + ((ENTITY_WIDTH - TRAIL_WIDTH + 1) / 2);
+    int midy = player->yy + ((ENTITY_HEIGHT - TRAIL_WIDTH + 1) / 2);
+
+    for (int y = midy; y < midy + TRAIL_WIDTH; ++y) {
+        for (int x = midx; x < midx + TRAIL_WIDTH; ++x) {
+            if (state->background[x][y] == BACKGROUND_COLOR) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,564 @@
+/// \file qix_core.h
+/// Simulation core of qix. The whole state of one game lives in
+/// qix_state_t, so any number of games can be simulated side by side.
+/// Nothing in here touches peripherals, the screen buffer or globals;
+/// rendering and LEDs are left to the caller (see game_logic.c).
+///
+/// A state may own threads: the worker of captures run with async_capture
+/// and the helpers of fills split across fill_threads, together with their
+/// mutexes and condition variables. They are started by the first capture
+/// needing them and live in the state until qix_release() stops them. A
+/// state therefore has to be zeroed before its first initialization, like
+/// a static one or one from calloc(); initializing it again stops the
+/// threads of the game before, and qix_release() has to be called before
+/// it is freed. One state must not be used by two threads at once.
+
+#ifndef QIX_CORE_H_INCLUDED
+#define QIX_CORE_H_INCLUDED
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "image.h"
+#include "mapping.h"
+#include "territory.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define RED 0xF2EA
+#define GREEN 0x8D8C
+#define BLUE 0x1B12
+#define TRAIL_COLOR 0xE79A
+#define BORDER_COLOR 0xF567
+#define PLAYER_COLOR 0xF75B
+#define QIX_COLOR 0xF2EA
+#define BACKGROUND_COLOR 0x00E4
+#define FILL_COLOR 0xFFFF
+#define PSEUDO_COLOR 0xA26A
+
+#define QIX_TICK_HZ 120 ///< Simulation steps per second, speeds and counters
+                        /// below are per step.
+#define QIX_FP_SHIFT 8 ///< Fraction bits of fixed-point qix positions and
+                       /// speeds.
+#define QIX_FP_ONE (1 << QIX_FP_SHIFT) ///< One pixel in fixed point.
+#define QIX_DEFAULT_SPEED 2 ///< In pixels, see qix_params_t::qix_speed.
+#define PLAYER_DEFAULT_SPEED 1
+#define PLAYER_DEFAULT_HP 4
+#define NEXT_ACTION_TRIGGER 200
+
+#define NQIXES 3 ///< Default number of qixes.
+#define QIX_MAX_QIXES 512 ///< Capacity of the qix pool.
+#define ENTITY_WIDTH 10
+#define ENTITY_HEIGHT 10
+
+#define TRAIL_WIDTH 4
+#define BORDER_WIDTH 10
+#define BORDER_HEIGHT 10
+#define QIX_ARENA_SIZE ((SCREEN_WIDTH - 2 * BORDER_WIDTH) \
+                        * (SCREEN_HEIGHT - 2 * BORDER_HEIGHT)) ///< Number of
+                                             /// pixels which can be captured.
+
+#define QIX_GRID_CELL 32 ///< Size of a spatial hash cell in pixels.
+#define QIX_GRID_WIDTH (SCREEN_WIDTH / QIX_GRID_CELL)
+#define QIX_GRID_HEIGHT (SCREEN_HEIGHT / QIX_GRID_CELL)
+#define QIX_GRID_SIZE (QIX_GRID_WIDTH * QIX_GRID_HEIGHT)
+
+#define QIX_TILE_SIZE 16 ///< Size of a tile of the tile summary in pixels.
+#define QIX_TILES_X (SCREEN_WIDTH / QIX_TILE_SIZE)
+#define QIX_TILES_Y (SCREEN_HEIGHT / QIX_TILE_SIZE)
+#define QIX_TILES (QIX_TILES_X * QIX_TILES_Y)
+
+#define QIX_QUAD_SIDE 32 ///< Tiles on a side of the quadtree, a power of two
+                         /// not less than QIX_TILES_X and QIX_TILES_Y.
+#define QIX_QUAD_LEVELS 5 ///< Levels of the quadtree above the tiles.
+#define QIX_QUAD_NODES ((QIX_QUAD_SIDE * QIX_QUAD_SIDE - 1) / 3)
+
+#define QIX_MAX_COLUMN_SPANS 32 ///< Free spans of a column the region map
+                                /// holds.
+#define QIX_MAX_TRAIL_SEGMENTS 1024 ///< Capacity of the trail index.
+#define QIX_MAX_PATH_VERTICES 256 ///< Corners of the trail path.
+#define QIX_MAX_OUTLINE_VERTICES 2048 ///< Corners of the traced outline of
+                                      /// the free area.
+#define QIX_MAX_FILL_THREADS 2 ///< Threads a capture fill can be split
+                               /// across, the cores of the Zynq.
+#define QIX_PARALLEL_FILL_PX 16384 ///< Least pixels of a fill worth starting
+                                   /// more threads for.
+#define QIX_FILL_STACK_SPANS (SCREEN_WIDTH * SCREEN_HEIGHT \
+                              / QIX_MAX_FILL_THREADS) ///< Capacity of the
+                                                      /// span stack of one
+                                                      /// fill thread.
+
+/// Structure for representing the player.
+typedef struct {
+    bool invul; ///< True if the entity is invincible, false otherwise.
+    int hit_anim_counter; ///< Animation counter.
+    int next_action_counter; ///< Next action counter
+                             /// (used for changing the direction of qixes).
+    int xx; ///< X-coordinate of the upper left corner of the entity.
+    int yy; ///< Y-coordinate of the upper left corner of the entity.
+    int direction; ///< Current direction of the entity.
+    int speed; ///< Speed in pixels of the entity.
+    int HP; ///< Current amount of HP of the entity.
+    rgb565_t color; ///< Color of the entity.
+} entity_t;
+
+/// Tunable constants of the game. Defaults come from the macros above.
+typedef struct {
+    int qix_speed; ///< Speed of qixes in 1/QIX_FP_ONE pixels per step.
+    int player_speed; ///< Speed of the player in pixels per step.
+    int player_hp; ///< HP of the player at the start of the game.
+    int next_action_trigger; ///< Number of steps after which qixes may
+                             /// change their direction.
+    int nqixes; ///< Number of qixes, at most QIX_MAX_QIXES.
+    int capture_step_px; ///< Pixels of a capture processed by every step,
+                         /// 0 to finish a capture in the step starting it.
+    int fill_threads; ///< Threads filling large captures, 1 to
+                      /// QIX_MAX_FILL_THREADS; the result does not depend
+                      /// on it.
+    bool async_capture; ///< True to run captures on a worker thread, see
+                        /// qix_capture_commit().
+    bool rle_territory; ///< True to keep the arena run-length encoded as
+                        /// well and read collisions and tiles from there.
+} qix_params_t;
+
+/// Pool of qixes stored as structure of arrays, so that the per-step loops
+/// over hundreds of qixes touch only the fields they need. Qixes move in
+/// fixed point, a qix lies at xx + subx / QIX_FP_ONE, so their speeds need
+/// not be whole pixels; the rest of the game sees whole pixels.
+typedef struct {
+    int count; ///< Number of qixes in the pool.
+    int xx[QIX_MAX_QIXES]; ///< X-coordinates of the upper left corners.
+    int yy[QIX_MAX_QIXES]; ///< Y-coordinates of the upper left corners.
+    int direction[QIX_MAX_QIXES]; ///< Current directions.
+    int subx[QIX_MAX_QIXES]; ///< Fractions of the x-coordinates in
+                             /// 1/QIX_FP_ONE pixels.
+    int suby[QIX_MAX_QIXES]; ///< Fractions of the y-coordinates in
+                             /// 1/QIX_FP_ONE pixels.
+    int speed[QIX_MAX_QIXES]; ///< Speeds in 1/QIX_FP_ONE pixels per step.
+    int next_action_counter[QIX_MAX_QIXES]; ///< Counters until the next
+                                            /// change of direction.
+    int hit_anim_counter[QIX_MAX_QIXES]; ///< Invincibility counters.
+    bool invul[QIX_MAX_QIXES]; ///< True if the qix is invincible.
+    rgb565_t color[QIX_MAX_QIXES]; ///< Colors of the qixes.
+} qix_pool_t;
+
+/// Flags of a spatial hash cell telling which colors may be in it.
+typedef enum qix_grid_flag_t {
+    QIX_GRID_TRAIL = 1 << 0, ///< Cell may contain trail.
+    QIX_GRID_FILL = 1 << 1 ///< Cell may contain filled area.
+} qix_grid_flag_t;
+
+/// Uniform grid over the arena. Qixes are bucketed by their upper left
+/// corner each step; the flags are kept up to date on every write into
+/// the background, so queries can skip cells without trail or fill.
+typedef struct {
+    uint16_t start[QIX_GRID_SIZE + 1]; ///< Qixes of cell c are
+                                       /// items[start[c]..start[c + 1]).
+    uint16_t items[QIX_MAX_QIXES]; ///< Indices of qixes sorted by cell.
+    uint8_t flags[QIX_GRID_SIZE]; ///< qix_grid_flag_t flags of every cell.
+} qix_grid_t;
+
+/// Content of a tile of the tile summary.
+typedef enum qix_tile_kind_t {
+    QIX_TILE_EMPTY, ///< Background only.
+    QIX_TILE_FILLED, ///< Filled area only.
+    QIX_TILE_BORDER, ///< Border only.
+    QIX_TILE_MIXED ///< Anything else, e.g. with trail or an edge of a fill.
+} qix_tile_kind_t;
+
+/// Summary of the arena by tiles of QIX_TILE_SIZE pixels, tile t covers
+/// columns from t % QIX_TILES_X * QIX_TILE_SIZE and rows from
+/// t / QIX_TILES_X * QIX_TILE_SIZE. The counts are kept up to date on every
+/// write into the background, so uniform tiles can be told at once and
+/// processed in bulk.
+typedef struct {
+    uint16_t empty[QIX_TILES]; ///< Number of background pixels.
+    uint16_t filled[QIX_TILES]; ///< Number of filled pixels.
+    uint16_t border[QIX_TILES]; ///< Number of border pixels.
+    uint8_t dirty[QIX_TILES]; ///< Non-zero if the tile has been written;
+                              /// set by the core, cleared by the renderer.
+} qix_tiles_t;
+
+/// Quadtree over the tile summary. A node of level l >= 1 covers
+/// QIX_TILE_SIZE << l pixels on a side, its children are the four nodes of
+/// level l - 1 within it and level 0 are the tiles themselves. The side of
+/// the tree is rounded up to a power of two, nodes past the arena count
+/// only the pixels within it. The counts are kept up to date together with
+/// the tiles, so a region of one kind is told at its largest node; a
+/// committed capture fills its free nodes whole, and the collision checks
+/// of entities ask the tree before reading pixels.
+typedef struct {
+    int32_t empty[QIX_QUAD_NODES]; ///< Number of background pixels.
+    int32_t filled[QIX_QUAD_NODES]; ///< Number of filled pixels.
+    int32_t border[QIX_QUAD_NODES]; ///< Number of border pixels.
+} qix_quadtree_t;
+
+/// Rectangle of pixels [x1, x2) x [y1, y2).
+typedef struct {
+    int16_t x1; ///< First column.
+    int16_t y1; ///< First row.
+    int16_t x2; ///< Column after the last one.
+    int16_t y2; ///< Row after the last one.
+} qix_rect_t;
+
+/// Rectangles the trail has been painted into, in the order it was laid,
+/// so the trail can be repainted without scanning the whole arena. Every
+/// trail pixel of the arena lies in one of them.
+typedef struct {
+    int count; ///< Number of segments.
+    qix_rect_t segments[QIX_MAX_TRAIL_SEGMENTS]; ///< Straight runs of the
+                                                 /// trail; once full, the
+                                                 /// last one grows to cover
+                                                 /// the rest.
+} qix_trail_index_t;
+
+/// Path of the trail as the corners of the line through the centers of the
+/// player, on the lattice of pixel corners: pixel (x, y) lies between the
+/// points (x, y) and (x + 1, y + 1). The trail reaches TRAIL_WIDTH / 2
+/// pixels to either side of it.
+typedef struct {
+    int count; ///< Number of corners.
+    int16_t x[QIX_MAX_PATH_VERTICES]; ///< X-coordinates of the corners.
+    int16_t y[QIX_MAX_PATH_VERTICES]; ///< Y-coordinates of the corners.
+    bool broken; ///< True if the path does not describe the trail, e.g.
+                 /// after a gap, a step back or running out of corners.
+} qix_trail_path_t;
+
+/// Free (background) pixels of the arena as vertical spans of every
+/// column, joined into connected regions by union-find over the spans that
+/// touch in neighbouring columns. Columns written into are rescanned and
+/// the regions relabelled on the next query, in time linear in the number
+/// of spans rather than pixels.
+typedef struct {
+    int16_t count[SCREEN_WIDTH]; ///< Number of free spans of every column.
+    int16_t y1[SCREEN_WIDTH][QIX_MAX_COLUMN_SPANS]; ///< First rows.
+    int16_t y2[SCREEN_WIDTH][QIX_MAX_COLUMN_SPANS]; ///< Last rows.
+    uint16_t parent[SCREEN_WIDTH * QIX_MAX_COLUMN_SPANS]; ///< Union-find
+                                                          /// parents of the
+                                                          /// spans, span i
+                                                          /// of column x is
+                                                          /// x * capacity
+                                                          /// + i.
+    int area[SCREEN_WIDTH * QIX_MAX_COLUMN_SPANS]; ///< Area of the region
+                                                   /// of every root span.
+    bool dirty[SCREEN_WIDTH]; ///< True if the column has been written
+                              /// since it was scanned.
+    bool stale; ///< True if the regions have to be relabelled.
+    bool overflow; ///< True if a column has more spans than fit, the
+                   /// regions are then not known.
+} qix_regions_t;
+
+/// Stage of a capture, see qix_capture_advance().
+typedef enum qix_capture_phase_t {
+    QIX_CAPTURE_IDLE, ///< No capture in progress.
+    QIX_CAPTURE_MEASURE, ///< Measuring the areas on both sides of the trail.
+    QIX_CAPTURE_FILL, ///< Filling the chosen area.
+    QIX_CAPTURE_REPAINT ///< Turning the trail into fill.
+} qix_capture_phase_t;
+
+/// Queue of spans of one capture search.
+typedef struct {
+    int head; ///< Next span to be taken.
+    int tail; ///< Next free place.
+    int pixels; ///< Pixels queued so far.
+    bool qix; ///< True if a queued span touches a qix.
+} qix_span_queue_t;
+
+/// Helper threads of parallel fills. They are started by the first fill
+/// split across threads and then wait on a condition variable for the
+/// next one, until qix_release() stops them.
+typedef struct {
+    bool ready; ///< True once the lock and the conditions are initialized.
+    bool quit; ///< True once the helpers have to exit.
+    int count; ///< Helper threads started.
+    int named; ///< Helpers that have taken their index, 1 to count.
+    pthread_t threads[QIX_MAX_FILL_THREADS - 1]; ///< Helper threads.
+    pthread_mutex_t lock; ///< Guards the pool, the fill and its stacks.
+    pthread_cond_t wake; ///< Signalled when a fill starts or on shutdown.
+    pthread_cond_t more; ///< Signalled when entries are pushed to the
+                         /// stacks or a thread leaves the fill.
+    pthread_cond_t left; ///< Signalled when the last helper leaves a fill.
+    void *job; ///< Fill in progress, NULL between fills.
+    unsigned long round; ///< Number of fills started.
+    int working; ///< Helpers still in the fill in progress.
+} qix_fill_pool_t;
+
+/// Worker thread of captures running with async_capture. It is started by
+/// the first such capture and then waits on a condition variable for the
+/// next one, until qix_release() stops it.
+typedef struct {
+    bool ready; ///< True once the thread, the lock and the conditions are
+                /// set up.
+    bool quit; ///< True once the worker has to exit.
+    pthread_t thread; ///< Worker thread.
+    pthread_mutex_t lock; ///< Guards the worker.
+    pthread_cond_t wake; ///< Signalled when a capture starts or on shutdown.
+    pthread_cond_t finished; ///< Signalled when a capture is done.
+    unsigned long round; ///< Number of captures handed over.
+    int done; ///< Non-zero once the capture handed over last is done,
+              /// also read atomically without the lock.
+} qix_capture_worker_t;
+
+/// Capture split into bounded pieces of work. The side without a qix is
+/// filled, or the smaller one if both or neither have one. The side is
+/// first chosen from the path of the trail and the outline of the free
+/// area around it: the outline is traced along its edge and both sides are
+/// the polygons the path cuts it into, their areas told by the shoelace
+/// formula in time linear in their corners. Areas closer than the error of
+/// this estimate, and trails it cannot describe, are left to the exact
+/// choices: the regions on both sides of the trail are looked up in the
+/// region map; when it is not known, both sides are searched in turns,
+/// marking their pixels, until the choice is certain. The background
+/// changes only once the chosen area is being filled, column span by
+/// column span in breadth-first order from the trail outwards. Large fills
+/// are split across fill_threads threads, each owning every other stripe
+/// of QIX_TILE_SIZE columns.
+///
+/// With async_capture, the whole capture runs on a worker thread. The game
+/// does not write the background until the capture is committed, so the
+/// worker sees it frozen; it only marks and queues the chosen area, which
+/// is painted and scored at once by the commit. Trail laid meanwhile is
+/// held and painted by the commit too, after the area.
+typedef struct {
+    qix_capture_phase_t phase; ///< Stage of the capture.
+    int seed_x[2]; ///< X-coordinates of the first pixels of both sides.
+    int seed_y[2]; ///< Y-coordinates of the first pixels of both sides.
+    int area[2]; ///< Measured areas of both sides.
+    bool estimated; ///< True if the areas are estimated from the outline;
+                    /// the area of the chosen side is counted by the fill.
+    qix_trail_path_t path; ///< Path of the trail being captured.
+    int outline_count; ///< Corners of the outline of the free area.
+    int16_t outline_x[QIX_MAX_OUTLINE_VERTICES]; ///< X-coordinates of the
+                                                 /// corners, clockwise.
+    int16_t outline_y[QIX_MAX_OUTLINE_VERTICES]; ///< Y-coordinates of the
+                                                 /// corners.
+    int side_count; ///< Corners of the polygon right of the path.
+    int16_t side_x[QIX_MAX_OUTLINE_VERTICES + QIX_MAX_PATH_VERTICES
+                   + 2]; ///< X-coordinates of the corners, the path first.
+    int16_t side_y[QIX_MAX_OUTLINE_VERTICES + QIX_MAX_PATH_VERTICES
+                   + 2]; ///< Y-coordinates of the corners.
+    int nqixes; ///< Number of qixes when the trail was closed.
+    int16_t qix_x[QIX_MAX_QIXES]; ///< X-coordinates of the qixes then.
+    int16_t qix_y[QIX_MAX_QIXES]; ///< Y-coordinates of the qixes then.
+    bool met; ///< True if the searches of both sides have met, the trail
+              /// has not split the area.
+    bool whole; ///< True if the area is measured as a whole after the
+                /// searches have met.
+    int chosen; ///< Side being filled.
+    uint8_t fill_mark; ///< Mark of the area being filled.
+    bool repaint_trail; ///< True if the trail becomes fill at the end.
+    int repaint_segment; ///< Next trail segment to be repainted.
+    qix_span_queue_t queues[2]; ///< Searches of both sides; filling uses
+                                /// the first one.
+    uint32_t queue[SCREEN_WIDTH * SCREEN_HEIGHT]; ///< Vertical spans of
+                                                  /// pixels, the first
+                                                  /// queue from the start,
+                                                  /// the second from the
+                                                  /// end.
+    uint8_t mark[SCREEN_WIDTH][SCREEN_HEIGHT]; ///< Side + 1 a pixel has been
+                                               /// measured in, 0 if none.
+    uint32_t stacks[QIX_MAX_FILL_THREADS][QIX_FILL_STACK_SPANS]; ///< Spans
+                                                                 /// of the
+                                                                 /// fill
+                                                                 /// threads.
+    qix_fill_pool_t helpers; ///< Helper threads of parallel fills.
+    qix_capture_worker_t worker; ///< Worker thread of async captures.
+    bool running; ///< True while the capture runs on the worker thread.
+    qix_trail_index_t held; ///< Trail laid while the capture runs on the
+                            /// worker thread, not painted yet.
+} qix_capture_t;
+
+/// Flags describing what happened during the last qix_step().
+typedef enum qix_event_t {
+    QIX_EVENT_NONE = 0, ///< Nothing noteworthy happened.
+    QIX_EVENT_CAPTURE = 1 << 0, ///< Player has captured an area.
+    QIX_EVENT_HIT = 1 << 1 ///< Player has lost HP.
+} qix_event_t;
+
+/// Status of the game after a step.
+typedef enum qix_status_t {
+    QIX_RUNNING, ///< Game goes on.
+    QIX_LOST, ///< Player has no HP left.
+    QIX_WON ///< Player has captured enough of the arena.
+} qix_status_t;
+
+/// Whole state of one game.
+typedef struct {
+    rgb565_t background[SCREEN_WIDTH][SCREEN_HEIGHT]; ///< Arena, one color
+                                                      /// per pixel.
+    territory_t territory; ///< Accessors the collisions and the renderer
+                           /// read the arena through, set over background
+                           /// or, with rle_territory, over rle.
+    rle_arena_t rle; ///< Run-length encoded copy of background kept with
+                     /// rle_territory; every write of the core goes to
+                     /// both, the capture kernels work on background.
+    qix_params_t params; ///< Tunable constants of this game.
+    entity_t player; ///< The player.
+    qix_pool_t qixes; ///< The qixes.
+    qix_grid_t grid; ///< Spatial hash of the qixes, trail and fill.
+    int score; ///< Number of captured pixels.
+    rgb565_t prev_color; ///< Color under the player before the last step.
+    uint32_t rng; ///< State of the random generator used by qixes.
+    unsigned int events; ///< qix_event_t flags of the last step.
+    int last_capture; ///< Number of pixels captured by the last capture.
+    unsigned long steps; ///< Number of steps simulated so far.
+    qix_capture_t capture; ///< Capture in progress.
+    qix_trail_index_t trail_segments; ///< Pixels of the trail not yet
+                                      /// turned into fill.
+    qix_trail_path_t trail_path; ///< Path of the trail laid since the last
+                                 /// capture started.
+    qix_regions_t regions; ///< Connected regions of free pixels.
+    qix_tiles_t tiles; ///< Summary of the arena by tiles.
+    qix_quadtree_t quadtree; ///< Quadtree over the tiles.
+} qix_state_t;
+
+/// Initializes the given state for a new game with default parameters.
+/// \param state State to be initialized, zeroed before its first
+/// initialization.
+/// \param seed Seed of the random generator used by qixes.
+void qix_init(qix_state_t *state, uint32_t seed);
+
+/// Initializes the given state for a new game with the given parameters.
+/// Threads of the game the state held before are stopped first, as by
+/// qix_release().
+/// \param state State to be initialized, zeroed before its first
+/// initialization.
+/// \param seed Seed of the random generator used by qixes.
+/// \param params Parameters of the game, NULL for defaults.
+void qix_init_with_params(qix_state_t *state, uint32_t seed,
+                          const qix_params_t *params);
+
+/// Fills the given parameters with defaults.
+/// \param params Parameters to be filled.
+void qix_default_params(qix_params_t *params);
+
+/// Advances the game by one step.
+/// \param state State of the game to be advanced.
+/// \param input Input for this step. Directions change the direction of the
+/// player, everything else is ignored.
+/// \return status of the game after the step
+qix_status_t qix_step(qix_state_t *state, input_t input);
+
+/// Get the status of the game without advancing it.
+/// \param state State of the game.
+/// \return status of the game
+qix_status_t qix_status(const qix_state_t *state);
+
+/// Check if a capture is in progress. Until it finishes, the trail counts as
+/// captured and the captured area is filled bit by bit, or at once when it
+/// runs on the worker thread.
+/// \param state State of the game.
+/// \return true if a capture is in progress, false otherwise
+bool qix_capture_pending(const qix_state_t *state);
+
+/// Advances the capture in progress. Every step advances it by
+/// capture_step_px of the parameters; callers with time to spare can call
+/// this in between. When the capture finishes, its area is added to the
+/// score, stored in last_capture and QIX_EVENT_CAPTURE is set. A capture
+/// running on the worker thread is waited for and committed whole.
+/// \param state State of the game.
+/// \param budget Maximal number of pixels to be processed.
+/// \return true if the capture has finished during this call, false
+/// otherwise
+bool qix_capture_advance(qix_state_t *state, int budget);
+
+/// Commits the capture running on the worker thread if the worker has
+/// finished, without waiting for it. Steps do not commit, so the game
+/// calls this once per frame and the captured area appears in one frame.
+/// \param state State of the game.
+/// \return true if a capture has been committed, false otherwise
+bool qix_capture_commit(qix_state_t *state);
+
+/// Waits for the worker thread of a capture in progress, drops the capture
+/// and stops the worker and the helper threads of parallel fills. The
+/// run-length encoded copy of the arena is freed, the territory is set
+/// back over background. Must be called before a state whose captures run
+/// on the worker, are filled by more than one thread or which keeps the
+/// copy is freed. The state can be initialized again.
+/// \param state State of the game.
+void qix_release(qix_state_t *state);
+
+/// Gets the area of the connected region of free pixels around the given
+/// pixel from the region map. Near constant time while the arena does not
+/// change, so it can be asked every frame, e.g. to preview a capture.
+/// \param state State of the game.
+/// \param x X-coordinate of the pixel.
+/// \param y Y-coordinate of the pixel.
+/// \return area of the region, 0 if the pixel is not free, -1 if the
+/// regions are not known or a capture runs on the worker thread
+int qix_region_area(qix_state_t *state, int x, int y);
+
+/// Get the kind of a tile from the tile summary.
+/// \param state State of the game.
+/// \param tile Index of the tile.
+/// \return kind of the tile
+qix_tile_kind_t qix_tile_kind(const qix_state_t *state, int tile);
+
+/// Get the color of every pixel of a uniform tile.
+/// \param kind Kind of the tile, not QIX_TILE_MIXED.
+/// \return color of the tile
+rgb565_t qix_tile_color(qix_tile_kind_t kind);
+
+/// Get the kind of a node of the quadtree over the tiles.
+/// \param state State of the game.
+/// \param level Level of the node, 0 for a tile up to QIX_QUAD_LEVELS for
+/// the root.
+/// \param nx Column of the node within its level.
+/// \param ny Row of the node within its level.
+/// \return kind of the pixels of the node within the arena, QIX_TILE_EMPTY
+/// for a node wholly past the arena
+qix_tile_kind_t qix_quad_kind(const qix_state_t *state, int level, int nx,
+                              int ny);
+
+/// Counts the pixels of a color within a rectangle. Background, fill and
+/// border are counted from the quadtree, visiting only the nodes on the
+/// edges of the rectangle, so e.g. whether a rectangle is wholly captured
+/// is told in logarithmic time; other colors are counted pixel by pixel.
+/// \param state State of the game.
+/// \param x X-coordinate of the rectangle.
+/// \param y Y-coordinate of the rectangle.
+/// \param w Width of the rectangle.
+/// \param h Height of the rectangle.
+/// \param color Color to be counted.
+/// \return number of pixels of the color within the rectangle clipped to
+/// the arena
+int qix_rect_count(const qix_state_t *state, int x, int y, int w, int h,
+                   rgb565_t color);
+
+/// Recounts the tile summary and its quadtree and marks every tile dirty,
+/// needed after the background has been written other than by the core
+/// (e.g. by a benchmark building an arena).
+/// \param state State of the game.
+void qix_refresh_tiles(qix_state_t *state);
+
+/// Counts the pixels of the given color connected to the given pixel.
+/// The background is left as it was. Kernel of a capture, exported for
+/// benchmarks; must not be called while a capture is in progress.
+/// \param state State of the game.
+/// \param x X-coordinate of the starting pixel.
+/// \param y Y-coordinate of the starting pixel.
+/// \param color Color of the area.
+/// \return number of pixels of the area, 0 if the starting pixel is not of
+/// the given color
+int qix_measure_area(qix_state_t *state, int x, int y, rgb565_t color);
+
+/// Fills the area of old_color connected to the given pixel with new_color.
+/// Kernel of a capture, exported for benchmarks; must not be called while
+/// a capture is in progress.
+/// \param state State of the game.
+/// \param x X-coordinate of the starting pixel.
+/// \param y Y-coordinate of the starting pixel.
+/// \param old_color Color of the area.
+/// \param new_color Color the area gets.
+void qix_fill_area(qix_state_t *state, int x, int y, rgb565_t old_color,
+                   rgb565_t new_color);
+
+/// Replaces every pixel of old_color in the arena with new_color. Kernel of
+/// a capture, exported for benchmarks.
+/// \param state State of the game.
+/// \param old_color Color to be replaced.
+/// \param new_color Color to replace with.
+void qix_repaint(qix_state_t *state, rgb565_t old_color, rgb565_t new_color);
+
+#endif // QIX_CORE_H_INCLUDED
@@ -0,0 +1,232 @@
+/// \file qixtop.c
+/// Live view of the statistics published by the running game, see stats.h.
+/// Rates and per-frame averages are computed from two consecutive snapshots.
+///
+/// Usage: qixtop [-i interval_ms] [-n count]
+/// where count stops after that many refreshes (default forever). When the
+/// output is not a terminal, one key=value line is printed per refresh.
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "stats.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_INTERVAL_MS 1000
+#define MAX_READ_TRIES 1000
+#define NSEC_PER_SEC 1000000000LL
+#define NS_PER_MS 1e6
+
+static const char *phase_names[QIX_STATS_NPHASES] = {
+    "input", "update", "compose", "sleep"
+};
+
+static const char *input_names[QIX_STATS_NINPUTS] = {
+    "none", "up", "down", "left", "right", "confirm", "back", "exit"
+};
+
+/// <------------ Start implementation functions declaration ------------>
+
+/// Maps the statistics of the game read-only.
+/// \return statistics, NULL if the game is not running or is incompatible
+static const qix_stats_t *map_stats();
+
+/// Copies a consistent snapshot of the statistics.
+/// \param shm Statistics shared with the game.
+/// \param snap Output, the snapshot.
+/// \return true on success, false if the game kept updating them
+static bool read_stats(const qix_stats_t *shm, qix_stats_t *snap);
+
+/// Prints the difference of two snapshots for a terminal.
+/// \param prev Older snapshot.
+/// \param cur Newer snapshot.
+static void print_screen(const qix_stats_t *prev, const qix_stats_t *cur);
+
+/// Prints the difference of two snapshots as one key=value line.
+/// \param prev Older snapshot.
+/// \param cur Newer snapshot.
+static void print_line(const qix_stats_t *prev, const qix_stats_t *cur);
+
+/// <------------ End implementation functions declaration ------------>
+
+int main(int argc, char *argv[])
+{
+    long interval_ms = DEFAULT_INTERVAL_MS;
+    long count = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "i:n:")) != -1) {
+        switch (opt) {
+        case 'i':
+            interval_ms = atol(optarg);
+            break;
+        case 'n':
+            count = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-i interval_ms] [-n count]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (interval_ms <= 0) {
+        interval_ms = DEFAULT_INTERVAL_MS;
+    }
+
+    const qix_stats_t *shm = map_stats();
+    if (!shm) {
+        return 1;
+    }
+
+    bool tty = isatty(STDOUT_FILENO);
+    struct timespec delay = {
+        .tv_sec = interval_ms / 1000,
+        .tv_nsec = interval_ms % 1000 * 1000000L
+    };
+
+    qix_stats_t prev, cur;
+    if (!read_stats(shm, &prev)) {
+        fprintf(stderr, "qixtop: statistics keep changing\n");
+        return 1;
+    }
+
+    for (long i = 0; count <= 0 || i < count; ++i) {
+        nanosleep(&delay, NULL);
+        if (!read_stats(shm, &cur)) {
+            continue;
+        }
+
+        if (tty) {
+            print_screen(&prev, &cur);
+        } else {
+            print_line(&prev, &cur);
+        }
+        fflush(stdout);
+        prev = cur;
+    }
+
+    return 0;
+}
+
+static const qix_stats_t *map_stats()
+{
+    int fd = shm_open(QIX_STATS_SHM, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "qixtop: %s not found, is the game running?\n",
+                QIX_STATS_SHM);
+        return NULL;
+    }
+
+    const qix_stats_t *shm = mmap(NULL, sizeof(qix_stats_t), PROT_READ,
+                                  MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        perror("qixtop: mmap");
+        return NULL;
+    }
+
+    if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != QIX_STATS_MAGIC
+        || shm->version != QIX_STATS_VERSION
+        || shm->size < sizeof(qix_stats_t)) {
+        fprintf(stderr, "qixtop: incompatible statistics (version %u, "
+                "expected %d)\n", shm->version, QIX_STATS_VERSION);
+        return NULL;
+    }
+
+    return shm;
+}
+
+static bool read_stats(const qix_stats_t *shm, qix_stats_t *snap)
+{
+    for (int i = 0; i < MAX_READ_TRIES; ++i) {
+        uint32_t seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+
+        memcpy(snap, shm, sizeof(qix_stats_t));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void print_screen(const qix_stats_t *prev, const qix_stats_t *cur)
+{
+    double secs = (double)(cur->updated_ns - prev->updated_ns) / NSEC_PER_SEC;
+    uint64_t frames = cur->frames - prev->frames;
+    if (secs <= 0) {
+        secs = 1;
+    }
+
+    // Clear the terminal and start from its upper left corner.
+    printf("\033[H\033[J");
+    printf("qixtop  %s  score %d  hp %d  qixes %d\n\n",
+           cur->in_game ? "in game" : "in menu", cur->score, cur->hp,
+           cur->nqixes);
+    printf("frames   %8.1f /s   pushed %8.1f /s   steps %8.1f /s\n",
+           frames / secs, (cur->frames_pushed - prev->frames_pushed) / secs,
+           (cur->steps - prev->steps) / secs);
+    printf("worst    %8.2f ms   lcd push %6.2f ms\n\n",
+           cur->max_frame_ns / NS_PER_MS, cur->lcd_push_ns / NS_PER_MS);
+
+    printf("phase        ms/frame\n");
+    for (int p = 0; p < QIX_STATS_NPHASES; ++p) {
+        uint64_t ns = cur->phase_ns[p] - prev->phase_ns[p];
+        printf("%-10s %10.3f\n", phase_names[p],
+               frames ? ns / NS_PER_MS / frames : 0.0);
+    }
+
+    printf("\ncaptures %8llu   pixels %10llu   last %.2f ms   max %.2f ms\n",
+           (unsigned long long)cur->captures,
+           (unsigned long long)cur->captured_px,
+           cur->last_capture_ns / NS_PER_MS, cur->max_capture_ns / NS_PER_MS);
+
+    printf("\ninputs/s");
+    for (int i = 1; i < QIX_STATS_NINPUTS; ++i) {
+        printf("  %s %.1f", input_names[i],
+               (cur->inputs[i] - prev->inputs[i]) / secs);
+    }
+    printf("\n\nrss %.1f MiB\n", cur->rss_bytes / (1024.0 * 1024.0));
+}
+
+static void print_line(const qix_stats_t *prev, const qix_stats_t *cur)
+{
+    double secs = (double)(cur->updated_ns - prev->updated_ns) / NSEC_PER_SEC;
+    uint64_t frames = cur->frames - prev->frames;
+    if (secs <= 0) {
+        secs = 1;
+    }
+
+    printf("in_game=%d fps=%.1f pushed_fps=%.1f steps_s=%.1f", cur->in_game,
+           frames / secs, (cur->frames_pushed - prev->frames_pushed) / secs,
+           (cur->steps - prev->steps) / secs);
+    for (int p = 0; p < QIX_STATS_NPHASES; ++p) {
+        uint64_t ns = cur->phase_ns[p] - prev->phase_ns[p];
+        printf(" %s_ms=%.3f", phase_names[p],
+               frames ? ns / NS_PER_MS / frames : 0.0);
+    }
+
+    uint64_t inputs = 0;
+    for (int i = 1; i < QIX_STATS_NINPUTS; ++i) {
+        inputs += cur->inputs[i] - prev->inputs[i];
+    }
+
+    printf(" worst_ms=%.2f lcd_push_ms=%.2f captures=%llu capture_ms=%.2f "
+           "inputs_s=%.1f rss_kib=%llu score=%d hp=%d\n",
+           cur->max_frame_ns / NS_PER_MS, cur->lcd_push_ns / NS_PER_MS,
+           (unsigned long long)cur->captures,
+           cur->last_capture_ns / NS_PER_MS, inputs / secs,
+           (unsigned long long)(cur->rss_bytes / 1024), cur->score, cur->hp);
+}
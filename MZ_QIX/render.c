@@ -0,0 +1,150 @@
+#include "render.h"
+
+#include <string.h>
+
+static uint8_t stale[QIX_TILES]; ///< Non-zero for tiles drawn over since
+                                 /// their background was last drawn.
+
+/// <------------ Start implementation functions declaration ------------>
+
+/// Buffers one tile of the background, in bulk if it is uniform.
+/// \param state State of the game.
+/// \param tile Index of the tile.
+static void draw_tile(const qix_state_t *state, int tile);
+
+/// Buffers one node of the quadtree over the tiles, a uniform one as a
+/// single rectangle.
+/// \param state State of the game.
+/// \param level Level of the node, 0 for a tile.
+/// \param nx Column of the node within its level.
+/// \param ny Row of the node within its level.
+static void draw_node(const qix_state_t *state, int level, int nx, int ny);
+
+/// Buffers the trail held while a capture runs on the worker thread, over
+/// the free pixels of its rectangles, which get redrawn by the next frame.
+/// \param state State of the game.
+static void draw_held_trail(const qix_state_t *state);
+
+/// Buffers the player and the qixes.
+/// \param state State of the game.
+static void draw_moving(const qix_state_t *state);
+
+/// <------------ End implementation functions declaration ------------>
+
+void draw_background(const qix_state_t *state)
+{
+    draw_node(state, QIX_QUAD_LEVELS, 0, 0);
+    memset(stale, 0, sizeof(stale));
+}
+
+void draw_entities(const qix_state_t *state)
+{
+    draw_background(state);
+    draw_held_trail(state);
+    draw_moving(state);
+}
+
+void draw_frame(qix_state_t *state)
+{
+    uint8_t *dirty = state->tiles.dirty;
+
+    for (int tile = 0; tile < QIX_TILES; ++tile) {
+        if (dirty[tile] || stale[tile]) {
+            draw_tile(state, tile);
+            dirty[tile] = 0;
+            stale[tile] = 0;
+        }
+    }
+    draw_held_trail(state);
+    draw_moving(state);
+}
+
+void render_invalidate(int x, int y, int w, int h)
+{
+    int x1 = x < 0 ? 0 : x / QIX_TILE_SIZE;
+    int y1 = y < 0 ? 0 : y / QIX_TILE_SIZE;
+    int x2 = x + w > SCREEN_WIDTH ? QIX_TILES_X
+        : (x + w + QIX_TILE_SIZE - 1) / QIX_TILE_SIZE;
+    int y2 = y + h > SCREEN_HEIGHT ? QIX_TILES_Y
+        : (y + h + QIX_TILE_SIZE - 1) / QIX_TILE_SIZE;
+
+    for (int ty = y1; ty < y2; ++ty) {
+        for (int tx = x1; tx < x2; ++tx) {
+            stale[ty * QIX_TILES_X + tx] = 1;
+        }
+    }
+}
+
+void redraw_entity(int x, int y, rgb565_t color)
+{
+    draw_rect(x, y, ENTITY_WIDTH, ENTITY_HEIGHT, color);
+    render_invalidate(x, y, ENTITY_WIDTH, ENTITY_HEIGHT);
+}
+
+static void draw_tile(const qix_state_t *state, int tile)
+{
+    int x0 = tile % QIX_TILES_X * QIX_TILE_SIZE;
+    int y0 = tile / QIX_TILES_X * QIX_TILE_SIZE;
+
+    qix_tile_kind_t kind = qix_tile_kind(state, tile);
+    if (kind != QIX_TILE_MIXED) {
+        draw_rect(x0, y0, QIX_TILE_SIZE, QIX_TILE_SIZE, qix_tile_color(kind));
+        return;
+    }
+
+    rgb565_t buffer[QIX_TILE_SIZE * QIX_TILE_SIZE];
+    int stride;
+    const rgb565_t *pixels = territory_block(&state->territory, x0, y0,
+                                             QIX_TILE_SIZE, QIX_TILE_SIZE,
+                                             buffer, &stride);
+    draw_columns(x0, y0, QIX_TILE_SIZE, QIX_TILE_SIZE, pixels, stride);
+}
+
+static void draw_node(const qix_state_t *state, int level, int nx, int ny)
+{
+    int size = QIX_TILE_SIZE << level;
+    if (nx * size >= SCREEN_WIDTH || ny * size >= SCREEN_HEIGHT) {
+        return;
+    } else if (level == 0) {
+        draw_tile(state, ny * QIX_TILES_X + nx);
+        return;
+    }
+
+    qix_tile_kind_t kind = qix_quad_kind(state, level, nx, ny);
+    if (kind != QIX_TILE_MIXED) {
+        draw_rect(nx * size, ny * size, size, size, qix_tile_color(kind));
+        return;
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        draw_node(state, level - 1, 2 * nx + i % 2, 2 * ny + i / 2);
+    }
+}
+
+static void draw_held_trail(const qix_state_t *state)
+{
+    const qix_trail_index_t *held = &state->capture.held;
+
+    for (int s = 0; s < held->count; ++s) {
+        qix_rect_t rect = held->segments[s];
+        for (int x = rect.x1; x < rect.x2; ++x) {
+            for (int y = rect.y1; y < rect.y2; ++y) {
+                if (territory_cell(&state->territory, x, y)
+                    == BACKGROUND_COLOR) {
+                    draw_pixel(x, y, TRAIL_COLOR);
+                }
+            }
+        }
+        render_invalidate(rect.x1, rect.y1, rect.x2 - rect.x1,
+                          rect.y2 - rect.y1);
+    }
+}
+
+static void draw_moving(const qix_state_t *state)
+{
+    redraw_entity(state->player.xx, state->player.yy, state->player.color);
+    for (int i = 0; i < state->qixes.count; ++i) {
+        redraw_entity(state->qixes.xx[i], state->qixes.yy[i],
+                      state->qixes.color[i]);
+    }
+}
@@ -0,0 +1,42 @@
+/// \file render.h
+/// Drawing of a game state into the screen buffer.
+
+#ifndef RENDER_H_INCLUDED
+#define RENDER_H_INCLUDED
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "qix_core.h"
+
+/// Buffers the background of the given game into the screen buffer.
+/// \param state State of the game.
+void draw_background(const qix_state_t *state);
+
+/// Buffers the background and all the entities (player, qixes) of the given
+/// game into the screen buffer.
+/// \param state State of the game.
+void draw_entities(const qix_state_t *state);
+
+/// Buffers the changes of the given game since the previous frame: tiles of
+/// the background written by the game or drawn over (by entities or
+/// render_invalidate()), then all the entities. Clears the dirty bits of the
+/// tile summary. The screen buffer has to hold the previous frame, e.g.
+/// drawn by draw_entities().
+/// \param state State of the game.
+void draw_frame(qix_state_t *state);
+
+/// Marks a rectangle of the screen to get its background redrawn by the
+/// next draw_frame(), for anything drawn over the game (e.g. text).
+/// \param x X-coordinate of the upper left corner.
+/// \param y Y-coordinate of the upper left corner.
+/// \param w Width of the rectangle.
+/// \param h Height of the rectangle.
+void render_invalidate(int x, int y, int w, int h);
+
+/// Buffers an entity into screen buffer.
+/// \param x X-coordinate of the upper left corner of the entity.
+/// \param y Y-coordinate of the upper left corner of the entity.
+/// \param color Color of the entity to be buffered.
+void redraw_entity(int x, int y, rgb565_t color);
+
+#endif // RENDER_H_INCLUDED
@@ -0,0 +1,321 @@
+#include "rle_arena.h"
+#include "qix_core.h"
+#include "fb.h"
+#include "span.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_CAPACITY 4 ///< Runs a column gets room for at least.
+
+/// Queue of column spans of a fill.
+typedef struct {
+    uint32_t *spans; ///< Queued spans.
+    int head; ///< Next span to be taken.
+    int tail; ///< Next free place.
+    int capacity; ///< Number of spans spans has room for.
+} span_queue_t;
+
+/// <------------ Start implementation functions declaration ------------>
+
+/// Makes room for at least the given number of runs in a column.
+/// \param column Column to be grown.
+/// \param count Number of runs.
+/// \return 0 on success, -1 if there is not enough memory
+static int reserve(rle_column_t *column, int count);
+
+/// Replaces a range of runs of a column, merging neighbours of the same
+/// color.
+/// \param column Column to be changed.
+/// \param first First run to be replaced.
+/// \param end Run after the last one to be replaced.
+/// \param runs New runs, sorted by their first rows.
+/// \param n Number of new runs.
+/// \return 0 on success, -1 if there is not enough memory
+static int splice(rle_column_t *column, int first, int end,
+                  const rle_run_t *runs, int n);
+
+/// Recolors a whole run of old_color of the given column containing a row
+/// and queues it.
+/// \param arena Arena.
+/// \param queue Queue of the fill.
+/// \param x X-coordinate of the column.
+/// \param y Row within the screen.
+/// \param old_color Color of the area.
+/// \param new_color Color the area gets.
+/// \param last Output, last row of the run containing y.
+/// \return number of filled pixels, 0 if the row is not of old_color, -1
+/// if there is not enough memory
+static int fill_run(rle_arena_t *arena, span_queue_t *queue, int x, int y,
+                    rgb565_t old_color, rgb565_t new_color, int *last);
+
+/// <------------ End implementation functions declaration ------------>
+
+int rle_init(rle_arena_t *arena, rgb565_t color)
+{
+    memset(arena, 0, sizeof(*arena));
+
+    for (int x = 0; x < SCREEN_WIDTH; ++x) {
+        rle_column_t *column = &arena->columns[x];
+        if (reserve(column, 1)) {
+            rle_free(arena);
+            return -1;
+        }
+        column->runs[0].y = 0;
+        column->runs[0].color = color;
+        column->count = 1;
+    }
+
+    return 0;
+}
+
+void rle_free(rle_arena_t *arena)
+{
+    for (int x = 0; x < SCREEN_WIDTH; ++x) {
+        free(arena->columns[x].runs);
+        arena->columns[x].runs = NULL;
+        arena->columns[x].count = arena->columns[x].capacity = 0;
+    }
+}
+
+int rle_encode(rle_arena_t *arena,
+               const rgb565_t background[SCREEN_WIDTH][SCREEN_HEIGHT])
+{
+    for (int x = 0; x < SCREEN_WIDTH; ++x) {
+        rle_column_t *column = &arena->columns[x];
+        const rgb565_t *pixels = background[x];
+
+        int count = 1;
+        for (int y = 1; y < SCREEN_HEIGHT; ++y) {
+            count += pixels[y] != pixels[y - 1];
+        }
+        if (reserve(column, count)) {
+            return -1;
+        }
+
+        column->count = 0;
+        for (int y = 0; y < SCREEN_HEIGHT; ++y) {
+            if (y == 0 || pixels[y] != pixels[y - 1]) {
+                column->runs[column->count].y = y;
+                column->runs[column->count].color = pixels[y];
+                ++column->count;
+            }
+        }
+    }
+
+    return 0;
+}
+
+void rle_decode(const rle_arena_t *arena,
+                rgb565_t background[SCREEN_WIDTH][SCREEN_HEIGHT])
+{
+    for (int x = 0; x < SCREEN_WIDTH; ++x) {
+        const rle_column_t *column = &arena->columns[x];
+        for (int i = 0; i < column->count; ++i) {
+            int n = rle_last(column, i) - column->runs[i].y + 1;
+            fb_fill(&background[x][column->runs[i].y], n, n, 1,
+                    column->runs[i].color);
+        }
+    }
+}
+
+int rle_copy(rle_arena_t *dst, const rle_arena_t *src)
+{
+    for (int x = 0; x < SCREEN_WIDTH; ++x) {
+        const rle_column_t *from = &src->columns[x];
+        rle_column_t *to = &dst->columns[x];
+
+        if (reserve(to, from->count)) {
+            return -1;
+        }
+        memcpy(to->runs, from->runs, from->count * sizeof(rle_run_t));
+        to->count = from->count;
+    }
+
+    return 0;
+}
+
+rgb565_t rle_cell(const rle_arena_t *arena, int x, int y)
+{
+    if (x < 0 || x >= SCREEN_WIDTH || y < 0 || y >= SCREEN_HEIGHT) {
+        return BORDER_COLOR;
+    }
+
+    const rle_column_t *column = &arena->columns[x];
+
+    return column->runs[rle_find(column, y)].color;
+}
+
+int rle_find(const rle_column_t *column, int y)
+{
+    // The last run starting at or above y.
+    int lo = 0, hi = column->count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (column->runs[mid].y <= y) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    return lo;
+}
+
+int rle_last(const rle_column_t *column, int i)
+{
+    return i + 1 < column->count ? column->runs[i + 1].y - 1
+        : SCREEN_HEIGHT - 1;
+}
+
+int rle_set_cells(rle_arena_t *arena, int x, int y, int n, rgb565_t color)
+{
+    rle_column_t *column = &arena->columns[x];
+    int y2 = y + n - 1;
+    int a = rle_find(column, y), b = rle_find(column, y2);
+
+    // The replaced runs with their neighbours, which may merge with the
+    // new one.
+    int first = a > 0 ? a - 1 : a;
+    int end = b + 1 < column->count ? b + 2 : b + 1;
+    rle_run_t runs[5];
+    int count = 0;
+    if (first < a) {
+        runs[count++] = column->runs[first];
+    }
+    if (column->runs[a].y < y) {
+        runs[count++] = column->runs[a];
+    }
+    runs[count++] = (rle_run_t){y, color};
+    if (y2 < rle_last(column, b)) {
+        runs[count++] = (rle_run_t){y2 + 1, column->runs[b].color};
+    }
+    if (end > b + 1) {
+        runs[count++] = column->runs[b + 1];
+    }
+
+    int merged = 0;
+    for (int i = 0; i < count; ++i) {
+        if (merged == 0 || runs[i].color != runs[merged - 1].color) {
+            runs[merged++] = runs[i];
+        }
+    }
+
+    return splice(column, first, end, runs, merged);
+}
+
+int rle_fill_area(rle_arena_t *arena, int x, int y, rgb565_t old_color,
+                  rgb565_t new_color)
+{
+    if (old_color == new_color || rle_cell(arena, x, y) != old_color) {
+        return 0;
+    }
+
+    span_queue_t queue = {0};
+    int last;
+    int done = fill_run(arena, &queue, x, y, old_color, new_color, &last);
+
+    // Runs are recolored when queued, so every pixel is queued at most once.
+    while (done >= 0 && queue.head < queue.tail) {
+        uint32_t span = queue.spans[queue.head++];
+        int sx = span >> SPAN_X_SHIFT;
+        int y1 = span >> SPAN_Y_SHIFT & SPAN_Y_MASK, y2 = span & SPAN_Y_MASK;
+
+        for (int nx = sx - 1; nx <= sx + 1 && done >= 0; nx += 2) {
+            if (nx < 0 || nx >= SCREEN_WIDTH) {
+                continue;
+            }
+            for (int ny = y1; ny <= y2 && done >= 0; ny = last + 1) {
+                int filled = fill_run(arena, &queue, nx, ny, old_color,
+                                      new_color, &last);
+                done = filled < 0 ? -1 : done + filled;
+            }
+        }
+    }
+    free(queue.spans);
+
+    return done;
+}
+
+size_t rle_bytes(const rle_arena_t *arena)
+{
+    size_t bytes = sizeof(*arena);
+
+    for (int x = 0; x < SCREEN_WIDTH; ++x) {
+        bytes += arena->columns[x].capacity * sizeof(rle_run_t);
+    }
+
+    return bytes;
+}
+
+static int reserve(rle_column_t *column, int count)
+{
+    if (count <= column->capacity) {
+        return 0;
+    }
+
+    int capacity = column->capacity * 2;
+    if (capacity < count) {
+        capacity = count;
+    }
+    if (capacity < MIN_CAPACITY) {
+        capacity = MIN_CAPACITY;
+    }
+
+    rle_run_t *runs = realloc(column->runs, capacity * sizeof(rle_run_t));
+    if (!runs) {
+        return -1;
+    }
+    column->runs = runs;
+    column->capacity = capacity;
+
+    return 0;
+}
+
+static int splice(rle_column_t *column, int first, int end,
+                  const rle_run_t *runs, int n)
+{
+    int count = column->count - (end - first) + n;
+    if (reserve(column, count)) {
+        return -1;
+    }
+
+    memmove(&column->runs[first + n], &column->runs[end],
+            (column->count - end) * sizeof(rle_run_t));
+    memcpy(&column->runs[first], runs, n * sizeof(rle_run_t));
+    column->count = count;
+
+    return 0;
+}
+
+static int fill_run(rle_arena_t *arena, span_queue_t *queue, int x, int y,
+                    rgb565_t old_color, rgb565_t new_color, int *last)
+{
+    const rle_column_t *column = &arena->columns[x];
+    int i = rle_find(column, y);
+    int y1 = column->runs[i].y;
+
+    *last = rle_last(column, i);
+    if (column->runs[i].color != old_color) {
+        return 0;
+    }
+
+    if (queue->tail == queue->capacity) {
+        int capacity = queue->capacity ? queue->capacity * 2 : SCREEN_WIDTH;
+        uint32_t *spans = realloc(queue->spans, capacity * sizeof(uint32_t));
+        if (!spans) {
+            return -1;
+        }
+        queue->spans = spans;
+        queue->capacity = capacity;
+    }
+    queue->spans[queue->tail++] = (uint32_t)x << SPAN_X_SHIFT
+        | (uint32_t)y1 << SPAN_Y_SHIFT | *last;
+
+    int n = *last - y1 + 1;
+    if (rle_set_cells(arena, x, y1, n, new_color)) {
+        return -1;
+    }
+
+    return n;
+}
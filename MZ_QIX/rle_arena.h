@@ -0,0 +1,113 @@
+/// \file rle_arena.h
+/// Run-length encoded arena, an alternative to the flat background array
+/// of qix_state_t. The arena is column-major, so every column is stored as
+/// its runs of one color sorted from the top; most columns of a game are
+/// a few runs of border, fill and background. The operations mirror the
+/// ones the core does on the flat array: reading a pixel, writing a span
+/// of a column and filling a connected area. territory.h puts it behind
+/// the same interface as the flat array; a game keeps it next to the flat
+/// array with rle_territory of qix_params_t. qix_bench.c compares both.
+
+#ifndef RLE_ARENA_H_INCLUDED
+#define RLE_ARENA_H_INCLUDED
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "mapping.h"
+
+#include <stddef.h>
+
+/// Run of pixels of one color, it lasts until the next run starts.
+typedef struct {
+    uint16_t y; ///< First row of the run.
+    rgb565_t color; ///< Color of the run.
+} rle_run_t;
+
+/// One column of the arena.
+typedef struct {
+    rle_run_t *runs; ///< Runs sorted by their first rows, the first one
+                     /// starts at row 0 and neighbours differ in color.
+    int count; ///< Number of runs.
+    int capacity; ///< Number of runs runs has room for.
+} rle_column_t;
+
+/// Arena of the size of the screen stored as runs of its columns.
+typedef struct {
+    rle_column_t columns[SCREEN_WIDTH]; ///< Columns from the left.
+} rle_arena_t;
+
+/// Initializes an arena of one color.
+/// \param arena Arena to be initialized.
+/// \param color Color of every pixel.
+/// \return 0 on success, -1 if there is not enough memory
+int rle_init(rle_arena_t *arena, rgb565_t color);
+
+/// Frees the runs of an arena.
+/// \param arena Arena initialized by rle_init().
+void rle_free(rle_arena_t *arena);
+
+/// Encodes a flat column-major arena, like the background of qix_state_t.
+/// \param arena Initialized arena to be overwritten.
+/// \param background Pixels of the arena.
+/// \return 0 on success, -1 if there is not enough memory
+int rle_encode(rle_arena_t *arena,
+               const rgb565_t background[SCREEN_WIDTH][SCREEN_HEIGHT]);
+
+/// Decodes an arena into a flat column-major one.
+/// \param arena Arena to be decoded.
+/// \param background Output, pixels of the arena.
+void rle_decode(const rle_arena_t *arena,
+                rgb565_t background[SCREEN_WIDTH][SCREEN_HEIGHT]);
+
+/// Copies an arena, e.g. to keep a snapshot of it.
+/// \param dst Initialized arena to be overwritten.
+/// \param src Arena to be copied.
+/// \return 0 on success, -1 if there is not enough memory
+int rle_copy(rle_arena_t *dst, const rle_arena_t *src);
+
+/// Get the color of a pixel, in logarithmic time of the runs of its column.
+/// \param arena Arena.
+/// \param x X-coordinate of the pixel.
+/// \param y Y-coordinate of the pixel.
+/// \return color of the pixel, BORDER_COLOR if outside of the arena
+rgb565_t rle_cell(const rle_arena_t *arena, int x, int y);
+
+/// Get the run of a column containing a row.
+/// \param column Column of an arena.
+/// \param y Row within the screen.
+/// \return index of the run
+int rle_find(const rle_column_t *column, int y);
+
+/// Get the last row of a run.
+/// \param column Column of an arena.
+/// \param i Index of the run.
+/// \return last row of the run
+int rle_last(const rle_column_t *column, int i);
+
+/// Writes one color into a run of pixels of one column, merging it with
+/// the runs around of the same color.
+/// \param arena Arena.
+/// \param x X-coordinate of the column.
+/// \param y Y-coordinate of the first pixel.
+/// \param n Number of pixels, the run has to lie within the screen.
+/// \param color New color of the pixels.
+/// \return 0 on success, -1 if there is not enough memory
+int rle_set_cells(rle_arena_t *arena, int x, int y, int n, rgb565_t color);
+
+/// Fills the area of old_color connected to the given pixel with new_color,
+/// like qix_fill_area(), run by run instead of pixel by pixel.
+/// \param arena Arena.
+/// \param x X-coordinate of the starting pixel.
+/// \param y Y-coordinate of the starting pixel.
+/// \param old_color Color of the area.
+/// \param new_color Color the area gets.
+/// \return number of filled pixels, -1 if there is not enough memory
+int rle_fill_area(rle_arena_t *arena, int x, int y, rgb565_t old_color,
+                  rgb565_t new_color);
+
+/// Get the memory taken by an arena, with the room reserved for its runs.
+/// \param arena Arena.
+/// \return size in bytes
+size_t rle_bytes(const rle_arena_t *arena);
+
+#endif // RLE_ARENA_H_INCLUDED
@@ -0,0 +1,13 @@
+/// \file span.h
+/// Packing of the vertical spans of pixels queued and stacked by the fills
+/// of the arena, of qix_core.c, rle_arena.c and territory.c alike. A span
+/// is x << SPAN_X_SHIFT | first y << SPAN_Y_SHIFT | last y in 32 bits.
+
+#ifndef SPAN_H_INCLUDED
+#define SPAN_H_INCLUDED
+
+#define SPAN_X_SHIFT 20 ///< Shift of the column of a span.
+#define SPAN_Y_SHIFT 10 ///< Shift of the first row of a span.
+#define SPAN_Y_MASK 0x3ff ///< Mask of one row of a span.
+
+#endif // SPAN_H_INCLUDED
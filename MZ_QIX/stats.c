@@ -0,0 +1,117 @@
+#include "stats.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NSEC_PER_SEC 1000000000LL
+#define RSS_PERIOD_NS NSEC_PER_SEC
+
+static qix_stats_t *stats = NULL;
+static long long rss_read_ns = 0;
+
+/// <------------ Start implementation functions declaration ------------>
+
+/// Get the current time of the monotonic clock.
+/// \return time in nanoseconds
+static long long monotonic_ns();
+
+/// Get the resident memory of the process.
+/// \return resident memory in bytes, 0 if it cannot be read
+static uint64_t resident_bytes();
+
+/// <------------ End implementation functions declaration ------------>
+
+int stats_open()
+{
+    int fd = shm_open(QIX_STATS_SHM, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR
+                      | S_IRGRP | S_IROTH);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (ftruncate(fd, sizeof(qix_stats_t))) {
+        close(fd);
+        return -1;
+    }
+
+    void *mem = mmap(NULL, sizeof(qix_stats_t), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        return -1;
+    }
+
+    stats = mem;
+    memset(stats, 0, sizeof(qix_stats_t));
+    stats->version = QIX_STATS_VERSION;
+    stats->size = sizeof(qix_stats_t);
+    // Readers check the magic last, so it goes last.
+    __atomic_store_n(&stats->magic, QIX_STATS_MAGIC, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+qix_stats_t *stats_begin_update()
+{
+    if (!stats) {
+        return NULL;
+    }
+
+    __atomic_store_n(&stats->seq, stats->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    return stats;
+}
+
+void stats_end_update()
+{
+    long long now = monotonic_ns();
+    stats->updated_ns = now;
+
+    // Reading /proc is too slow for every frame.
+    if (now - rss_read_ns >= RSS_PERIOD_NS) {
+        stats->rss_bytes = resident_bytes();
+        rss_read_ns = now;
+    }
+
+    __atomic_store_n(&stats->seq, stats->seq + 1, __ATOMIC_RELEASE);
+}
+
+void stats_close()
+{
+    if (!stats) {
+        return;
+    }
+
+    munmap(stats, sizeof(qix_stats_t));
+    stats = NULL;
+    shm_unlink(QIX_STATS_SHM);
+}
+
+static long long monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static uint64_t resident_bytes()
+{
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) {
+        return 0;
+    }
+
+    unsigned long size, resident;
+    int n = fscanf(f, "%lu %lu", &size, &resident);
+    fclose(f);
+
+    return n == 2 ? (uint64_t)resident * sysconf(_SC_PAGESIZE) : 0;
+}
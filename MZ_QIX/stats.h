@@ -0,0 +1,70 @@
+/// \file stats.h
+/// Statistics of the running game published in POSIX shared memory, read
+/// live by qixtop. The game is the only writer and guards every update
+/// with a sequence lock, so readers never block it: a reader copies the
+/// struct and retries if the sequence was odd or has changed meanwhile.
+
+#ifndef STATS_H_INCLUDED
+#define STATS_H_INCLUDED
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdint.h>
+
+#define QIX_STATS_SHM "/qix_stats" ///< Name of the shared memory segment.
+#define QIX_STATS_MAGIC 0x54535851 ///< "QXST"
+#define QIX_STATS_VERSION 1 ///< Bumped on incompatible changes; compatible
+                            /// additions go at the end and grow size.
+#define QIX_STATS_NINPUTS 8 ///< Number of input_t values.
+
+/// Phases of one iteration of the game loop.
+typedef enum qix_stats_phase_t {
+    QIX_STATS_INPUT, ///< Reading the knobs.
+    QIX_STATS_UPDATE, ///< Simulation steps.
+    QIX_STATS_COMPOSE, ///< Drawing into the screen buffer.
+    QIX_STATS_SLEEP, ///< Waiting for the next tick.
+    QIX_STATS_NPHASES ///< Number of phases.
+} qix_stats_phase_t;
+
+/// Layout of the shared memory segment.
+typedef struct {
+    uint32_t magic; ///< QIX_STATS_MAGIC.
+    uint32_t version; ///< QIX_STATS_VERSION.
+    uint32_t size; ///< Size of this struct as written by the game.
+    uint32_t seq; ///< Sequence lock, odd while an update is in progress.
+
+    uint64_t updated_ns; ///< Monotonic time of the last update.
+    uint64_t frames; ///< Iterations of the game loop.
+    uint64_t frames_pushed; ///< Frames submitted to the LCD.
+    uint64_t steps; ///< Simulation steps.
+    uint64_t phase_ns[QIX_STATS_NPHASES]; ///< Total time of every phase.
+    uint64_t max_frame_ns; ///< The longest iteration without sleep.
+    uint64_t lcd_push_ns; ///< Length of the last LCD push.
+    uint64_t captures; ///< Number of captures.
+    uint64_t captured_px; ///< Pixels captured in total.
+    uint64_t last_capture_ns; ///< Length of the last capturing step.
+    uint64_t max_capture_ns; ///< The longest capturing step.
+    uint64_t inputs[QIX_STATS_NINPUTS]; ///< Number of inputs of every kind,
+                                        /// indexed by input_t.
+    uint64_t rss_bytes; ///< Resident memory of the game.
+    int32_t score; ///< Score of the current game.
+    int32_t hp; ///< HP of the player.
+    int32_t nqixes; ///< Number of qixes.
+    int32_t in_game; ///< 1 while a game is running, 0 in menus.
+} qix_stats_t;
+
+/// Creates the shared memory segment.
+/// \return 0 on success, -1 otherwise (updates are then skipped)
+int stats_open();
+
+/// Starts an update of the statistics.
+/// \return statistics to be modified, NULL if the segment is not open
+qix_stats_t *stats_begin_update();
+
+/// Finishes the update started by stats_begin_update().
+void stats_end_update();
+
+/// Removes the shared memory segment.
+void stats_close();
+
+#endif // STATS_H_INCLUDED
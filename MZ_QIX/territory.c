@@ -0,0 +1,312 @@
+#include "territory.h"
+#include "qix_core.h"
+#include "fb.h"
+#include "span.h"
+
+#include <stdlib.h>
+
+#define MIN_CAPACITY 64 ///< Spans a fill stack gets room for at least.
+
+/// Stack of column spans of a fill of the flat backend.
+typedef struct {
+    uint32_t *spans; ///< Stacked spans.
+    int count; ///< Number of stacked spans.
+    int capacity; ///< Number of spans spans has room for.
+} span_stack_t;
+
+/// <------------ Start implementation functions declaration ------------>
+
+/// Get the color of a pixel of a flat arena.
+/// \param arena Flat column-major arena.
+/// \param x X-coordinate of the pixel.
+/// \param y Y-coordinate of the pixel.
+/// \return color of the pixel, BORDER_COLOR if outside of the arena
+static rgb565_t flat_cell(const void *arena, int x, int y);
+
+/// Writes one color into a run of pixels of one column of a flat arena.
+/// \param arena Flat column-major arena.
+/// \param x X-coordinate of the column.
+/// \param y Y-coordinate of the first pixel.
+/// \param n Number of pixels.
+/// \param color New color of the pixels.
+/// \return 0
+static int flat_set_cells(void *arena, int x, int y, int n, rgb565_t color);
+
+/// Fills the area of old_color connected to a pixel of a flat arena, span
+/// by span of its columns.
+/// \param arena Flat column-major arena.
+/// \param x X-coordinate of the starting pixel.
+/// \param y Y-coordinate of the starting pixel.
+/// \param old_color Color of the area.
+/// \param new_color Color the area gets.
+/// \return number of filled pixels, -1 if there is not enough memory
+static int flat_fill_area(void *arena, int x, int y, rgb565_t old_color,
+                          rgb565_t new_color);
+
+/// Recolors the whole span of old_color of a column of a flat arena
+/// containing a row and stacks it.
+/// \param background Flat column-major arena.
+/// \param stack Stack of the fill.
+/// \param x X-coordinate of the column.
+/// \param y Row within the screen.
+/// \param old_color Color of the area.
+/// \param new_color Color the area gets.
+/// \param last Output, last row of the span, y if the row is not of
+/// old_color.
+/// \return number of filled pixels, -1 if there is not enough memory
+static int fill_span(rgb565_t (*background)[SCREEN_HEIGHT],
+                     span_stack_t *stack, int x, int y, rgb565_t old_color,
+                     rgb565_t new_color, int *last);
+
+/// Get the pixels of a rectangle of a flat arena, in place.
+/// \param arena Flat column-major arena.
+/// \param x X-coordinate of the left column.
+/// \param y Y-coordinate of the top row.
+/// \param w Width.
+/// \param h Height.
+/// \param buffer Unused.
+/// \param stride Output, SCREEN_HEIGHT.
+/// \return first pixel of the left column
+static const rgb565_t *flat_block(const void *arena, int x, int y, int w,
+                                  int h, rgb565_t *buffer, int *stride);
+
+/// Get the memory taken by a flat arena.
+/// \param arena Flat column-major arena.
+/// \return size in bytes
+static size_t flat_bytes(const void *arena);
+
+/// rle_cell() for the operations of the RLE backend.
+static rgb565_t rle_op_cell(const void *arena, int x, int y);
+
+/// rle_set_cells() for the operations of the RLE backend.
+static int rle_op_set_cells(void *arena, int x, int y, int n,
+                            rgb565_t color);
+
+/// rle_fill_area() for the operations of the RLE backend.
+static int rle_op_fill_area(void *arena, int x, int y, rgb565_t old_color,
+                            rgb565_t new_color);
+
+/// Decodes a rectangle of a run-length encoded arena, run by run.
+/// \param arena Run-length encoded arena.
+/// \param x X-coordinate of the left column.
+/// \param y Y-coordinate of the top row.
+/// \param w Width.
+/// \param h Height.
+/// \param buffer Output, w columns of h pixels.
+/// \param stride Output, h.
+/// \return buffer
+static const rgb565_t *rle_op_block(const void *arena, int x, int y, int w,
+                                    int h, rgb565_t *buffer, int *stride);
+
+/// rle_bytes() for the operations of the RLE backend.
+static size_t rle_op_bytes(const void *arena);
+
+/// <------------ End implementation functions declaration ------------>
+
+static const territory_ops_t flat_ops = {
+    flat_cell, flat_set_cells, flat_fill_area, flat_block, flat_bytes
+};
+
+static const territory_ops_t rle_ops = {
+    rle_op_cell, rle_op_set_cells, rle_op_fill_area, rle_op_block,
+    rle_op_bytes
+};
+
+void territory_flat(territory_t *territory,
+                    rgb565_t background[SCREEN_WIDTH][SCREEN_HEIGHT])
+{
+    territory->ops = &flat_ops;
+    territory->arena = background;
+}
+
+void territory_rle(territory_t *territory, rle_arena_t *arena)
+{
+    territory->ops = &rle_ops;
+    territory->arena = arena;
+}
+
+rgb565_t territory_cell(const territory_t *territory, int x, int y)
+{
+    return territory->ops->cell(territory->arena, x, y);
+}
+
+int territory_set_cells(territory_t *territory, int x, int y, int n,
+                        rgb565_t color)
+{
+    return territory->ops->set_cells(territory->arena, x, y, n, color);
+}
+
+int territory_fill_area(territory_t *territory, int x, int y,
+                        rgb565_t old_color, rgb565_t new_color)
+{
+    return territory->ops->fill_area(territory->arena, x, y, old_color,
+                                     new_color);
+}
+
+const rgb565_t *territory_block(const territory_t *territory, int x, int y,
+                                int w, int h, rgb565_t *buffer, int *stride)
+{
+    return territory->ops->block(territory->arena, x, y, w, h, buffer,
+                                 stride);
+}
+
+size_t territory_bytes(const territory_t *territory)
+{
+    return territory->ops->bytes(territory->arena);
+}
+
+static rgb565_t flat_cell(const void *arena, int x, int y)
+{
+    const rgb565_t (*background)[SCREEN_HEIGHT] = arena;
+
+    if (x < 0 || x >= SCREEN_WIDTH || y < 0 || y >= SCREEN_HEIGHT) {
+        return BORDER_COLOR;
+    }
+
+    return background[x][y];
+}
+
+static int flat_set_cells(void *arena, int x, int y, int n, rgb565_t color)
+{
+    rgb565_t (*background)[SCREEN_HEIGHT] = arena;
+
+    fb_fill(&background[x][y], n, n, 1, color);
+
+    return 0;
+}
+
+static int flat_fill_area(void *arena, int x, int y, rgb565_t old_color,
+                          rgb565_t new_color)
+{
+    rgb565_t (*background)[SCREEN_HEIGHT] = arena;
+
+    if (old_color == new_color || flat_cell(arena, x, y) != old_color) {
+        return 0;
+    }
+
+    span_stack_t stack = {0};
+    int last;
+    int done = fill_span(background, &stack, x, y, old_color, new_color,
+                         &last);
+
+    // Spans are recolored when stacked, so every pixel is stacked at most
+    // once.
+    while (done >= 0 && stack.count > 0) {
+        uint32_t span = stack.spans[--stack.count];
+        int sx = span >> SPAN_X_SHIFT;
+        int y1 = span >> SPAN_Y_SHIFT & SPAN_Y_MASK, y2 = span & SPAN_Y_MASK;
+
+        for (int nx = sx - 1; nx <= sx + 1 && done >= 0; nx += 2) {
+            if (nx < 0 || nx >= SCREEN_WIDTH) {
+                continue;
+            }
+            for (int ny = y1; ny <= y2 && done >= 0; ny = last + 1) {
+                int filled = fill_span(background, &stack, nx, ny, old_color,
+                                       new_color, &last);
+                done = filled < 0 ? -1 : done + filled;
+            }
+        }
+    }
+    free(stack.spans);
+
+    return done;
+}
+
+static int fill_span(rgb565_t (*background)[SCREEN_HEIGHT],
+                     span_stack_t *stack, int x, int y, rgb565_t old_color,
+                     rgb565_t new_color, int *last)
+{
+    rgb565_t *column = background[x];
+
+    *last = y;
+    if (column[y] != old_color) {
+        return 0;
+    }
+
+    int y1 = y, y2 = y;
+    while (y1 > 0 && column[y1 - 1] == old_color) {
+        --y1;
+    }
+    while (y2 < SCREEN_HEIGHT - 1 && column[y2 + 1] == old_color) {
+        ++y2;
+    }
+
+    if (stack->count == stack->capacity) {
+        int capacity = stack->capacity ? stack->capacity * 2 : MIN_CAPACITY;
+        uint32_t *spans = realloc(stack->spans, capacity * sizeof(uint32_t));
+        if (!spans) {
+            return -1;
+        }
+        stack->spans = spans;
+        stack->capacity = capacity;
+    }
+    stack->spans[stack->count++] = (uint32_t)x << SPAN_X_SHIFT
+        | (uint32_t)y1 << SPAN_Y_SHIFT | y2;
+
+    fb_fill(&column[y1], y2 - y1 + 1, y2 - y1 + 1, 1, new_color);
+    *last = y2;
+
+    return y2 - y1 + 1;
+}
+
+static const rgb565_t *flat_block(const void *arena, int x, int y, int w,
+                                  int h, rgb565_t *buffer, int *stride)
+{
+    const rgb565_t (*background)[SCREEN_HEIGHT] = arena;
+    (void)w;
+    (void)h;
+    (void)buffer;
+
+    *stride = SCREEN_HEIGHT;
+
+    return &background[x][y];
+}
+
+static size_t flat_bytes(const void *arena)
+{
+    (void)arena;
+
+    return SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(rgb565_t);
+}
+
+static rgb565_t rle_op_cell(const void *arena, int x, int y)
+{
+    return rle_cell(arena, x, y);
+}
+
+static int rle_op_set_cells(void *arena, int x, int y, int n,
+                            rgb565_t color)
+{
+    return rle_set_cells(arena, x, y, n, color);
+}
+
+static int rle_op_fill_area(void *arena, int x, int y, rgb565_t old_color,
+                            rgb565_t new_color)
+{
+    return rle_fill_area(arena, x, y, old_color, new_color);
+}
+
+static const rgb565_t *rle_op_block(const void *arena, int x, int y, int w,
+                                    int h, rgb565_t *buffer, int *stride)
+{
+    const rle_arena_t *rle = arena;
+
+    for (int c = 0; c < w; ++c) {
+        const rle_column_t *column = &rle->columns[x + c];
+        rgb565_t *pixels = &buffer[c * h];
+        for (int row = y, i = rle_find(column, y); row < y + h; ++i) {
+            int last = rle_last(column, i);
+            int n = (last < y + h ? last + 1 : y + h) - row;
+            fb_fill(&pixels[row - y], n, n, 1, column->runs[i].color);
+            row += n;
+        }
+    }
+    *stride = h;
+
+    return buffer;
+}
+
+static size_t rle_op_bytes(const void *arena)
+{
+    return rle_bytes(arena);
+}
@@ -0,0 +1,106 @@
+/// \file territory.h
+/// Accessors of the arena behind one interface, so its readers do not care
+/// how it is stored. Two backends come with it: the flat column-major array
+/// of qix_state_t and the run-length encoded arena of rle_arena.h. The core
+/// reads its collisions and render.c its tiles through the territory of
+/// the state. It is the flat array unless rle_territory of qix_params_t
+/// asks for the encoded one, which every write of the core then goes to
+/// as well; the search and fill kernels of a capture stay on the flat
+/// array, since they pair every pixel with its mark.
+
+#ifndef TERRITORY_H_INCLUDED
+#define TERRITORY_H_INCLUDED
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "mapping.h"
+#include "rle_arena.h"
+
+#include <stddef.h>
+
+/// Operations of one backend, the arena is passed as the first argument.
+typedef struct {
+    /// Get the color of a pixel, BORDER_COLOR if outside of the arena.
+    rgb565_t (*cell)(const void *arena, int x, int y);
+    /// Writes one color into a run of pixels of one column within the
+    /// screen, returns 0 on success, -1 if there is not enough memory.
+    int (*set_cells)(void *arena, int x, int y, int n, rgb565_t color);
+    /// Fills the area of old_color connected to a pixel with new_color,
+    /// returns the number of filled pixels, -1 if there is not enough
+    /// memory.
+    int (*fill_area)(void *arena, int x, int y, rgb565_t old_color,
+                     rgb565_t new_color);
+    /// Get the pixels of a rectangle within the screen column by column,
+    /// either from the arena itself or decoded into the buffer of w * h
+    /// pixels; stride gets the distance of the columns.
+    const rgb565_t *(*block)(const void *arena, int x, int y, int w, int h,
+                             rgb565_t *buffer, int *stride);
+    /// Get the memory taken by the arena in bytes.
+    size_t (*bytes)(const void *arena);
+} territory_ops_t;
+
+/// Arena together with the operations of its backend.
+typedef struct {
+    const territory_ops_t *ops; ///< Operations of the backend.
+    void *arena; ///< Arena the operations work on.
+} territory_t;
+
+/// Sets a territory over a flat column-major arena, like the background of
+/// qix_state_t. The arena is not copied.
+/// \param territory Territory to be set.
+/// \param background Pixels of the arena.
+void territory_flat(territory_t *territory,
+                    rgb565_t background[SCREEN_WIDTH][SCREEN_HEIGHT]);
+
+/// Sets a territory over a run-length encoded arena. The arena is not
+/// copied.
+/// \param territory Territory to be set.
+/// \param arena Initialized arena.
+void territory_rle(territory_t *territory, rle_arena_t *arena);
+
+/// Get the color of a pixel.
+/// \param territory Territory.
+/// \param x X-coordinate of the pixel.
+/// \param y Y-coordinate of the pixel.
+/// \return color of the pixel, BORDER_COLOR if outside of the arena
+rgb565_t territory_cell(const territory_t *territory, int x, int y);
+
+/// Writes one color into a run of pixels of one column.
+/// \param territory Territory.
+/// \param x X-coordinate of the column.
+/// \param y Y-coordinate of the first pixel.
+/// \param n Number of pixels, the run has to lie within the screen.
+/// \param color New color of the pixels.
+/// \return 0 on success, -1 if there is not enough memory
+int territory_set_cells(territory_t *territory, int x, int y, int n,
+                        rgb565_t color);
+
+/// Fills the area of old_color connected to the given pixel with
+/// new_color. Unlike qix_fill_area(), no summary of a state is kept.
+/// \param territory Territory.
+/// \param x X-coordinate of the starting pixel.
+/// \param y Y-coordinate of the starting pixel.
+/// \param old_color Color of the area.
+/// \param new_color Color the area gets.
+/// \return number of filled pixels, -1 if there is not enough memory
+int territory_fill_area(territory_t *territory, int x, int y,
+                        rgb565_t old_color, rgb565_t new_color);
+
+/// Get the pixels of a rectangle column by column.
+/// \param territory Territory.
+/// \param x X-coordinate of the left column.
+/// \param y Y-coordinate of the top row.
+/// \param w Width, the rectangle has to lie within the screen.
+/// \param h Height.
+/// \param buffer Room for w * h pixels the backend may decode into.
+/// \param stride Output, distance of the columns in pixels.
+/// \return first pixel of the left column
+const rgb565_t *territory_block(const territory_t *territory, int x, int y,
+                                int w, int h, rgb565_t *buffer, int *stride);
+
+/// Get the memory taken by the arena of a territory.
+/// \param territory Territory.
+/// \return size in bytes
+size_t territory_bytes(const territory_t *territory);
+
+#endif // TERRITORY_H_INCLUDED
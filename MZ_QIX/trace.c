@@ -0,0 +1,286 @@
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NSEC_PER_SEC 1000000000LL
+#define FLUSH_PERIOD_NS (100 * 1000 * 1000)
+
+/// One recorded event.
+typedef struct {
+    const char *name; ///< Name of the event.
+    const char *arg_name; ///< Name of the argument, NULL for none.
+    long long ts_ns; ///< When the event has happened.
+    long long dur_ns; ///< Length of a complete event.
+    long long arg; ///< Value of the argument.
+    char phase; ///< Chrome phase: 'B', 'E', 'X' or 'i'.
+} event_t;
+
+/// Ring buffer of one thread, written by the thread and read by the
+/// flusher. Indices grow forever and are masked on access.
+typedef struct {
+    event_t events[TRACE_RING_SIZE]; ///< The events.
+    unsigned int head; ///< Next to be written by the owner.
+    unsigned int tail; ///< Next to be read by the flusher.
+    unsigned long dropped; ///< Events lost because the ring was full.
+    const char *name; ///< Name of the thread, NULL if not named.
+    int tid; ///< Thread id shown in the trace.
+} ring_t;
+
+static bool enabled = false;
+static FILE *out = NULL;
+static long long epoch_ns = 0;
+
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static ring_t *rings[TRACE_MAX_THREADS];
+static int nrings = 0;
+static __thread ring_t *my_ring = NULL;
+
+static pthread_t flusher;
+static bool flusher_running = false;
+static bool stopping = false;
+static pthread_cond_t stop_cond = PTHREAD_COND_INITIALIZER;
+
+/// <------------ Start implementation functions declaration ------------>
+
+/// Get the ring of the calling thread, registering it on first use.
+/// \return ring of the thread, NULL if there are too many threads
+static ring_t *thread_ring();
+
+/// Appends an event to the ring of the calling thread.
+/// \param phase Chrome phase of the event.
+/// \param name Name of the event.
+/// \param ts_ns When the event has happened.
+/// \param dur_ns Length of a complete event.
+/// \param arg_name Name of the argument, NULL for none.
+/// \param arg Value of the argument.
+static void record(char phase, const char *name, long long ts_ns,
+                   long long dur_ns, const char *arg_name, long long arg);
+
+/// Writes all the events buffered so far into the trace file.
+static void drain();
+
+/// Entry point of the flusher thread.
+static void *flusher_main(void *arg);
+
+/// <------------ End implementation functions declaration ------------>
+
+int trace_open(const char *path)
+{
+    if (!path) {
+        return 0;
+    }
+
+    out = fopen(path, "w");
+    if (!out) {
+        return -1;
+    }
+
+    epoch_ns = trace_now_ns();
+    fprintf(out, "[\n");
+
+    stopping = false;
+    flusher_running = pthread_create(&flusher, NULL, flusher_main, NULL) == 0;
+    __atomic_store_n(&enabled, true, __ATOMIC_RELEASE);
+    trace_thread_name("main");
+
+    return 0;
+}
+
+void trace_close()
+{
+    if (!__atomic_load_n(&enabled, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    __atomic_store_n(&enabled, false, __ATOMIC_RELEASE);
+
+    if (flusher_running) {
+        pthread_mutex_lock(&rings_lock);
+        stopping = true;
+        pthread_cond_signal(&stop_cond);
+        pthread_mutex_unlock(&rings_lock);
+
+        pthread_join(flusher, NULL);
+        flusher_running = false;
+    }
+
+    drain();
+
+    // Thread names go last, the closing element needs no trailing comma.
+    pthread_mutex_lock(&rings_lock);
+    for (int i = 0; i < nrings; ++i) {
+        fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                "\"tid\":%d,\"args\":{\"name\":\"%s\",\"dropped\":%lu}},\n",
+                rings[i]->tid, rings[i]->name ? rings[i]->name : "thread",
+                rings[i]->dropped);
+    }
+    pthread_mutex_unlock(&rings_lock);
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+            "\"args\":{\"name\":\"qix\"}}\n]\n");
+
+    fclose(out);
+    out = NULL;
+}
+
+void trace_thread_name(const char *name)
+{
+    if (!__atomic_load_n(&enabled, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    ring_t *ring = thread_ring();
+    if (ring) {
+        pthread_mutex_lock(&rings_lock);
+        ring->name = name;
+        pthread_mutex_unlock(&rings_lock);
+    }
+}
+
+long long trace_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+void trace_begin(const char *name)
+{
+    if (__atomic_load_n(&enabled, __ATOMIC_RELAXED)) {
+        record('B', name, trace_now_ns(), 0, NULL, 0);
+    }
+}
+
+void trace_end(const char *name)
+{
+    if (__atomic_load_n(&enabled, __ATOMIC_RELAXED)) {
+        record('E', name, trace_now_ns(), 0, NULL, 0);
+    }
+}
+
+void trace_complete(const char *name, long long start_ns,
+                    const char *arg_name, long long arg)
+{
+    if (__atomic_load_n(&enabled, __ATOMIC_RELAXED)) {
+        record('X', name, start_ns, trace_now_ns() - start_ns, arg_name, arg);
+    }
+}
+
+void trace_instant(const char *name, const char *arg_name, long long arg)
+{
+    if (__atomic_load_n(&enabled, __ATOMIC_RELAXED)) {
+        record('i', name, trace_now_ns(), 0, arg_name, arg);
+    }
+}
+
+static ring_t *thread_ring()
+{
+    if (my_ring) {
+        return my_ring;
+    }
+
+    pthread_mutex_lock(&rings_lock);
+    if (nrings < TRACE_MAX_THREADS) {
+        ring_t *ring = calloc(1, sizeof(ring_t));
+        if (ring) {
+            ring->tid = nrings + 1;
+            rings[nrings++] = ring;
+            my_ring = ring;
+        }
+    }
+    pthread_mutex_unlock(&rings_lock);
+
+    return my_ring;
+}
+
+static void record(char phase, const char *name, long long ts_ns,
+                   long long dur_ns, const char *arg_name, long long arg)
+{
+    ring_t *ring = thread_ring();
+    if (!ring) {
+        return;
+    }
+
+    unsigned int head = ring->head;
+    unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - tail == TRACE_RING_SIZE) {
+        ++ring->dropped;
+        return;
+    }
+
+    event_t *ev = &ring->events[head & (TRACE_RING_SIZE - 1)];
+    ev->name = name;
+    ev->arg_name = arg_name;
+    ev->ts_ns = ts_ns;
+    ev->dur_ns = dur_ns;
+    ev->arg = arg;
+    ev->phase = phase;
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void drain()
+{
+    ring_t *snapshot[TRACE_MAX_THREADS];
+
+    pthread_mutex_lock(&rings_lock);
+    int n = nrings;
+    for (int i = 0; i < n; ++i) {
+        snapshot[i] = rings[i];
+    }
+    pthread_mutex_unlock(&rings_lock);
+
+    for (int i = 0; i < n; ++i) {
+        ring_t *ring = snapshot[i];
+        unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        unsigned int tail = ring->tail;
+
+        for (; tail != head; ++tail) {
+            const event_t *ev = &ring->events[tail & (TRACE_RING_SIZE - 1)];
+            double ts_us = (ev->ts_ns - epoch_ns) / 1000.0;
+
+            fprintf(out, "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+                    "\"pid\":1,\"tid\":%d", ev->name, ev->phase, ts_us,
+                    ring->tid);
+            if (ev->phase == 'X') {
+                fprintf(out, ",\"dur\":%.3f", ev->dur_ns / 1000.0);
+            }
+            if (ev->phase == 'i') {
+                fprintf(out, ",\"s\":\"t\"");
+            }
+            if (ev->arg_name) {
+                fprintf(out, ",\"args\":{\"%s\":%lld}", ev->arg_name, ev->arg);
+            }
+            fprintf(out, "},\n");
+        }
+
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    fflush(out);
+}
+
+static void *flusher_main(void *arg)
+{
+    pthread_mutex_lock(&rings_lock);
+    while (!stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += FLUSH_PERIOD_NS;
+        if (deadline.tv_nsec >= NSEC_PER_SEC) {
+            deadline.tv_nsec -= NSEC_PER_SEC;
+            ++deadline.tv_sec;
+        }
+        pthread_cond_timedwait(&stop_cond, &rings_lock, &deadline);
+
+        pthread_mutex_unlock(&rings_lock);
+        drain();
+        pthread_mutex_lock(&rings_lock);
+    }
+    pthread_mutex_unlock(&rings_lock);
+
+    return NULL;
+}
@@ -0,0 +1,59 @@
+/// \file trace.h
+/// Opt-in tracer of frame phases and game events. Every thread writes into
+/// its own ring buffer without locking, a background thread drains the
+/// rings into a Chrome trace-event JSON file, which can be opened in
+/// chrome://tracing or Perfetto. When tracing is off every call returns
+/// immediately.
+
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#define _POSIX_C_SOURCE 200112L
+
+#define TRACE_ENV "QIX_TRACE" ///< Environment variable with a path of the
+                              /// trace file; tracing is off if it is unset.
+#define TRACE_RING_SIZE 8192 ///< Events buffered per thread, has to be a
+                             /// power of two.
+#define TRACE_MAX_THREADS 8 ///< Number of threads which can be traced.
+
+/// Starts tracing into the given file. Has to be called before the traced
+/// threads are started.
+/// \param path Path to the trace file, NULL keeps tracing off.
+/// \return 0 on success or if tracing is off, -1 if the file cannot be
+/// created
+int trace_open(const char *path);
+
+/// Writes all the buffered events, finishes the file and turns tracing off.
+void trace_close();
+
+/// Names the calling thread in the trace.
+/// \param name Name of the thread, has to be a string literal.
+void trace_thread_name(const char *name);
+
+/// Get the current time of the trace clock, for trace_complete().
+/// \return time in nanoseconds
+long long trace_now_ns();
+
+/// Begins a span on the calling thread.
+/// \param name Name of the span, has to be a string literal.
+void trace_begin(const char *name);
+
+/// Ends the innermost span on the calling thread.
+/// \param name Name of the span, has to be a string literal.
+void trace_end(const char *name);
+
+/// Records a span which has already finished.
+/// \param name Name of the span, has to be a string literal.
+/// \param start_ns Start of the span, see trace_now_ns().
+/// \param arg_name Name of the argument, a string literal or NULL for none.
+/// \param arg Value of the argument.
+void trace_complete(const char *name, long long start_ns,
+                    const char *arg_name, long long arg);
+
+/// Records a discrete event on the calling thread.
+/// \param name Name of the event, has to be a string literal.
+/// \param arg_name Name of the argument, a string literal or NULL for none.
+/// \param arg Value of the argument.
+void trace_instant(const char *name, const char *arg_name, long long arg);
+
+#endif // TRACE_H_INCLUDED